@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+// Converts a cache directory (one file per cell) into a single archive file, or compacts an existing archive.
+// Usage: archive <cache directory> <archive file>
+//        archive --compact <archive file>
+
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+
+#include <eleman/elevationarchive.h>
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		printf("Usage: %s <cache directory> <archive file>\n", argv[0]);
+		printf("       %s --compact <archive file>\n", argv[0]);
+		return 1;
+	}
+
+	try
+	{
+		eleman::ElevationArchive archive(argv[2]);
+		if(std::string(argv[1]) == "--compact")
+		{
+			uint64_t before = archive.fileSize();
+			archive.compact();
+			printf("Compacted %s from %lu to %lu bytes\n", argv[2], (unsigned long)before, (unsigned long)archive.fileSize());
+			return 0;
+		}
+
+		uint64_t count = archive.import(argv[1]);
+		printf("Packed %lu cells into %s (%lu cells, %lu bytes)\n", (unsigned long)count, argv[2], (unsigned long)archive.size(),
+			   (unsigned long)archive.fileSize());
+	}
+	catch(const std::exception& e)
+	{
+		printf("%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+// Batched lookups of randomly scattered positions in input order versus sorted along a space filling curve.
+// Usage: benchmark [cells per side] [queries]
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <eleman/elevationcache.h>
+#include <eleman/elevationmanager.h>
+#include <eleman/elevationutils.h>
+#include <eleman/elevationvendor.h>
+
+// Answers every request locally with a smooth synthetic surface
+class SyntheticVendor : public eleman::ElevationVendor
+{
+public:
+	SyntheticVendor()
+	{
+		setID("synthetic");
+		setName("Synthetic Benchmark Surface");
+		setLocationsPerRequest(65535);
+		setRequestsPerSecond(65535);
+		setRequestsPerDay(65535);
+	}
+
+	eleman::VendorResponse request(std::vector<eleman::Position> positions, std::string /*userAgent*/) const override
+	{
+		eleman::VendorResponse response;
+		response.code = eleman::OK;
+		for(const eleman::Position& pos : positions)
+			response.results.push_back({pos.latitude, pos.longitude, 1000.0 + 300.0 * sin(pos.latitude * 400.0) * cos(pos.longitude * 300.0)});
+		return response;
+	}
+};
+
+static double measure(eleman::ElevationCache& cache, const std::vector<double>& lat, const std::vector<double>& lon,
+					  std::vector<double>& elevation, eleman::ElevationCache::BatchOrder order)
+{
+	cache.setBatchOrder(order);
+	// Warm up once, sizes the reused buffers
+	cache.get(lat.data(), lon.data(), lat.size(), elevation.data());
+
+	const int repetitions = 5;
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < repetitions; i++)
+		cache.get(lat.data(), lon.data(), lat.size(), elevation.data());
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / (repetitions * lat.size());
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t cellsPerSide = argc > 1 ? atoi(argv[1]) : 50;
+	size_t queries = argc > 2 ? atol(argv[2]) : 2000000;
+
+	SyntheticVendor vendor;
+	eleman::ElevationCache cache(100, 10.0);
+	eleman::ElevationManager manager;
+	manager.setCache(&cache);
+	manager.setVendor(&vendor);
+	cache.setManager(&manager);
+
+	// Fill all cells of the area up front, only cache hits are measured
+	const double lat0 = 47.0, lon0 = 12.0;
+	const double lat1 = lat0 + cellsPerSide / 100.0 - 1e-6;
+	const double lon1 = lon0 + cellsPerSide / 100.0 - 1e-6;
+	for(uint64_t id : cache.cellsForRegion(lat0, lon0, lat1, lon1))
+		cache.getCell(id)->precacheCell();
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> latDistribution(lat0, lat1), lonDistribution(lon0, lon1);
+	std::vector<double> lat(queries), lon(queries), elevation(queries);
+	for(size_t i = 0; i < queries; i++)
+	{
+		lat[i] = latDistribution(rng);
+		lon[i] = lonDistribution(rng);
+	}
+
+	double random = measure(cache, lat, lon, elevation, eleman::ElevationCache::INPUT_ORDER);
+	double morton = measure(cache, lat, lon, elevation, eleman::ElevationCache::MORTON_ORDER);
+	double hilbert = measure(cache, lat, lon, elevation, eleman::ElevationCache::HILBERT_ORDER);
+
+	// Reference: input that already arrives sorted
+	std::vector<size_t> order(queries);
+	for(size_t i = 0; i < queries; i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return lat[a] < lat[b]; });
+	std::vector<double> sortedLat(queries), sortedLon(queries);
+	for(size_t i = 0; i < queries; i++)
+	{
+		sortedLat[i] = lat[order[i]];
+		sortedLon[i] = lon[order[i]];
+	}
+	double sorted = measure(cache, sortedLat, sortedLon, elevation, eleman::ElevationCache::INPUT_ORDER);
+
+	printf("\n%u x %u cells (%s), %zu random queries\n", cellsPerSide, cellsPerSide, eleman::formatMemory(cache.memory()).c_str(), queries);
+	printf("random input, input order   %8.1f ns/query\n", random);
+	printf("random input, Morton order  %8.1f ns/query\n", morton);
+	printf("random input, Hilbert order %8.1f ns/query\n", hilbert);
+	printf("input sorted by latitude    %8.1f ns/query\n", sorted);
+	return 0;
+}
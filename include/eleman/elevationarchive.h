@@ -0,0 +1,116 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONARCHIVE_H
+#define ELEVATIONARCHIVE_H
+
+#include "elevationio.h"
+
+#include <filesystem>
+#include <map>
+#include <shared_mutex>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Many cell files packed into a single file with an offset index, instead of one file per cell.
+	 * Cells are grouped in layers, named like the cache subdirectories (vendor/divisions/precision).
+	 * The archive is append only: written cells and the index go to the end of the file and the header is
+	 * switched to the new index last, so readers (threads or other processes) always see a consistent state.
+	 * Replaced cells leave garbage behind until the archive is compacted. Only one process may write at a time.
+	 * Read only archives pick up indices published by the writer on their own, after compaction they have to be
+	 * opened again.
+	 */
+	class ElevationArchive
+	{
+	public:
+		enum Mode {
+			READ_ONLY,
+			READ_WRITE		// Creates the archive if needed
+		};
+
+		ElevationArchive(const std::filesystem::path& filepath, Mode mode = READ_WRITE);
+		ElevationArchive(const ElevationArchive&) = delete;
+		ElevationArchive& operator=(const ElevationArchive&) = delete;
+		// Flushes the index of a writable archive
+		~ElevationArchive();
+
+		// Contents of a cell file, false if the archive does not contain it. Safe to call concurrently.
+		bool read(const std::string& layer, uint64_t cellID, std::vector<uint8_t>& buffer) const;
+		bool contains(const std::string& layer, uint64_t cellID) const;
+		// Written cells are visible to this archive immediately and to other processes after flush().
+		// Cells written since the last flush are lost if the process dies.
+		void write(const std::string& layer, uint64_t cellID, const uint8_t* data, size_t size);
+		void flush();
+
+		// Packs all cell files found below a cache directory into the archive, returns the amount of cells
+		uint64_t import(const std::filesystem::path& cacheDir);
+		// Rewrites the archive without replaced cells and old indices
+		void compact();
+
+		size_t size() const;
+		// Bytes of the archive file, including garbage
+		uint64_t fileSize() const;
+		std::vector<std::pair<std::string, uint64_t>> list() const;
+
+	private:
+		struct Entry
+		{
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		std::filesystem::path filepath;
+		Mode mode;
+		int fd = -1;
+
+		// Reloaded by read only archives once the writer published a new index
+		mutable std::shared_mutex mutex;
+		mutable std::vector<std::string> layers;
+		mutable std::map<std::string, uint32_t> layerIDs;
+		mutable std::map<std::pair<uint32_t, uint64_t>, Entry> index;
+		mutable uint64_t indexOffset = 0;	// Of the loaded index, 0 if there is none
+		mutable uint64_t end = 0;			// Appends start here
+		bool modified = false;
+
+		void open();
+		void close();
+		// Reloads the index if another one was published, read only archives only
+		void refresh() const;
+		void readIndex() const;
+		void writeIndex();
+		uint32_t layerID(const std::string& layer);
+	};
+
+	/**
+	 * ElevationIO storing the cells in an ElevationArchive, format settings are the same as for files.
+	 * Memory mapping is not supported, PAGED cells are read like any other.
+	 * Stored cells are published (and safe from crashes) once the cache flushes, unloads all cells or the archive
+	 * is closed.
+	 */
+	class ElevationArchiveIO : public ElevationIO
+	{
+	public:
+		// The archive has to outlive the IO
+		ElevationArchiveIO(ElevationArchive& archive);
+
+		bool store(ElevationCacheCell& cell) override;
+		bool load(ElevationCacheCell& cell) override;
+		// Writes the index of the archive
+		void flush() override;
+
+		// Layer of a cell inside the archive, matches its directory below the cache directory
+		static std::string getLayer(const ElevationCacheCell& cell);
+
+	private:
+		ElevationArchive& archive;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONARCHIVE_H
@@ -8,8 +8,11 @@
 #include "elevationregion.h"
 
 #include "grid.h"
+#include <atomic>
+#include <functional>
 #include <map>
-// #include <memory>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -26,12 +29,26 @@ namespace eleman
 		double latitude, longitude;
 	};
 
+	// Samples of one cell that changed, published to the update listeners of the cache
+	struct CacheUpdate {
+		uint64_t cellID;
+		uint32_t x0, y0, x1, y1;			// Inclusive grid rectangle inside the cell
+		double lat0, lon0, lat1, lon1;		// Positions of the rectangle corners
+	};
+
 	/**
 	* @todo write docs
 	*/
 	class ElevationCache
 	{
 	public:
+		// Order batched queries visit their positions in, results always keep the input order
+		enum BatchOrder {
+			INPUT_ORDER,
+			MORTON_ORDER,	// Z order curve over the cell coordinates
+			HILBERT_ORDER	// Hilbert curve over the cell coordinates, fewest cell changes
+		};
+
 		/**
 		* Default constructor
 		*/
@@ -52,10 +69,32 @@ namespace eleman
 		ElevationData get(Position pos, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		// TODO request multiple points
 		std::vector<ElevationData> get(const std::vector<Position>& positions, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Batched lookup of count positions into caller owned arrays, status (optional) receives a QueryStatus per position.
+		// Does not allocate once the touched cells are loaded and their samples cached.
+		void get(const double* latitude, const double* longitude, size_t count, double* elevation, uint8_t* status = nullptr,
+				 ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		void get(const double* latitude, const double* longitude, size_t count, float* elevation, uint8_t* status = nullptr,
+				 ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		// TODO request grid of points
 		ElevationRegion get(double lat0, double lon0, double lat1, double lon1, double precision, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		ElevationRegion get(double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		void fillRegion(ElevationRegion& region, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Only fills the inclusive grid rectangle of the region
+		void fillRegion(ElevationRegion& region, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+						ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Fills the region strip by strip (consecutive strips share one row) instead of holding the whole grid,
+		// firstRow is the row of the whole region the strip starts at
+		void streamRegion(double lat0, double lon0, double lat1, double lon1, double precision, uint32_t stripRows,
+						  const std::function<void(const ElevationRegion& strip, uint32_t firstRow)>& callback,
+						  ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Samples every spacing meters along the polyline
+		ElevationProfile profile(const std::vector<Position>& polyline, double spacing, bool climb = false);
+
+		// Extrema of the cached samples inside a box or polygon, missing samples are not requested
+		double minElevation(double latitude0, double longitude0, double latitude1, double longitude1);
+		double maxElevation(double latitude0, double longitude0, double latitude1, double longitude1);
+		double minElevation(const std::vector<Position>& polygon);
+		double maxElevation(const std::vector<Position>& polygon);
 
 		// Precaching
 		uint32_t precacheCells(double latitude0, double longitude0, double latitude1, double longitude1);
@@ -63,6 +102,15 @@ namespace eleman
 		uint32_t precacheRegion(Position pos0, Position pos1);
 		uint32_t precacheRegion(double latitude0, double longitude0, double latitude1, double longitude1);
 
+		// Change notifications, listeners are called in the writing thread whenever samples of a cell are written or cleared.
+		// Listeners may be added and removed from any thread.
+		uint32_t addUpdateListener(const std::function<void(const CacheUpdate& update)>& listener);
+		void removeUpdateListener(uint32_t listenerID);
+		// Between begin and end the changes are merged per cell and published once at the end (calls nest).
+		// Bulk writes of the cache (processMissing, precaching, clearing) do this on their own.
+		void beginUpdates();
+		void endUpdates();
+
 		void processCacheMiss(const CacheMiss& cacheMiss);
 		void processMissing(const std::vector<CacheMiss>& missing);
 		uint32_t reportMissing(std::vector<CacheMiss>& missing, uint32_t limit = 0) const;
@@ -70,18 +118,56 @@ namespace eleman
 		// Loading/Unloading cells
 		bool isCellLoaded(uint64_t cellID);
 		bool loadCell(uint64_t cellID);
+		// Loads the cells that are not loaded yet together, with an IO queue their files are read concurrently.
+		// Returns the amount of loaded cells.
+		uint32_t loadCells(const std::vector<uint64_t>& cellIDs);
+		// Loads the cell if needed and counts the access for the memory tiers
 		ElevationCacheCell* getCell(uint64_t cellID);
+		// Loaded cell or nullptr, never loads and does not count as an access.
+		// Safe on several threads at once as long as no cell is loaded or unloaded meanwhile.
+		ElevationCacheCell* findCell(uint64_t cellID);
 		bool unloadCell(uint64_t cellID);
 		void unloadAll();
 		std::vector<uint64_t> cellsForRegion(double latitude0, double longitude0, double latitude1, double longitude1);
+		// IDs of the (up to) eight cells around the given one
+		std::vector<uint64_t> neighborCells(uint64_t cellID) const;
 		uint32_t cellsLoaded();
 
+		// Memory tiers: loaded cells are hot, idle cells can be kept warm instead of being dropped, compressed in memory
+		// without loss (ElevationCodec FAST) and inflated again once they are accessed.
+		// balanceTiers() demotes the least frequently accessed hot cells beyond hotBytes and drops the least frequently
+		// accessed warm cells beyond warmBytes. 0 hotBytes never demotes, 0 warmBytes disables the warm tier.
+		// Warm cells with unstored samples (caches without IO) are never dropped, even beyond the budget.
+		void setMemoryBudget(size_t hotBytes, size_t warmBytes);
+		// Call between requests, pointers to demoted cells become invalid. Dirty cells are stored before.
+		// Returns the amount of demoted cells.
+		uint32_t balanceTiers();
+		uint32_t cellsWarm() const;
+		size_t memoryWarm() const;	// Compressed bytes of the warm cells
+
 		// Cache control
 		void clear();
 		bool clearRadius(double latitude, double longitude, double radius);
 		bool clearRegion(Position pos0, Position pos1);
 		bool clearRegion(double latitude0, double longitude0, double latitude1, double longitude1);
+		// Stores all dirty cells, through the IO queue if there is one
 		void flush();
+		// Share of known samples in the cells touching the box, stored cells are looked up in the IO's manifest instead of loaded
+		double coverage(double latitude0, double longitude0, double latitude1, double longitude1);
+
+		// Sorting large batches of scattered positions along a curve avoids jumping between cells
+		void setBatchOrder(BatchOrder order);
+		BatchOrder getBatchOrder() const;
+
+		// Regions at least twice as coarse as the cache average the cache samples covered by every output sample
+		// instead of interpolating at its center (NEAREST always samples). Footprints with missing samples are
+		// sampled at their center, which requests the missing samples around it.
+		void setAreaDownsampling(bool enabled);
+		bool getAreaDownsampling() const;
+
+		// Amount of neighbour samples every cell keeps around its grid (2 by default, enough for bicubic interpolation)
+		void setHaloWidth(uint8_t width);
+		uint8_t getHaloWidth() const;
 
 		// Getters
 		uint16_t getCellDivisions() const;
@@ -115,7 +201,54 @@ namespace eleman
 
 		uint16_t cellDivisions;
 		double precision;
+		uint8_t haloWidth = 2;
+		BatchOrder batchOrder = INPUT_ORDER;
+		bool areaDownsampling = true;
+		// Curve index and position of every query, reused between batches
+		std::vector<std::pair<uint64_t, size_t>> batchKeys;
+
+		// Held while listeners run, so they may add or remove listeners and a removed listener is never called again
+		std::recursive_mutex listenerMutex;
+		std::map<uint32_t, std::function<void(const CacheUpdate& update)>> updateListeners;
+		uint32_t nextListenerID = 0;
+		uint32_t updateDepth = 0;
+		std::map<uint64_t, CacheUpdate> pendingUpdates;
 		std::map<uint32_t, ElevationCacheCell> cells;
+
+		// Compressed cell with what the tiers need to inflate it again
+		struct WarmCell
+		{
+			std::vector<uint8_t> data;
+			size_t known;
+			uint32_t accesses;
+			bool dirty, stored;
+		};
+		std::map<uint64_t, WarmCell> warmCells;
+		size_t warmBytes = 0;
+		size_t hotBudget = 0, warmBudget = 0;
+
+		// Returns the given cell if it contains the position, otherwise looks up the right one
+		ElevationCacheCell* cellFor(double latitude, double longitude, ElevationCacheCell* cell);
+		// Mean of the samples inside the lat/lon box, NAN unless all of them are known and their cells loaded
+		// (never fetches missing samples or loads cells)
+		double areaMean(double latitude0, double longitude0, double latitude1, double longitude1);
+		template <typename T>
+		void getBatch(const double* latitude, const double* longitude, size_t count, T* elevation, uint8_t* status,
+					  ElevationRegion::Interpolation interpolation);
+		// Moves a hot cell to the warm tier (or drops it without one), stores it first
+		void demote(ElevationCacheCell& cell);
+		// Decompresses a warm cell into a hot one, halos are left to the caller
+		ElevationCacheCell& inflate(std::map<uint64_t, WarmCell>::iterator warm);
+		// Drops the least frequently accessed clean warm cells until the warm budget is met
+		void trimWarm();
+
+		// Keep the halos of loaded neighbours coherent with the samples of a cell
+		void updateNeighborHalos(const ElevationCacheCell& cell, uint32_t x, uint32_t y);
+		void refreshNeighborHalos(const ElevationCacheCell& cell);
+		// Publishes (or merges while updates are batched) a written sample of a cell
+		void noteUpdate(const ElevationCacheCell& cell, uint32_t x, uint32_t y);
+
+		friend class ElevationCacheCell;
 	};
 
 	class ElevationCacheCell : public ElevationRegion
@@ -144,11 +277,23 @@ namespace eleman
 		// overwrite grid functions from ElevationRegion
 		double getGrid(uint32_t x, uint32_t y) const override;
 		void setGrid(uint32_t x, uint32_t y, double value) override;
+		// Reads the halo outside of the grid, falls back to the nearest edge sample where the halo is unknown
+		double getGridExtended(int32_t x, int32_t y) const override;
+
+		// Copies of the neighbouring cells' samples up to getHaloWidth() outside of the grid,
+		// NAN if the neighbour is not loaded or the sample is unknown. No cache miss handling.
+		double getGridHalo(int32_t x, int32_t y) const;
+		uint8_t getHaloWidth() const;
+		// Rebuilds the whole halo from the loaded neighbours
+		void refreshHalo();
 
 		// Getters
 		uint32_t getID() const;
 		double getPrecision() const;
+		bool contains(double latitude, double longitude) const;
 		bool isDirty() const;
+		// Samples are used in place from a mapped cell file until the first write
+		bool isMapped() const;
 
 
 		// TODO Check if virtual specifier is needed in ElevationRegion
@@ -166,6 +311,38 @@ namespace eleman
 		bool dirty = true;
 		std::shared_ptr<Grid<bool>> statusData;
 
+		// Samples written since the cell file was written or loaded (row by row indices), only tracked for update logs.
+		// Overflows once rewriting the cell file is cheaper than logging the changes.
+		bool stored = false;
+		bool changesOverflow = false;
+		std::vector<uint32_t> changes;
+		int64_t knownChange = 0;
+		// Set on the IO thread once the last asynchronous store is written, the cell counts as dirty until then
+		std::shared_ptr<std::atomic<bool>> written;
+
+		// Lookups through the cache, halved whenever the tiers are balanced
+		uint32_t accesses = 0;
+
+		// Halo strips, south and north span the corners as well
+		uint8_t haloWidth = 0;
+		Grid<double> haloSouth, haloNorth;	// (sizeLon + 2 * haloWidth) x haloWidth
+		Grid<double> haloWest, haloEast;	// haloWidth x sizeLat
+
+		void storeSample(uint32_t x, uint32_t y, double elevation);
+		void noteChange(uint32_t x, uint32_t y, bool wasKnown);
+		// Empty grids unless already loaded or mapped
+		void allocateGrids();
+		// Moves mapped samples to private heap grids before they are written
+		void promote();
+
+		void resizeHalo(uint8_t width);
+		void setHalo(int32_t x, int32_t y, double value);
+		// Interpolates the halo sample from the neighbour it lies in
+		double haloSample(int32_t x, int32_t y) const;
+		// Recomputes the halo samples depending on a sample of a neighbouring cell
+		void updateHalo(const ElevationCacheCell& source, uint32_t x, uint32_t y);
+
+		friend class ElevationCache;
 		friend class ElevationIO;
 	};
 
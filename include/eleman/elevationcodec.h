@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONCODEC_H
+#define ELEVATIONCODEC_H
+
+#include "grid.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Compression of elevation grids. Samples are quantized to a fixed step, predicted from their west, north and
+	 * north west neighbours (median edge detector as in LOCO-I) and only the residuals are kept, which stay tiny on
+	 * smooth terrain. FAST stores the residuals as variable length bytes, HIGH additionally entropy codes them (rANS).
+	 * Decoding is a single pass over the grid, the quantization error is at most half a step.
+	 * Without quantization the bit patterns of the samples are predicted instead and decoded exactly.
+	 */
+	class ElevationCodec
+	{
+	public:
+		enum Level : uint8_t {
+			FAST = 1,	// About a byte per sample, decodes at memory speed
+			HIGH = 2	// Entropy coded, smaller but slower to decode
+		};
+
+		/**
+		 *	Appends the compressed grid to the buffer. Samples without status are not stored,
+		 *	non finite samples are stored as unknown.
+		 *	@param quantization Step in meters the samples are rounded to, 0 keeps them exact
+		 */
+		static void compress(GridView<const double> samples, GridView<const bool> status, Level level, double quantization,
+							 std::vector<uint8_t>& buffer);
+
+		// Returns false if the data is damaged or the views do not match the size of the compressed grid
+		static bool decompress(const uint8_t* data, size_t size, GridView<double> samples, GridView<bool> status);
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONCODEC_H
@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONCONTOUR_H
+#define ELEVATIONCONTOUR_H
+
+#include "elevationdata.h"
+#include "elevationregion.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+	class ElevationCache;
+
+	struct ContourLine {
+		double elevation;
+		bool closed;					// First and last point are equal
+		std::vector<Position> points;	// Higher ground lies on the left
+	};
+
+	/**
+	 * Contour line extraction with marching squares (saddles are resolved by the center average).
+	 * Segments are stitched into polylines by the grid edge they cross, so bands of rows can be
+	 * traced in parallel and merged at their seams, and strips of a streamed region can be appended
+	 * one after another. Unknown samples (NAN) end lines at their neighbouring squares.
+	 */
+	class ElevationContour
+	{
+	public:
+		// Levels at base + k * interval
+		ElevationContour(double interval, double base = 0.0);
+		// Explicit list of levels
+		ElevationContour(const std::vector<double>& levels);
+		~ElevationContour();
+
+		// Works on any region including cache cells, rows are split into bands for threads (0 uses all)
+		std::vector<ContourLine> trace(const ElevationRegion& region, uint32_t threads = 0) const;
+		std::vector<ContourLine> trace(ElevationCache& cache, uint64_t cellID, uint32_t threads = 0) const;
+		// Streams the area through the cache in strips of rows, the full grid is never held in memory
+		std::vector<ContourLine> trace(ElevationCache& cache, double lat0, double lon0, double lat1, double lon1, double precision,
+									   uint32_t stripRows = 256, uint32_t threads = 0) const;
+
+	private:
+		class Builder;
+
+		double interval, base;
+		std::vector<double> levels;	// Sorted, only used without interval
+
+		double level(int64_t k) const;
+		// Inclusive range of levels within (min, max], false if there are none
+		bool levelRange(double min, double max, int64_t& k0, int64_t& k1) const;
+
+		void traceRows(const ElevationRegion& region, uint32_t rowOffset, uint32_t y0, uint32_t y1, Builder& builder) const;
+		void traceRegion(const ElevationRegion& region, uint32_t rowOffset, Builder& builder, uint32_t threads) const;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONCONTOUR_H
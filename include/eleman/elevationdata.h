@@ -1,6 +1,9 @@
 #ifndef ELEVATIONDATA_H
 #define ELEVATIONDATA_H
 
+#include <stdint.h>
+#include <vector>
+
 namespace eleman
 {
 
@@ -13,6 +16,21 @@ namespace eleman
 		double elevation;
 	};
 
+	// Per position result of the batched queries
+	enum QueryStatus : uint8_t {
+		QUERY_OK = 0,
+		QUERY_UNKNOWN = 1,		// No sample available, e.g. the vendor could not be reached
+		QUERY_OUT_OF_RANGE = 2	// Not a valid latitude/longitude
+	};
+
+	struct ElevationProfile {
+		std::vector<double> distance;	// Meters from the start of the polyline
+		std::vector<double> elevation;
+		// Cumulative climb in meters, only filled on request
+		std::vector<double> ascent;
+		std::vector<double> descent;
+	};
+
 }	// end namespace eleman
 
 #endif // ELEVATIONDATA_H
@@ -6,20 +6,60 @@
 
 
 #include "elevationcache.h"
+#include "elevationcodec.h"
+#include "elevationioqueue.h"
+#include "elevationmanifest.h"
 
+#include <condition_variable>
 #include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <stdint.h>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace eleman
 {
 
 	/**
-	* @todo write docs
+	* Stores cache cells on disk, one file per cell below the cache directory.
+	* Cells are written in a versioned binary format by default: a fixed header, a packed status bitmap,
+	* the raw sample array and a checksum. The samples may be compressed instead (bitmap included), which
+	* trades a quantization error for a fraction of the size, or laid out to be memory mapped.
+	* JSON can still be written for debugging or export,
+	* loading detects the format of every file on its own.
+	* With the update log enabled, stores of cells that already have a file only append their changed samples
+	* to a log next to it (.edl), which is replayed on load and folded into the cell file in the background.
+	* Every cache directory keeps a manifest of its cells, loads of cells that were never stored skip the filesystem.
+	* With an ElevationIOQueue, cells can be loaded and stored asynchronously so many files are in flight at once.
+	* An optional quota bounds the disk space of the cache directory by evicting the least valuable cell files.
 	*/
 	class ElevationIO
 	{
 	public:
+		enum Format {
+			BINARY,		// Header, status bitmap, raw samples and checksum
+			JSON		// Pretty printed list of the known samples
+		};
+
+		enum SampleType : uint8_t {
+			FLOAT64,	// Lossless
+			FLOAT32		// Half the size, rounds to a few millimeters
+		};
+
+		// Encoding of the samples in binary files
+		enum Encoding : uint8_t {
+			RAW = 0,						// Sample array as is, in the sample type
+			FAST = ElevationCodec::FAST,	// Quantized and predictively coded, see ElevationCodec
+			HIGH = ElevationCodec::HIGH,	// Additionally entropy coded
+			PAGED = 3						// Float64 samples and status bytes at page aligned offsets, can be memory mapped
+		};
+
 		/**
 		* Default constructor
 		*/
@@ -28,18 +68,200 @@ namespace eleman
 		/**
 		* Destructor
 		*/
-		~ElevationIO();
+		virtual ~ElevationIO();
+
+		// Backends other than one file per cell (e.g. ElevationArchiveIO) override these
+		virtual bool store(ElevationCacheCell& cell);
+		virtual bool load(ElevationCacheCell& cell);
+		// Makes the stored cells durable, ElevationCache::flush() calls it once all cells are stored.
+		// Nothing to do for cell files, every store replaces its file as a whole.
+		virtual void flush();
+
+		// Starts reading the files of the cell through the queue, get() decodes them on the calling thread and
+		// returns what load() would. The cell must not be used before. Without a queue get() loads synchronously.
+		std::future<bool> loadAsync(ElevationCacheCell& cell);
+		// Encodes the cell right away and writes it through the queue, the cell may change or be unloaded meanwhile.
+		// get() waits for the file and returns what store() would, or throws if it could not be written.
+		std::future<bool> storeAsync(ElevationCacheCell& cell);
+		// Queue of the asynchronous calls, not owned and has to outlive the IO. nullptr makes them synchronous.
+		void setQueue(ElevationIOQueue* queue);
+		ElevationIOQueue* getQueue() const;
+
+		// Format of stored cells, JSON files written before are still loaded
+		void setFormat(Format format);
+		Format getFormat() const;
+		void setSampleType(SampleType sampleType);
+		SampleType getSampleType() const;
+		// Compressed encodings round the samples to the quantization step (in meters)
+		void setEncoding(Encoding encoding, double quantization = 0.01);
+		Encoding getEncoding() const;
+		double getQuantization() const;
+		// Cells stored PAGED are mapped instead of read, their samples are used in place and faulted in lazily.
+		// The first write to a mapped cell copies it to the heap. Mapped files are not checksummed on load.
+		void setMemoryMapping(bool enabled);
+		bool getMemoryMapping() const;
+		// Stores cost O(changed samples) instead of rewriting the cell file. A log is compacted once it reaches
+		// compactionRatio of its cell file or compactionBytes. Only used for the binary format.
+		void setUpdateLog(bool enabled, double compactionRatio = 0.25, uint64_t compactionBytes = 1 << 20);
+		bool getUpdateLog() const;
+		// Folds every log below the cache directory into its cell file, returns the amount of logs
+		uint32_t compactLogs();
 
-		bool store(ElevationCacheCell& cell);
-		bool load(ElevationCacheCell& cell);
+		struct MigrationReport
+		{
+			uint64_t cells = 0;			// Cell files found
+			uint64_t migrated = 0;		// Rewritten in the configured format
+			uint64_t failed = 0;		// Damaged or not verified, left as they were
+			uint64_t verified = 0;		// In the configured format and intact afterwards
+			uint64_t bytesBefore = 0;	// Cell files and logs
+			uint64_t bytesAfter = 0;
+		};
+
+		// Rewrites every cell file below the cache directory that is in another format or has a log in the configured
+		// format (JSON included), every new file is decoded again and compared before it replaces the old one.
+		// Finishes with a pass that decodes every file. Cells can be loaded and stored meanwhile.
+		// @param threads Amount of threads to use, 0 uses all hardware threads
+		// @param memoryLimit Bytes the files and grids in flight may take, a larger cell still runs alone
+		MigrationReport migrate(uint32_t threads = 0, size_t memoryLimit = size_t(256) << 20);
+		// Loaded cells whose file is in another format get their file rewritten in the configured one
+		void setMigrateOnLoad(bool enabled);
+		bool getMigrateOnLoad() const;
+
+		// Cell files below the cache directory may take up to bytes, 0 disables the quota. Once exceeded, the least
+		// valuable cells are removed until 90% of the quota are used: cheap to download again, large and unused for long.
+		void setQuota(uint64_t bytes);
+		uint64_t getQuota() const;
+		// Bytes of all stored cells (files and logs) according to the manifests
+		uint64_t getUsage();
+		// Cells touching the box are never evicted, returns the ID to unpin it
+		uint32_t pinArea(double latitude0, double longitude0, double latitude1, double longitude1);
+		void unpinArea(uint32_t pinID);
+		// Seconds the vendor needs to deliver a sample again. Vendors without one get it from their request limits
+		// once a cache of theirs uses the IO.
+		void setRefetchCost(const std::string& vendorID, double secondsPerSample);
+		// Evicts cells if the quota is exceeded, returns the amount of evicted cells. Stores do this on their own.
+		uint32_t enforceQuota();
+
+		// Manifest entry (fill and size on disk) of a stored cell of the cache, false if the cell was never stored.
+		// Reads the manifest on first use, no filesystem access afterwards.
+		bool getCellInfo(ElevationCache& cache, uint64_t cellID, ManifestEntry& entry);
+		// All stored cells of the cache
+		std::map<uint64_t, ManifestEntry> getCellInfos(ElevationCache& cache);
+
+		// Binary cell file as in memory buffer
+		static void encode(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer, SampleType sampleType = FLOAT64,
+						   Encoding encoding = RAW, double quantization = 0.01);
+		// Returns false if the buffer is no intact binary cell file, throws if it belongs to another cell
+		static bool decode(const uint8_t* data, size_t size, ElevationCacheCell& cell);
+		static bool isBinary(const uint8_t* data, size_t size);
+		// Contents of a cell file with its update log applied, cells with a log are encoded again with raw samples.
+		// Damaged files are returned as they are, false if the file can not be read.
+		static bool readCellFile(const std::filesystem::path& filepath, std::vector<uint8_t>& buffer);
 
 		static std::filesystem::path getDirectory(const std::filesystem::path cacheDir, const ElevationCacheCell& cell);
+		static std::filesystem::path getDirectory(const std::filesystem::path cacheDir, ElevationCache& cache, double precision);
 		static std::string getFilename(const ElevationCacheCell& cell, const std::string& fileExtension = "edc");
 
+	protected:
+		ElevationIO();
+
+		// Cell file contents in the configured format
+		void encodeCell(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer) const;
+		// Fills the cell from binary or JSON file contents, false if they are damaged
+		bool decodeCell(ElevationCacheCell& cell, const uint8_t* data, size_t size);
+		static void markStored(ElevationCacheCell& cell);
+
 	private:
+		// Cache directory of a vendor, cell division and precision, with the manifest of its cells
+		struct Layer
+		{
+			std::string vendorID;
+			uint16_t cellDivisions;
+			double precision;
+			std::filesystem::path directory;
+			std::unique_ptr<ElevationManifest> manifest;
+		};
+
 		std::filesystem::path cacheDir;
+		Format format = BINARY;
+		SampleType sampleType = FLOAT64;
+		Encoding encoding = RAW;
+		double quantization = 0.01;
+		bool memoryMapping = false;
+		bool migrateOnLoad = false;
+
+		ElevationIOQueue* queue = nullptr;
+		// Cell files still written by the queue, loads and stores of the same file wait for them
+		std::map<std::filesystem::path, std::shared_future<void>> pendingStores;
+		std::mutex storeMutex;
+
+		// Pinned boxes and refetch costs by vendor are guarded by the manifest mutex
+		struct Pin
+		{
+			double latitude0, longitude0, latitude1, longitude1;
+		};
+		uint64_t quota = 0;
+		std::map<uint32_t, Pin> pins;
+		uint32_t nextPin = 1;
+		std::map<std::string, double> refetchCosts;
+
+		bool updateLog = false;
+		double compactionRatio = 0.25;
+		uint64_t compactionBytes = 1 << 20;
+		// Cell files with a log are only touched while holding it
+		std::mutex logMutex;
+
+		// Background compaction
+		std::thread compactor;
+		std::mutex compactionMutex;
+		std::condition_variable compactionSignal;
+		std::set<std::filesystem::path> compactionQueue;
+		bool stopping = false;
+
+		// Layers are never removed, the manifests are only accessed while holding the mutex
+		std::vector<std::unique_ptr<Layer>> layers;
+		std::mutex manifestMutex;
 
 		void createCacheDir();
+
+		// Opens the layer on first use and rebuilds its manifest if it is stale, call with the manifest mutex held
+		Layer& layerOf(ElevationCache& cache, double precision);
+		Layer* findLayer(const std::filesystem::path& directory);
+		// Opens the layers of all cache directories below the cache directory, call with the manifest mutex held
+		void openLayers();
+		void rebuildManifest(ElevationManifest& manifest);
+		void updateManifest(const std::filesystem::path& filepath, uint64_t cellID, const ManifestEntry& entry);
+
+		// Appends the tracked changes of the cell to its log, false if the cell file has to be rewritten
+		bool appendLog(ElevationCacheCell& cell, const std::filesystem::path& filepath);
+		// Applies the log of a cell file to the cell, truncates torn records. Returns the amount of applied samples.
+		size_t replayLog(ElevationCacheCell& cell, const std::filesystem::path& logpath, const std::vector<uint8_t>& log);
+		void scheduleCompaction(const std::filesystem::path& filepath);
+		void runCompactor();
+		// Rewrites a cell file with its log applied and removes the log
+		bool compactLog(const std::filesystem::path& filepath);
+		// Rewrites a cell file of any format with its log applied in the configured format, optionally decoding it
+		// again first. Retried if the files change meanwhile, false if they stay as they are.
+		bool rewriteCellFile(const std::filesystem::path& filepath, bool verify, uint64_t& bytes);
+		// The file contents are in the configured format (quantization aside)
+		bool isCurrent(const uint8_t* data, size_t size) const;
+
+		// Fills the cell from the contents of its file and log (nullptr if missing), call with the log mutex held.
+		// current tells whether the file is in the configured format.
+		bool loadFiles(ElevationCacheCell& cell, const std::filesystem::path& filepath, const std::vector<uint8_t>* file,
+					   const std::vector<uint8_t>* log, bool& current);
+		// Rewrites the file of a loaded cell in the configured format if migrating on load
+		void migrateLoaded(ElevationCacheCell& cell, const std::filesystem::path& filepath);
+		void waitForStore(const std::filesystem::path& filepath);
+		// Waits for the last asynchronous store of the cell, which is dirty again if it was not written
+		void waitForStore(ElevationCacheCell& cell, const std::filesystem::path& filepath);
+		bool isPinned(uint64_t cellID, uint16_t cellDivisions) const;
+
+		// Maps PAGED cell files, returns false for any other file
+		bool mapCell(ElevationCacheCell& cell, const std::filesystem::path& filepath, size_t size);
+
+		static void encodeJSON(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer);
+		static bool decodeJSON(ElevationCacheCell& cell, const uint8_t* text, size_t size);
 	};
 	std::string cellname(uint8_t zoneNumber, char zoneLetter, int32_t eastID, int32_t northID);
 
@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONIOQUEUE_H
+#define ELEVATIONIOQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Reads and writes whole files asynchronously, so many cell files can be in flight at once.
+	 * Queued requests are submitted in batches through io_uring where the kernel supports it, otherwise a pool of
+	 * threads works through them with blocking calls. Either way up to depth requests are outstanding, which keeps
+	 * the queues of NVMe drives busy instead of waiting for one file at a time.
+	 */
+	class ElevationIOQueue
+	{
+	public:
+		enum Backend {
+			AUTO,		// io_uring if available, threads otherwise
+			IO_URING,	// Throws if the kernel does not support it
+			THREADS
+		};
+
+		/**
+		 * @param depth Requests in flight at once
+		 * @param threads Threads of the fallback, 0 uses all hardware threads
+		 */
+		ElevationIOQueue(uint32_t depth = 64, Backend backend = AUTO, uint32_t threads = 0);
+		ElevationIOQueue(const ElevationIOQueue&) = delete;
+		ElevationIOQueue& operator=(const ElevationIOQueue&) = delete;
+		// Finishes all queued requests
+		~ElevationIOQueue();
+
+		// Reads the whole file into the buffer, the queue keeps it alive until then.
+		// The future holds false if the file does not exist or can not be read.
+		std::future<bool> read(const std::filesystem::path& filepath, std::shared_ptr<std::vector<uint8_t>> buffer);
+		// Replaces the file by the buffer, then calls completion on the IO thread.
+		// Errors while writing and exceptions of the completion are thrown by the future.
+		std::future<void> write(const std::filesystem::path& filepath, std::vector<uint8_t> buffer,
+								std::function<void()> completion = nullptr);
+
+		// Backend in use, never AUTO
+		Backend getBackend() const;
+		uint32_t getDepth() const;
+		// Submissions to the kernel, every one may carry many requests (io_uring only)
+		uint64_t getSubmissions() const;
+
+	private:
+		struct Request
+		{
+			bool write;
+			std::filesystem::path filepath;
+			std::shared_ptr<std::vector<uint8_t>> buffer;	// Target of reads
+			std::vector<uint8_t> data;			// Source of writes
+			std::function<void()> completion;
+			std::promise<bool> read;
+			std::promise<void> written;
+
+			int fd = -1;
+			size_t size = 0;
+			size_t done = 0;
+			uint32_t slot = 0;					// Chunk descriptor in the ring (io_uring only)
+		};
+		struct Ring;
+
+		Backend backend;
+		uint32_t depth;
+
+		std::mutex mutex;
+		std::condition_variable signal;
+		std::deque<std::unique_ptr<Request>> pending;
+		bool stopping = false;
+		std::vector<std::thread> workers;
+
+		std::unique_ptr<Ring> ring;
+		std::atomic<uint64_t> submissions{0};
+
+		void enqueue(std::unique_ptr<Request> request);
+
+		// Blocking IO of the fallback threads
+		void runWorker();
+		void process(Request& request);
+
+		// io_uring: opens the files of new requests, submits chunks and completes the requests.
+		// If the ring fails, requests in flight fail and the ring thread continues with runWorker.
+		bool openRing();
+		void runRing();
+		bool start(Request& request);
+		void submit(Request& request);
+		void complete(Request& request, int result);
+		void finish(Request& request, const std::string& error);
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONIOQUEUE_H
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONLAZYREGION_H
+#define ELEVATIONLAZYREGION_H
+
+#include "elevationregion.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+	class ElevationCache;
+
+	/**
+	 * Region whose samples are retrieved from the cache tile by tile on first access instead of up front.
+	 * Evaluated tiles are kept, the grid memory of untouched tiles is never written (the OS only backs touched pages).
+	 * Whole grid consumers (pyramid, meshes, contours, copies as ElevationRegion) evaluate every tile.
+	 * The cache has to outlive the region, like the cache itself the region is not thread safe.
+	 */
+	class ElevationLazyRegion : public ElevationRegion
+	{
+	public:
+		ElevationLazyRegion(ElevationCache* cache, double lat0, double lon0, double lat1, double lon1, double precision,
+							Interpolation interpolation = LINEAR, uint32_t tileSize = 64);
+		ElevationLazyRegion(ElevationCache* cache, double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon,
+							Interpolation interpolation = LINEAR, uint32_t tileSize = 64);
+		ElevationLazyRegion(const ElevationLazyRegion& region);
+		~ElevationLazyRegion();
+
+		double getGrid(uint32_t x, uint32_t y) const override;
+		void setGrid(uint32_t x, uint32_t y, double value) override;
+
+		// Retrieves all tiles not evaluated yet
+		void evaluateAll();
+		bool isEvaluated(uint32_t x, uint32_t y) const;
+		uint32_t tilesEvaluated() const;
+		uint32_t tilesTotal() const;
+		uint32_t getTileSize() const;
+
+	protected:
+		void evaluate(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const override;
+
+	private:
+		ElevationCache* cache;
+		Interpolation interpolation;
+		uint32_t tileSize;
+		uint32_t tilesLon, tilesLat;
+
+		mutable std::vector<bool> tiles;
+		mutable uint32_t evaluated = 0;
+		// Positions and results of one tile, reused for every tile
+		mutable std::vector<double> latitudes, longitudes, elevations;
+
+		void initialize(uint32_t tileSize);
+		void evaluateTile(uint32_t tileX, uint32_t tileY) const;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONLAZYREGION_H
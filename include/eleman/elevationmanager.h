@@ -6,6 +6,7 @@
 
 #include "elevationcache.h"
 #include "elevationdata.h"
+#include "elevationlazyregion.h"
 #include "elevationvendor.h"
 
 #include <chrono>
@@ -50,10 +51,19 @@ namespace eleman
 		ElevationData get(Position pos, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		// TODO request multiple points
 		std::vector<ElevationData> get(const std::vector<Position>& positions, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Struct of arrays variants writing into caller owned memory, see ElevationCache
+		void get(const double* latitude, const double* longitude, size_t count, double* elevation, uint8_t* status = nullptr,
+				 ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		void get(const double* latitude, const double* longitude, size_t count, float* elevation, uint8_t* status = nullptr,
+				 ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		// TODO request grid of points
 		ElevationRegion get(double lat0, double lon0, double lat1, double lon1, double precision, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		ElevationRegion get(double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
 		void fillRegion(ElevationRegion& region, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		// Regions retrieving their samples tile by tile on first access, see ElevationLazyRegion
+		ElevationLazyRegion getLazy(double lat0, double lon0, double lat1, double lon1, double precision, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		ElevationLazyRegion getLazy(double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon, ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR);
+		ElevationProfile profile(const std::vector<Position>& polyline, double spacing, bool climb = false);
 
 
 		// Precache methods
@@ -0,0 +1,68 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONMANIFEST_H
+#define ELEVATIONMANIFEST_H
+
+#include <filesystem>
+#include <map>
+#include <stdint.h>
+
+namespace eleman
+{
+
+	struct ManifestEntry
+	{
+		uint64_t known = 0;		// Known samples
+		uint64_t samples = 0;	// Grid positions of the cell
+		uint64_t bytes = 0;		// Size on disk, update log included
+		int64_t accessed = 0;	// Last load or store, seconds since the epoch
+
+		double fill() const { return samples > 0 ? double(known) / samples : 0.0; }
+	};
+
+	/**
+	 * Index of the cells stored in one cache directory (vendor/divisions/precision) with their fill, size and last access.
+	 * Kept in memory and appended to the manifest file on every change, so cells that were never stored are
+	 * rejected without touching the filesystem. A manifest older than its directory (files added or removed
+	 * behind its back) is reported stale and has to be rebuilt from the cell files.
+	 * Not synchronized, ElevationIO serializes the access.
+	 */
+	class ElevationManifest
+	{
+	public:
+		// Reads the manifest of the directory, torn records at the end are dropped
+		ElevationManifest(const std::filesystem::path& directory);
+
+		bool contains(uint64_t cellID) const;
+		bool get(uint64_t cellID, ManifestEntry& entry) const;
+		void set(uint64_t cellID, const ManifestEntry& entry);
+		void remove(uint64_t cellID);
+		// Updates the access time, written only if the stored one is at least resolution seconds older
+		void touch(uint64_t cellID, int64_t time, int64_t resolution);
+		// Replaces all entries and rewrites the manifest file
+		void reset(const std::map<uint64_t, ManifestEntry>& entries);
+
+		const std::map<uint64_t, ManifestEntry>& getEntries() const;
+		const std::filesystem::path& getDirectory() const;
+		// Sum of the entry sizes
+		uint64_t getBytes() const;
+		// The directory holds cell files but the manifest is missing or older
+		bool isStale() const;
+
+	private:
+		std::filesystem::path directory;
+		std::filesystem::path filepath;
+		std::map<uint64_t, ManifestEntry> entries;
+		uint64_t records = 0;	// Records in the file, replaced ones included
+		uint64_t bytes = 0;
+		bool stale = false;
+
+		void read();
+		void append(uint64_t cellID, const ManifestEntry& entry);
+		void rewrite();
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONMANIFEST_H
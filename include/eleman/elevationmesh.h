@@ -0,0 +1,55 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONMESH_H
+#define ELEVATIONMESH_H
+
+#include "elevationregion.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Indexed triangle mesh of a region (x east, y north, z up, in meters).
+	 * With a maximum error >= 0 the mesh is simplified with a right-triangulated irregular network
+	 * (RTIN), flat areas then collapse into a few large triangles without cracks between them.
+	 */
+	class ElevationMesh
+	{
+	public:
+		/**
+		 *	@param maxError Largest vertical distance of any sample to the mesh in meters, negative values keep every sample
+		 *	@param scale Factor applied to all coordinates
+		 */
+		ElevationMesh(const ElevationRegion& region, double maxError = -1.0, double scale = 1.0, bool centerHorizontal = true, bool centerVertical = true);
+		~ElevationMesh();
+
+		// Writers buffer their output and return false if the file could not be written
+		bool writeOBJ(const std::string& filepath) const;
+		bool writePLY(const std::string& filepath) const;
+		bool writeGLB(const std::string& filepath) const;
+
+		size_t vertexCount() const { return positions.size() / 3; }
+		size_t triangleCount() const { return indices.size() / 3; }
+
+		const std::vector<float>& getPositions() const { return positions; }	// x, y, z per vertex
+		const std::vector<float>& getUVs() const { return uvs; }				// u, v per vertex
+		const std::vector<uint32_t>& getIndices() const { return indices; }		// Counter clockwise triangles
+
+	private:
+		std::vector<float> positions;
+		std::vector<float> uvs;
+		std::vector<uint32_t> indices;
+
+		// Builders emit the grid index (y * width + x) of every vertex
+		void buildFull(const Grid<double>& grid, std::vector<uint32_t>& samples);
+		void buildRTIN(const Grid<double>& grid, double maxError, std::vector<uint32_t>& samples);
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONMESH_H
@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONPYRAMID_H
+#define ELEVATIONPYRAMID_H
+
+#include "grid.h"
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Min/max/sum mip pyramid on top of an elevation grid.
+	 * Level 0 is the grid itself, every further level reduces 2x2 nodes of the level below.
+	 * NAN samples (unknown data) are ignored, queries return NAN if no sample matched.
+	 */
+	class ElevationPyramid
+	{
+	public:
+		enum Coverage {
+			OUTSIDE,
+			PARTIAL,
+			INSIDE
+		};
+
+		// Classifies the inclusive grid rectangle [x0, x1] x [y0, y1] against the queried area
+		typedef std::function<Coverage(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)> Classifier;
+
+		ElevationPyramid(std::shared_ptr<const Grid<double>> grid);
+		~ElevationPyramid();
+
+		// Recompute all levels from the grid
+		void build();
+		// Propagate a single changed grid sample through all levels
+		void update(uint32_t x, uint32_t y);
+
+		// Extrema of the whole grid
+		double min() const;
+		double max() const;
+
+		// Extrema inside the inclusive grid rectangle
+		double min(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+		double max(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+
+		// Extrema inside an arbitrary area described by a classifier
+		double min(const Classifier& classifier) const;
+		double max(const Classifier& classifier) const;
+
+		// Sum and amount of the known samples inside the inclusive grid rectangle, whole nodes are taken from the levels
+		void sum(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, double& sum, uint64_t& count) const;
+
+		uint8_t getLevels() const;
+		size_t memory() const;
+
+	private:
+		std::shared_ptr<const Grid<double>> grid;
+
+		// Level k of the pyramid is stored at index k-1
+		std::vector<Grid<double>> minLevels;
+		std::vector<Grid<double>> maxLevels;
+		std::vector<Grid<double>> sumLevels;
+		std::vector<Grid<uint32_t>> countLevels;
+
+		void reduce(uint8_t level, uint32_t x, uint32_t y);
+		double nodeMin(uint8_t level, uint32_t x, uint32_t y) const;
+		double nodeMax(uint8_t level, uint32_t x, uint32_t y) const;
+		double nodeSum(uint8_t level, uint32_t x, uint32_t y) const;
+		uint32_t nodeCount(uint8_t level, uint32_t x, uint32_t y) const;
+		void querySum(uint8_t level, uint32_t x, uint32_t y, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, double& sum, uint64_t& count) const;
+		void query(bool maximum, uint8_t level, uint32_t x, uint32_t y, const Classifier& classifier, double& best) const;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONPYRAMID_H
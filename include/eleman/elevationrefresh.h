@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONREFRESH_H
+#define ELEVATIONREFRESH_H
+
+#include "elevationcache.h"
+#include "elevationregion.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+
+	/**
+	 * Keeps a region derived from the cache up to date. Listens to the cache updates, marks the output tiles
+	 * whose samples depend on changed cache samples as stale and recomputes only those on refresh().
+	 * Cache and region have to outlive the refresher. Updates may arrive from another thread (e.g. the downloader),
+	 * refresh() has to run where the cache may be read.
+	 */
+	class ElevationRefresher
+	{
+	public:
+		ElevationRefresher(ElevationCache& cache, ElevationRegion& region,
+						   ElevationRegion::Interpolation interpolation = ElevationRegion::LINEAR, uint32_t tileSize = 64);
+		ElevationRefresher(const ElevationRefresher&) = delete;
+		ElevationRefresher& operator=(const ElevationRefresher&) = delete;
+		~ElevationRefresher();
+
+		// Marks all output tiles depending on samples inside the box
+		void markStale(double lat0, double lon0, double lat1, double lon1);
+		void markAllStale();
+
+		bool isStale() const;
+		uint32_t staleTiles() const;
+		// Recomputes the stale tiles from the cache, returns the amount of tiles recomputed
+		uint32_t refresh();
+
+		uint32_t getTileSize() const { return tileSize; }
+
+	private:
+		ElevationCache& cache;
+		ElevationRegion& region;
+		ElevationRegion::Interpolation interpolation;
+		uint32_t tileSize;
+		uint32_t tilesLon, tilesLat;
+		uint32_t listenerID;
+
+		mutable std::mutex mutex;
+		std::vector<bool> stale;
+		uint32_t staleCount = 0;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONREFRESH_H
@@ -4,9 +4,13 @@
 #ifndef ELEVATIONREGION_H
 #define ELEVATIONREGION_H
 
+#include <filesystem>
 #include <memory>
 #include <stdint.h>
+#include <vector>
 
+#include "elevationdata.h"
+#include "elevationpyramid.h"
 #include "grid.h"
 
 namespace eleman
@@ -42,6 +46,11 @@ public:
 	double& atGrid(uint32_t x, uint32_t y);
 	virtual double getGrid(uint32_t x, uint32_t y) const;
 	virtual void setGrid(uint32_t x, uint32_t y, double value);
+	// Samples outside of the grid repeat the nearest edge sample (cache cells read their halo first)
+	virtual double getGridExtended(int32_t x, int32_t y) const;
+	// Raw grid access without any cache handling (unknown samples are NAN)
+	const Grid<double>& getElevationData() const { evaluate(0, 0, sizeLon - 1, sizeLat - 1); return *elevationData; }
+	double getGridLinear(double gridFloatLat, double gridFloatLon) const;
 
 	// Access by lat/lon
 	double get(double latitude, double longitude, Interpolation interpolation = LINEAR) const;
@@ -49,17 +58,39 @@ public:
 	double getLinear(double latitude, double longitude) const;
 	double getCubic(double latitude, double longitude) const;
 
+	// Extrema of all known samples, backed by a min/max pyramid (NAN if no sample is known)
 	double minElevation() const;
 	double maxElevation() const;
-
-	// CELL COORDINATE CONVERSION FUNCTIONS
-	void gridToPos(uint32_t gridLat, uint32_t gridLon, double& latitude, double& longitude) const;
-	void posToGrid(double latitude, double longitude, uint32_t& gridLat, uint32_t& gridLon) const;
-	void gridFloatToPos(double gridFloatLat, double gridFloatLon, double& latitude, double& longitude) const;
-	void posToGridFloat(double latitude, double longitude, double& gridFloatLat, double& gridFloatLon) const;
+	double minElevation(double latitude0, double longitude0, double latitude1, double longitude1) const;
+	double maxElevation(double latitude0, double longitude0, double latitude1, double longitude1) const;
+	double minElevation(const std::vector<Position>& polygon) const;
+	double maxElevation(const std::vector<Position>& polygon) const;
+	// Extrema inside the inclusive grid rectangle
+	double minGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+	double maxGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+	// Sum, amount and mean of the known samples inside the inclusive grid rectangle, no cache miss handling.
+	// Large boxes are taken from the pyramid if it is built already, otherwise summed row by row.
+	void sumGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, double& sum, uint64_t& count) const;
+	double meanGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const;
+	// Pyramid is built lazily on first use and updated by setGrid
+	const ElevationPyramid& getPyramid() const;
+
+	// CELL COORDINATE CONVERSION FUNCTIONS (virtual for projected regions, see ElevationUTMRegion)
+	virtual void gridToPos(uint32_t gridLat, uint32_t gridLon, double& latitude, double& longitude) const;
+	virtual void posToGrid(double latitude, double longitude, uint32_t& gridLat, uint32_t& gridLon) const;
+	virtual void gridFloatToPos(double gridFloatLat, double gridFloatLon, double& latitude, double& longitude) const;
+	virtual void posToGridFloat(double latitude, double longitude, double& gridFloatLat, double& gridFloatLon) const;
+	// Positions of a whole grid row, arrays need space for getGridSizeLon() values
+	virtual void gridRowToPos(uint32_t gridLat, double* latitude, double* longitude) const;
+	// Distance between neighbouring samples of a grid row in meters
+	virtual void gridSpacing(uint32_t gridLat, double& metersLon, double& metersLat) const;
+
+	// Moves the samples into a shared file mapping (raw rows, see Grid::map), all later writes go straight to the file
+	void mapToFile(const std::filesystem::path& filepath, size_t rowAlignment = Grid<double>::ALIGNMENT);
 
 	// UTILS
-	void toMesh(const std::string& filepath, double scale = 1.0, bool centerHorizontal = true, bool centerVertical = true) const;
+	// Format is chosen by extension (.obj, .ply or .glb), see ElevationMesh for the meaning of maxError
+	void toMesh(const std::string& filepath, double scale = 1.0, bool centerHorizontal = true, bool centerVertical = true, double maxError = -1.0) const;
 
 	double getLat0() const { return lat0; }
 	double getLon0() const { return lon0; }
@@ -79,6 +110,20 @@ protected:
 	uint32_t sizeLat, sizeLon;
 
 	std::shared_ptr<Grid<double>> elevationData;
+	mutable std::shared_ptr<ElevationPyramid> pyramid;
+
+	// Has to be called whenever elevationData is modified without setGrid
+	void invalidatePyramid();
+	// Makes sure the inclusive grid rectangle holds its samples before elevationData is read directly,
+	// lazily evaluated regions compute them here (see ElevationLazyRegion)
+	virtual void evaluate(uint32_t /*x0*/, uint32_t /*y0*/, uint32_t /*x1*/, uint32_t /*y1*/) const {}
+
+private:
+	// Clamps grid coordinates within rounding distance of the grid, false if they are outside
+	bool clampGridFloat(double& gridFloatLat, double& gridFloatLon) const;
+	bool gridBox(double latitude0, double longitude0, double latitude1, double longitude1,
+				 uint32_t& x0, uint32_t& y0, uint32_t& x1, uint32_t& y1) const;
+	ElevationPyramid::Classifier polygonClassifier(const std::vector<Position>& polygon) const;
 };
 
 }	// end namespace eleman
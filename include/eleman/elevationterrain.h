@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONTERRAIN_H
+#define ELEVATIONTERRAIN_H
+
+#include "elevationregion.h"
+#include "grid.h"
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+	class ElevationCache;
+
+	enum GradientMethod {
+		HORN,					// 3x3 Sobel-like weights, smoother
+		ZEVENBERGEN_THORNE		// 4 neighbour central differences, sharper
+	};
+
+	// Unit surface normal (east, north, up)
+	struct Normal {
+		double x, y, z;
+	};
+
+	/**
+	 * Terrain derivatives (gradient, slope, aspect, normals and hillshade) of an elevation grid.
+	 * The input is copied into a window with a one sample border once, all products are then
+	 * computed row by row in parallel with branch free inner loops the compiler can vectorize.
+	 * Unknown samples (NAN) propagate into the products of their neighbours.
+	 */
+	class ElevationTerrain
+	{
+	public:
+		// Grid with uniform metric spacing, edges repeat the outermost samples
+		ElevationTerrain(const Grid<double>& grid, double spacingX, double spacingY);
+		// Spacing derived from the region extent, edges repeat the outermost samples
+		ElevationTerrain(const ElevationRegion& region);
+		// Border samples are read from the neighbouring cache cells
+		ElevationTerrain(ElevationCache& cache, uint64_t cellID);
+
+		// Partial derivatives towards east (x) and north (y), unitless (meter per meter)
+		void gradient(Grid<double>& dzdx, Grid<double>& dzdy, GradientMethod method = HORN) const;
+		// Slope in degrees
+		Grid<double> slope(GradientMethod method = HORN) const;
+		// Downslope direction in degrees clockwise from north, NAN on flat terrain
+		Grid<double> aspect(GradientMethod method = HORN) const;
+		Grid<Normal> normals(GradientMethod method = HORN) const;
+		// Lambertian shading (0-255) for a light source at azimuth/altitude in degrees
+		Grid<uint8_t> hillshade(double azimuth = 315.0, double altitude = 45.0, double zFactor = 1.0, GradientMethod method = HORN) const;
+
+		uint32_t getWidth() const { return width; }
+		uint32_t getHeight() const { return height; }
+
+	private:
+		uint32_t width, height;
+
+		// Elevation with a one sample border, (width + 2) x (height + 2)
+		Grid<double> window;
+		// Distance between columns per row and between rows in meters
+		std::vector<double> spacingX;
+		double spacingY;
+
+		void fromRegion(const ElevationRegion& region);
+		void extendBorder();
+		void gradientRow(uint32_t y, GradientMethod method, double* dzdx, double* dzdy) const;
+		void forEachRow(GradientMethod method, const std::function<void(uint32_t y, const double* dzdx, const double* dzdy)>& function) const;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONTERRAIN_H
@@ -5,6 +5,8 @@
 #define ELEVATIONUTILS_H
 
 #include <cmath>
+#include <functional>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 
@@ -45,6 +47,8 @@ namespace eleman
 	double interpolate(double x, double x0, double y0, double x1, double y1);
 
 	std::string toHex(double value);
+	// Inverse of toHex, NAN if the string is no hex representation
+	double fromHex(const std::string& hex);
 
 	template <typename T>
 	bool inEllipse(T x, T y, T cx, T cy, T rx, T ry)
@@ -55,6 +59,26 @@ namespace eleman
 
 	std::string formatMemory(size_t bytes);
 
+	/**
+	 *	Split the range [begin, end) into contiguous chunks and process them concurrently
+	 *	@param function Called with the sub range [chunkBegin, chunkEnd) of each chunk
+	 *	@param threads Amount of threads to use, 0 uses all hardware threads
+	 */
+	void parallelFor(uint32_t begin, uint32_t end, const std::function<void(uint32_t chunkBegin, uint32_t chunkEnd)>& function, uint32_t threads = 0);
+
+	/**
+	 *	Position along a space filling curve through a 2^32 x 2^32 grid, sorting by it keeps
+	 *	neighbouring grid positions close to each other (Hilbert better than Morton)
+	 */
+	uint64_t mortonIndex(uint32_t x, uint32_t y);
+	uint64_t hilbertIndex(uint32_t x, uint32_t y);
+
+	/**
+	 *	64 bit checksum of a byte range (FNV-1a over 64 bit words), detects corrupted files but is not cryptographic
+	 *	@param seed Result of the previous range to checksum data in several pieces (aligned to 8 bytes)
+	 */
+	uint64_t checksum(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+
 
 	template <typename T>
 	T roundMultiplier(T value, T multiplier)
@@ -0,0 +1,93 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONUTM_H
+#define ELEVATIONUTM_H
+
+#include "elevationregion.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace eleman
+{
+
+	/**
+	 * Universal Transverse Mercator projection on the WGS84 ellipsoid.
+	 * Uses the 6th order Krüger series (Karney 2011, accurate to a few nanometers within the zone)
+	 * evaluated with Clenshaw summation, so every conversion costs a fixed handful of
+	 * transcendental functions and no iteration.
+	 */
+	class UTMProjection
+	{
+	public:
+		UTMProjection(uint8_t zone, bool north = true);
+		~UTMProjection();
+
+		// Standard zone of a position including the Norway and Svalbard exceptions
+		static uint8_t zoneFor(double latitude, double longitude);
+		// Latitude band letter (C - X), 'Z' outside of the UTM latitude range
+		static char zoneLetter(double latitude);
+		static UTMProjection forPosition(double latitude, double longitude);
+
+		void forward(double latitude, double longitude, double& easting, double& northing) const;
+		void inverse(double easting, double northing, double& latitude, double& longitude) const;
+		// Batched conversions of count positions, large batches are split among all hardware threads
+		void forward(const double* latitude, const double* longitude, double* easting, double* northing, size_t count) const;
+		void inverse(const double* easting, const double* northing, double* latitude, double* longitude, size_t count) const;
+
+		uint8_t getZone() const { return zone; }
+		bool isNorth() const { return north; }
+		double getCentralMeridian() const { return centralMeridian; }
+
+	private:
+		uint8_t zone;
+		bool north;
+		double centralMeridian;
+		double falseNorthing;
+	};
+
+	/**
+	 * Region on a UTM grid, rows run along northing and columns along easting with a uniform
+	 * metric spacing. Latitude/longitude bounds are the bounding box of the projected rectangle,
+	 * positions inside the box but outside the rectangle are out of bounds for lookups.
+	 */
+	class ElevationUTMRegion : public ElevationRegion
+	{
+	public:
+		ElevationUTMRegion(uint8_t zone, bool north, double easting0, double northing0, double easting1, double northing1, double precision);
+		ElevationUTMRegion(uint8_t zone, bool north, double easting0, double northing0, double easting1, double northing1,
+						   uint32_t gridSizeNorthing, uint32_t gridSizeEasting);
+		// Smallest rectangle in the zone of the box center covering the whole lat/lon box
+		ElevationUTMRegion(double lat0, double lon0, double lat1, double lon1, double precision);
+		~ElevationUTMRegion();
+
+		// Coordinate conversions through the projection
+		void gridToPos(uint32_t gridLat, uint32_t gridLon, double& latitude, double& longitude) const override;
+		void posToGrid(double latitude, double longitude, uint32_t& gridLat, uint32_t& gridLon) const override;
+		void gridFloatToPos(double gridFloatLat, double gridFloatLon, double& latitude, double& longitude) const override;
+		void posToGridFloat(double latitude, double longitude, double& gridFloatLat, double& gridFloatLon) const override;
+		void gridRowToPos(uint32_t gridLat, double* latitude, double* longitude) const override;
+		// Uniform grid spacing in projected meters
+		void gridSpacing(uint32_t gridLat, double& metersLon, double& metersLat) const override;
+
+		void gridToUTM(double gridFloatNorthing, double gridFloatEasting, double& easting, double& northing) const;
+		void utmToGrid(double easting, double northing, double& gridFloatNorthing, double& gridFloatEasting) const;
+
+		const UTMProjection& getProjection() const { return projection; }
+		double getEasting0() const { return easting0; }
+		double getNorthing0() const { return northing0; }
+		double getEasting1() const { return easting1; }
+		double getNorthing1() const { return northing1; }
+
+	private:
+		UTMProjection projection;
+		double easting0, northing0;
+		double easting1, northing1;
+
+		void initialize(double easting0, double northing0, double easting1, double northing1, uint32_t gridSizeNorthing, uint32_t gridSizeEasting);
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONUTM_H
@@ -0,0 +1,74 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef ELEVATIONVISIBILITY_H
+#define ELEVATIONVISIBILITY_H
+
+#include "elevationdata.h"
+#include "elevationregion.h"
+#include "grid.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace eleman
+{
+	class ElevationCache;
+	class ElevationCacheCell;
+
+	// Heights are given in meters above ground
+	struct SightLine {
+		Position from;
+		double fromHeight;
+		Position to;
+		double toHeight;
+	};
+
+	// Visibility grid (1 = visible) aligned to the samples of the terrain region
+	struct Viewshed {
+		ElevationRegion terrain;
+		Grid<uint8_t> visible;
+	};
+
+	/**
+	 * Line of sight and radial viewshed computations including earth curvature and refraction.
+	 * Rays walk the raw grids directly and skip whole chunks whose maximum elevation (taken from the
+	 * min/max pyramid) can not block or be seen. Intermediate samples which are not cached yet are
+	 * treated as transparent, only the ground elevation at the endpoints is requested from the cache.
+	 */
+	class ElevationVisibility
+	{
+	public:
+		ElevationVisibility(ElevationCache* cache);
+		~ElevationVisibility();
+
+		// Line of sight queries through the cache
+		bool lineOfSight(Position from, double fromHeight, Position to, double toHeight);
+		bool lineOfSight(const SightLine& line);
+		// Batch of queries processed on all hardware threads, result is 1 for visible lines
+		std::vector<uint8_t> lineOfSight(const std::vector<SightLine>& lines);
+
+		// Visibility of every sample of the region (within radius in meters, 0 for the whole region)
+		Grid<uint8_t> viewshed(const ElevationRegion& terrain, Position observer, double observerHeight, double targetHeight = 0.0, double radius = 0.0) const;
+		// Viewshed on a terrain region around the observer at cache precision
+		Viewshed viewshed(Position observer, double observerHeight, double radius, double targetHeight = 0.0);
+
+		// Coefficient of atmospheric refraction (0.13 by default, 0 disables refraction)
+		void setRefraction(double refraction);
+		double getRefraction() const;
+
+	private:
+		ElevationCache* cache;
+		double refraction = 0.13;
+
+		// Drop of the earth surface at the given distance in meters
+		double curvature(double distance) const;
+
+		double sample(double latitude, double longitude, const ElevationCacheCell*& cell) const;
+		void prepare(const std::vector<SightLine>& lines, std::vector<double>& groundFrom, std::vector<double>& groundTo);
+		bool trace(const SightLine& line, double groundFrom, double groundTo) const;
+	};
+
+}	// end namespace eleman
+
+#endif // ELEVATIONVISIBILITY_H
@@ -4,45 +4,174 @@
 #ifndef GRID_H
 #define GRID_H
 
+#include "mappedfile.h"
+
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stddef.h>
 #include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Non-owning view of a rectangle of grid elements, consecutive rows are stride elements apart.
+ * GridView<const T> gives read only access, mutable views convert to it implicitly.
+ */
+template <typename ElemType>
+class GridView
+{
+public:
+	typedef typename std::remove_const<ElemType>::type ValueType;
+
+	GridView() : data(nullptr), width(0), height(0), stride(0)
+	{
+
+	}
+
+	GridView(ElemType* data, uint32_t width, uint32_t height, size_t stride)
+		: data(data), width(width), height(height), stride(stride)
+	{
+
+	}
+
+	template <typename OtherType, typename = typename std::enable_if<std::is_same<const OtherType, ElemType>::value>::type>
+	GridView(const GridView<OtherType>& view)
+		: data(view.getData()), width(view.getWidth()), height(view.getHeight()), stride(view.getStride())
+	{
+
+	}
+
+
+	ElemType& at(const uint32_t& x, const uint32_t& y) const
+	{
+		return data[y * stride + x];
+	}
+
+	ValueType get(const uint32_t& x, const uint32_t& y) const
+	{
+		return data[y * stride + x];
+	}
+
+	void set(const uint32_t& x, const uint32_t& y, const ValueType& value) const
+	{
+		data[y * stride + x] = value;
+	}
+
+	ElemType* row(const uint32_t& y) const
+	{
+		return data + y * stride;
+	}
+
+	// Sub rectangle starting at x/y
+	GridView view(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const
+	{
+		return GridView(data + y * stride + x, width, height, stride);
+	}
+
+
+	void fill(const ValueType& value) const
+	{
+		if(stride == width)
+		{
+			std::fill_n(data, size_t(width) * height, value);
+			return;
+		}
+
+		for(uint32_t y = 0; y < height; y++)
+			std::fill_n(row(y), width, value);
+	}
+
+	// Copies the overlapping top left part of the source
+	void copy(const GridView<const ValueType>& source) const
+	{
+		uint32_t rangeX = std::min(width, source.getWidth());
+		uint32_t rangeY = std::min(height, source.getHeight());
+
+		// Whole block at once if neither view has gaps between its rows
+		if(rangeX == width && rangeX == source.getWidth() && stride == width && source.getStride() == width)
+		{
+			copyElements(source.getData(), data, size_t(width) * rangeY);
+			return;
+		}
+
+		for(uint32_t y = 0; y < rangeY; y++)
+			copyElements(source.row(y), row(y), rangeX);
+	}
+
+
+	ElemType* getData() const { return data; }
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+	size_t getStride() const { return stride; }
+
+private:
+	ElemType* data;
+	uint32_t width, height;
+	size_t stride;
+
+	static void copyElements(const ValueType* from, ValueType* to, size_t count)
+	{
+		if(std::is_trivially_copyable<ValueType>::value)
+			std::memmove(to, from, count * sizeof(ValueType));
+		else
+			std::copy_n(from, count, to);
+	}
+};
+
 
 /**
- * @todo write docs
+ * Owning two dimensional array. Rows start on 64 byte boundaries, for this the row stride is padded
+ * whenever the element size divides the alignment. Use row() or views to walk rows instead of
+ * assuming the rows to be contiguous.
+ * Grids of trivially copyable elements may be backed by a file mapping instead of heap memory,
+ * copies and resized grids always live on the heap.
  */
 template <typename ElemType>
 class Grid
 {
 public:
+	static constexpr size_t ALIGNMENT = 64;
+
+	Grid() : data(nullptr), width(0), height(0), stride(0)
+	{
+
+	}
 
-    /**
-     * Default constructor
-     */
+	/**
+	 * Default constructor
+	 */
 	Grid(uint32_t width, uint32_t height)
 	{
-		this->width = width;
-		this->height = height;
-		this->data = new ElemType[width * height];
+		allocate(width, height);
+		std::uninitialized_default_construct_n(data, elements());
 	}
 
 	Grid(uint32_t width, uint32_t height, ElemType value)
 	{
-		this->width = width;
-		this->height = height;
-		this->data = new ElemType[width * height];
-
-		for(size_t i = 0; i < width * height; i++)
-			this->data[i] = value;
+		allocate(width, height);
+		std::uninitialized_fill_n(data, elements(), value);
 	}
 
 	Grid(const Grid& grid)
 	{
-		this->width		= grid.width;
-		this->height	= grid.height;
-		this->data		= new ElemType[width * height];
+		allocate(grid.width, grid.height);
+		if(stride == grid.stride)
+		{
+			std::uninitialized_copy_n(grid.data, elements(), data);
+		}
+		else
+		{
+			// Mapped grids may use a different row alignment
+			std::uninitialized_default_construct_n(data, elements());
+			view().copy(grid.view());
+		}
+	}
 
-		for(size_t i = 0; i < width * height; i++)
-			this->data[i] = grid.data[i];
+	Grid(Grid&& grid) noexcept : Grid()
+	{
+		swap(grid);
 	}
 
 	/**
@@ -50,42 +179,139 @@ public:
 	*/
 	~Grid()
 	{
-		delete[] data;
+		release();
+	}
+
+	Grid& operator=(const Grid& grid)
+	{
+		if(this == &grid) return *this;
+
+		// Reuse the buffer (or shared mapping) if the size matches, other mappings can not or should not be written
+		bool writable = !mapping || mapping->getMode() == eleman::MappedFile::SHARED;
+		if(writable && width == grid.width && height == grid.height)
+		{
+			view().copy(grid.view());
+			return *this;
+		}
+
+		Grid copy(grid);
+		swap(copy);
+		return *this;
+	}
+
+	Grid& operator=(Grid&& grid) noexcept
+	{
+		swap(grid);
+		return *this;
+	}
+
+	void swap(Grid& grid) noexcept
+	{
+		std::swap(data, grid.data);
+		std::swap(width, grid.width);
+		std::swap(height, grid.height);
+		std::swap(stride, grid.stride);
+		std::swap(mapping, grid.mapping);
+	}
+
+
+	/**
+	 *	Grid backed by rows stored in a file, a row takes getStride() elements
+	 *	@param offset Start of the first row in the file, has to be a multiple of the page size
+	 *	@param rowAlignment Rows start at multiples of this amount of bytes, e.g. MappedFile::pageSize()
+	 */
+	static Grid map(const std::filesystem::path& filepath, uint32_t width, uint32_t height,
+					eleman::MappedFile::Mode mode, size_t offset = 0, size_t rowAlignment = ALIGNMENT)
+	{
+		static_assert(std::is_trivially_copyable<ElemType>::value, "Only trivially copyable elements can be mapped");
+
+		Grid grid;
+		grid.width = width;
+		grid.height = height;
+		grid.stride = strideFor(width, rowAlignment);
+		grid.mapping = std::make_shared<eleman::MappedFile>(filepath, offset, grid.elements() * sizeof(ElemType), mode);
+		grid.data = static_cast<ElemType*>(grid.mapping->getData());
+		return grid;
+	}
+
+	// Bytes a mapped grid occupies in its file
+	static size_t mappedSize(uint32_t width, uint32_t height, size_t rowAlignment = ALIGNMENT)
+	{
+		return strideFor(width, rowAlignment) * height * sizeof(ElemType);
+	}
+
+	bool isMapped() const
+	{
+		return mapping != nullptr;
+	}
+
+	// Writes modified rows of a shared mapping to the file, nothing to do for heap grids
+	void sync()
+	{
+		if(mapping) mapping->sync();
 	}
 
 
 	ElemType& at(const uint32_t& x, const uint32_t& y)
 	{
-		return data[y * width + x];
+		return data[y * stride + x];
 	}
 
 	ElemType get(const uint32_t& x, const uint32_t& y) const
 	{
-		return data[y * width + x];
+		return data[y * stride + x];
 	}
 
 	void set(const uint32_t& x, const uint32_t& y, const ElemType& value)
 	{
-		data[y * width + x] = value;
+		data[y * stride + x] = value;
 	}
 
+	// Contiguous access to a whole row, used by the row based kernels
+	ElemType* row(const uint32_t& y)
+	{
+		return data + y * stride;
+	}
 
-	void resize(const uint32_t& width, const uint32_t& height)
+	const ElemType* row(const uint32_t& y) const
 	{
-		ElemType* newData = new ElemType[width * height];
+		return data + y * stride;
+	}
 
-		uint32_t rangeX = std::min(this->width, width);
-		uint32_t rangeY = std::min(this->height, height);
 
-		for(uint32_t y = 0; y < rangeY; y++)
-		{
-			for(uint32_t x = 0; x < rangeX; x++)
-			{
-				newData[y * width + x] = data[y * width + x];
-			}
-		}
-		delete[] data;
-		data = newData;
+	// Views of the whole grid or a sub rectangle
+	GridView<ElemType> view()
+	{
+		return GridView<ElemType>(data, width, height, stride);
+	}
+
+	GridView<const ElemType> view() const
+	{
+		return GridView<const ElemType>(data, width, height, stride);
+	}
+
+	GridView<ElemType> view(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+	{
+		return view().view(x, y, width, height);
+	}
+
+	GridView<const ElemType> view(uint32_t x, uint32_t y, uint32_t width, uint32_t height) const
+	{
+		return view().view(x, y, width, height);
+	}
+
+	// Padding is filled as well, this keeps the whole buffer a single run
+	void fill(const ElemType& value)
+	{
+		std::fill_n(data, elements(), value);
+	}
+
+
+	void resize(const uint32_t& width, const uint32_t& height)
+	{
+		Grid resized(width, height);
+		resized.view().copy(view());
+		swap(resized);
 	}
 
 
@@ -97,15 +323,61 @@ public:
 	{
 		return height;
 	}
+	// Elements between the starts of two rows
+	size_t getStride() const
+	{
+		return stride;
+	}
 
+	// Mapped grids are paged by the OS and not counted
 	uint64_t memory() const
 	{
-		return sizeof(Grid<ElemType>) +  width * height * sizeof(ElemType);
+		return sizeof(Grid<ElemType>) + (mapping ? 0 : elements() * sizeof(ElemType));
 	}
 
 private:
 	ElemType* data;
 	uint32_t width, height;
+	size_t stride;
+	std::shared_ptr<eleman::MappedFile> mapping;
+
+	size_t elements() const
+	{
+		return stride * height;
+	}
+
+	void allocate(uint32_t width, uint32_t height)
+	{
+		this->width = width;
+		this->height = height;
+
+		stride = strideFor(width, ALIGNMENT);
+		data = elements() > 0 ? static_cast<ElemType*>(::operator new(elements() * sizeof(ElemType), std::align_val_t(ALIGNMENT))) : nullptr;
+	}
+
+	// Pad rows to the alignment if elements can fill it exactly
+	static size_t strideFor(uint32_t width, size_t alignment)
+	{
+		if(alignment % sizeof(ElemType) != 0) return width;
+
+		size_t perLine = alignment / sizeof(ElemType);
+		return (size_t(width) + perLine - 1) / perLine * perLine;
+	}
+
+	void release()
+	{
+		if(mapping)
+		{
+			mapping.reset();
+			data = nullptr;
+			return;
+		}
+		if(data == nullptr) return;
+
+		std::destroy_n(data, elements());
+		::operator delete(data, std::align_val_t(ALIGNMENT));
+		data = nullptr;
+	}
 };
 
 #endif // GRID_H
@@ -0,0 +1,51 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <filesystem>
+#include <stddef.h>
+
+namespace eleman
+{
+
+	/**
+	 * Memory mapping of a byte range of a file, unmapped on destruction.
+	 * Pages are loaded by the OS on first access and may be dropped again under memory pressure.
+	 */
+	class MappedFile
+	{
+	public:
+		enum Mode {
+			READ_ONLY,		// Writing to the mapping is not allowed (crashes)
+			COPY_ON_WRITE,	// Writes stay private to the process and never reach the file
+			SHARED			// Writes go to the file, which is created or grown as needed
+		};
+
+		// Offset has to be a multiple of the page size
+		MappedFile(const std::filesystem::path& filepath, size_t offset, size_t size, Mode mode);
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile();
+
+		// Writes modified pages of a shared mapping back to the file
+		void sync();
+		// Hint that the range will be needed soon, the OS starts reading it in the background
+		void prefetch(size_t offset, size_t size);
+
+		void* getData() const { return data; }
+		size_t getSize() const { return size; }
+		Mode getMode() const { return mode; }
+
+		static size_t pageSize();
+
+	private:
+		void* data;
+		size_t size;
+		Mode mode;
+	};
+
+}	// end namespace eleman
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,54 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+// Converts every cell file of a cache directory (e.g. JSON written by older versions) into another format and
+// verifies the result. The cache may be used by other programs meanwhile.
+// Usage: migrate <cache directory> [raw|fast|high|paged|json] [threads] [memory MB]
+
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include <eleman/elevationio.h>
+
+int main(int argc, char **argv)
+{
+	if(argc < 2 || argc > 5)
+	{
+		printf("Usage: %s <cache directory> [raw|fast|high|paged|json] [threads] [memory MB]\n", argv[0]);
+		return 1;
+	}
+
+	std::string format = argc > 2 ? argv[2] : "raw";
+	uint32_t threads = argc > 3 ? strtoul(argv[3], nullptr, 10) : 0;
+	size_t memory = argc > 4 ? strtoull(argv[4], nullptr, 10) << 20 : size_t(256) << 20;
+
+	try
+	{
+		eleman::ElevationIO io(argv[1]);
+		if(format == "json")
+			io.setFormat(eleman::ElevationIO::JSON);
+		else if(format == "fast")
+			io.setEncoding(eleman::ElevationIO::FAST);
+		else if(format == "high")
+			io.setEncoding(eleman::ElevationIO::HIGH);
+		else if(format == "paged")
+			io.setEncoding(eleman::ElevationIO::PAGED);
+		else if(format != "raw")
+			throw std::runtime_error("Unknown format " + format);
+
+		eleman::ElevationIO::MigrationReport report = io.migrate(threads, memory);
+		printf("%lu cells, %lu migrated, %lu failed, %lu verified, %lu bytes before, %lu bytes after\n",
+			   (unsigned long)report.cells, (unsigned long)report.migrated, (unsigned long)report.failed,
+			   (unsigned long)report.verified, (unsigned long)report.bytesBefore, (unsigned long)report.bytesAfter);
+		if(report.verified != report.cells) return 1;
+	}
+	catch(const std::exception& e)
+	{
+		printf("%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
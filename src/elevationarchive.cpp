@@ -0,0 +1,428 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationarchive.h"
+
+#include "eleman/elevationutils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	// Archive layout: header, then cell files and indices in the order they were appended. The header points to
+	// the latest index, older indices and replaced cells are garbage. Host byte order (little endian).
+	// Index: layer count, layers (length and name), entry count, entries sorted by layer and cell.
+	const char ARCHIVE_MAGIC[4] = {'E', 'D', 'C', 'A'};
+	const uint16_t ARCHIVE_VERSION = 1;
+
+	struct ArchiveHeader
+	{
+		char magic[4];
+		uint16_t version;
+		uint16_t reserved;
+		uint64_t indexOffset;	// 0 as long as no index was written
+		uint64_t indexSize;
+		uint64_t indexChecksum;
+		uint64_t entries;
+		uint64_t reserved2[3];
+	};
+	static_assert(sizeof(ArchiveHeader) == 64, "Archive header has to stay 64 bytes");
+
+	struct IndexEntry
+	{
+		uint32_t layer;
+		uint32_t reserved;
+		uint64_t cellID;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	void readAt(int fd, uint8_t* data, size_t size, uint64_t offset)
+	{
+		while(size > 0)
+		{
+			ssize_t done = pread(fd, data, size, offset);
+			if(done < 0 && errno == EINTR) continue;
+			if(done <= 0)
+				throw std::runtime_error(std::string("[ElevationArchive] could not read: ") + (done < 0 ? strerror(errno) : "unexpected end of file"));
+			data += done;
+			size -= done;
+			offset += done;
+		}
+	}
+
+	void writeAt(int fd, const uint8_t* data, size_t size, uint64_t offset)
+	{
+		while(size > 0)
+		{
+			ssize_t done = pwrite(fd, data, size, offset);
+			if(done < 0 && errno == EINTR) continue;
+			if(done <= 0)
+				throw std::runtime_error(std::string("[ElevationArchive] could not write: ") + strerror(errno));
+			data += done;
+			size -= done;
+			offset += done;
+		}
+	}
+
+	template <typename T>
+	void append(std::vector<uint8_t>& buffer, const T& value)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	template <typename T>
+	bool take(const std::vector<uint8_t>& buffer, size_t& position, T& value)
+	{
+		if(position + sizeof(T) > buffer.size()) return false;
+		memcpy(&value, buffer.data() + position, sizeof(T));
+		position += sizeof(T);
+		return true;
+	}
+}
+
+eleman::ElevationArchive::ElevationArchive(const std::filesystem::path& filepath, Mode mode)
+{
+	this->filepath = filepath;
+	this->mode = mode;
+	open();
+}
+
+eleman::ElevationArchive::~ElevationArchive()
+{
+	try
+	{
+		close();
+	}
+	catch(const std::exception& e)
+	{
+		printf("[ElevationArchive] could not write the index of %s: %s\n", filepath.c_str(), e.what());
+	}
+}
+
+
+bool eleman::ElevationArchive::read(const std::string& layer, uint64_t cellID, std::vector<uint8_t>& buffer) const
+{
+	refresh();
+	std::shared_lock<std::shared_mutex> lock(mutex);
+
+	auto layerIt = layerIDs.find(layer);
+	if(layerIt == layerIDs.end()) return false;
+	auto it = index.find({layerIt->second, cellID});
+	if(it == index.end()) return false;
+
+	buffer.resize(it->second.size);
+	readAt(fd, buffer.data(), buffer.size(), it->second.offset);
+	return true;
+}
+
+bool eleman::ElevationArchive::contains(const std::string& layer, uint64_t cellID) const
+{
+	refresh();
+	std::shared_lock<std::shared_mutex> lock(mutex);
+
+	auto layerIt = layerIDs.find(layer);
+	return layerIt != layerIDs.end() && index.count({layerIt->second, cellID}) > 0;
+}
+
+void eleman::ElevationArchive::write(const std::string& layer, uint64_t cellID, const uint8_t* data, size_t size)
+{
+	if(mode == READ_ONLY)
+		throw std::runtime_error("[ElevationArchive] archive is read only");
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+
+	writeAt(fd, data, size, end);
+	index[{layerID(layer), cellID}] = {end, size};
+	end += size;
+	modified = true;
+}
+
+void eleman::ElevationArchive::flush()
+{
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	if(modified) writeIndex();
+}
+
+
+uint64_t eleman::ElevationArchive::import(const std::filesystem::path& cacheDir)
+{
+	uint64_t count = 0;
+	std::vector<uint8_t> buffer;
+	for(const std::filesystem::directory_entry& file : std::filesystem::recursive_directory_iterator(cacheDir))
+	{
+		if(!file.is_regular_file() || file.path().extension() != ".edc") continue;
+
+		uint64_t cellID;
+		try
+		{
+			cellID = std::stoull(file.path().stem().string());
+		}
+		catch(const std::exception&)
+		{
+			continue;
+		}
+
+		// Copied as is with the update log folded in, loading detects the format of every cell
+		if(!ElevationIO::readCellFile(file.path(), buffer))
+			throw std::runtime_error("[ElevationArchive] could not read " + file.path().string());
+
+		std::string layer = std::filesystem::relative(file.path().parent_path(), cacheDir).generic_string();
+		write(layer, cellID, buffer.data(), buffer.size());
+		count++;
+	}
+
+	flush();
+	return count;
+}
+
+void eleman::ElevationArchive::compact()
+{
+	if(mode == READ_ONLY)
+		throw std::runtime_error("[ElevationArchive] archive is read only");
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+
+	// Readers of the old file keep it until they reopen, it is replaced and not changed
+	std::filesystem::path temporary = filepath;
+	temporary += ".tmp";
+	std::filesystem::remove(temporary);
+	{
+		ElevationArchive compacted(temporary, READ_WRITE);
+		std::vector<uint8_t> buffer;
+		for(const auto& entry : index)
+		{
+			buffer.resize(entry.second.size);
+			readAt(fd, buffer.data(), buffer.size(), entry.second.offset);
+			compacted.write(layers[entry.first.first], entry.first.second, buffer.data(), buffer.size());
+		}
+		compacted.flush();
+	}
+
+	modified = false;
+	close();
+	std::filesystem::rename(temporary, filepath);
+	open();
+}
+
+
+size_t eleman::ElevationArchive::size() const
+{
+	refresh();
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return index.size();
+}
+
+uint64_t eleman::ElevationArchive::fileSize() const
+{
+	struct stat status;
+	if(fstat(fd, &status) != 0)
+		throw std::runtime_error("[ElevationArchive] could not stat " + filepath.string());
+	return status.st_size;
+}
+
+std::vector<std::pair<std::string, uint64_t>> eleman::ElevationArchive::list() const
+{
+	refresh();
+	std::shared_lock<std::shared_mutex> lock(mutex);
+
+	std::vector<std::pair<std::string, uint64_t>> cells;
+	cells.reserve(index.size());
+	for(const auto& entry : index)
+		cells.push_back({layers[entry.first.first], entry.first.second});
+	return cells;
+}
+
+
+void eleman::ElevationArchive::open()
+{
+	fd = mode == READ_WRITE ? ::open(filepath.c_str(), O_RDWR | O_CREAT, 0644) : ::open(filepath.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("[ElevationArchive] could not open " + filepath.string() + ": " + strerror(errno));
+
+	// Writers exclude each other, readers never lock
+	if(mode == READ_WRITE && flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		::close(fd);
+		fd = -1;
+		throw std::runtime_error("[ElevationArchive] " + filepath.string() + " is written by another process");
+	}
+
+	try
+	{
+		readIndex();
+	}
+	catch(...)
+	{
+		::close(fd);
+		fd = -1;
+		throw;
+	}
+}
+
+void eleman::ElevationArchive::close()
+{
+	if(fd < 0) return;
+
+	if(modified) writeIndex();
+	::close(fd);
+	fd = -1;
+}
+
+void eleman::ElevationArchive::refresh() const
+{
+	// Only the writer changes the index, readers pick up what it published since
+	if(mode != READ_ONLY) return;
+
+	ArchiveHeader header;
+	readAt(fd, reinterpret_cast<uint8_t*>(&header), sizeof(header), 0);
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	if(header.indexOffset != indexOffset)
+		readIndex();
+}
+
+void eleman::ElevationArchive::readIndex() const
+{
+	layers.clear();
+	layerIDs.clear();
+	index.clear();
+	indexOffset = 0;
+
+	ArchiveHeader header;
+	if(fileSize() == 0 && mode == READ_WRITE)
+	{
+		header = {};
+		memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+		header.version = ARCHIVE_VERSION;
+		writeAt(fd, reinterpret_cast<const uint8_t*>(&header), sizeof(header), 0);
+		end = sizeof(header);
+		return;
+	}
+
+	readAt(fd, reinterpret_cast<uint8_t*>(&header), sizeof(header), 0);
+	if(memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 || header.version != ARCHIVE_VERSION)
+		throw std::runtime_error("[ElevationArchive] " + filepath.string() + " is no elevation archive");
+
+	// Anything behind the index was appended but never published
+	end = header.indexOffset == 0 ? sizeof(header) : header.indexOffset + header.indexSize;
+	indexOffset = header.indexOffset;
+	if(header.indexOffset == 0) return;
+
+	std::vector<uint8_t> buffer(header.indexSize);
+	readAt(fd, buffer.data(), buffer.size(), header.indexOffset);
+	if(checksum(buffer.data(), buffer.size()) != header.indexChecksum)
+		throw std::runtime_error("[ElevationArchive] index of " + filepath.string() + " is damaged");
+
+	size_t position = 0;
+	uint32_t layerCount = 0;
+	uint64_t entryCount = 0;
+	bool intact = take(buffer, position, layerCount);
+	for(uint32_t i = 0; intact && i < layerCount; i++)
+	{
+		uint32_t length = 0;
+		intact = take(buffer, position, length) && position + length <= buffer.size();
+		if(!intact) break;
+		layers.emplace_back(reinterpret_cast<const char*>(buffer.data() + position), length);
+		layerIDs[layers.back()] = i;
+		position += length;
+	}
+	intact = intact && take(buffer, position, entryCount);
+	for(uint64_t i = 0; intact && i < entryCount; i++)
+	{
+		IndexEntry entry;
+		intact = take(buffer, position, entry) && entry.layer < layers.size();
+		if(intact) index[{entry.layer, entry.cellID}] = {entry.offset, entry.size};
+	}
+	if(!intact)
+		throw std::runtime_error("[ElevationArchive] index of " + filepath.string() + " is damaged");
+}
+
+void eleman::ElevationArchive::writeIndex()
+{
+	std::vector<uint8_t> buffer;
+	append(buffer, uint32_t(layers.size()));
+	for(const std::string& layer : layers)
+	{
+		append(buffer, uint32_t(layer.size()));
+		buffer.insert(buffer.end(), layer.begin(), layer.end());
+	}
+	append(buffer, uint64_t(index.size()));
+	for(const auto& entry : index)
+		append(buffer, IndexEntry{entry.first.first, 0, entry.first.second, entry.second.offset, entry.second.size});
+
+	// Cells and index have to be on disk before the header points to them
+	writeAt(fd, buffer.data(), buffer.size(), end);
+	fdatasync(fd);
+
+	ArchiveHeader header = {};
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+	header.version = ARCHIVE_VERSION;
+	header.indexOffset = end;
+	header.indexSize = buffer.size();
+	header.indexChecksum = checksum(buffer.data(), buffer.size());
+	header.entries = index.size();
+	writeAt(fd, reinterpret_cast<const uint8_t*>(&header), sizeof(header), 0);
+	fdatasync(fd);
+
+	indexOffset = end;
+	end += buffer.size();
+	modified = false;
+}
+
+uint32_t eleman::ElevationArchive::layerID(const std::string& layer)
+{
+	auto it = layerIDs.find(layer);
+	if(it != layerIDs.end()) return it->second;
+
+	layers.push_back(layer);
+	layerIDs[layer] = layers.size() - 1;
+	return layers.size() - 1;
+}
+
+
+eleman::ElevationArchiveIO::ElevationArchiveIO(ElevationArchive& archive) : archive(archive)
+{
+
+}
+
+bool eleman::ElevationArchiveIO::store(ElevationCacheCell& cell)
+{
+	if(!cell.isDirty()) return false;
+
+	std::string layer = getLayer(cell);
+	std::vector<uint8_t> buffer;
+	encodeCell(cell, buffer);
+	archive.write(layer, cell.getID(), buffer.data(), buffer.size());
+	markStored(cell);
+
+	return true;
+}
+
+bool eleman::ElevationArchiveIO::load(ElevationCacheCell& cell)
+{
+	std::string layer = getLayer(cell);
+	std::vector<uint8_t> buffer;
+	if(!archive.read(layer, cell.getID(), buffer)) return false;
+
+	// Damaged cells are ignored like missing ones
+	return decodeCell(cell, buffer.data(), buffer.size());
+}
+
+void eleman::ElevationArchiveIO::flush()
+{
+	archive.flush();
+}
+
+std::string eleman::ElevationArchiveIO::getLayer(const ElevationCacheCell& cell)
+{
+	return getDirectory("", cell).generic_string();
+}
@@ -3,17 +3,63 @@
 
 #include "eleman/elevationcache.h"
 
+#include "eleman/elevationcodec.h"
 #include "eleman/elevationdata.h"
 #include "eleman/elevationexception.h"
 #include "eleman/elevationio.h"
 #include "eleman/elevationmanager.h"
 #include "eleman/elevationutils.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <exception>
+#include <future>
 #include <math.h>
 #include <set>
+#include <tuple>
 
 
+// Publishes the changes of a bulk write once at its end, even if the write throws
+class UpdateBatch
+{
+public:
+	UpdateBatch(eleman::ElevationCache& cache) : cache(cache)
+	{
+		cache.beginUpdates();
+	}
+
+	// Publishes on success, exceptions of the listeners reach the caller
+	void commit()
+	{
+		committed = true;
+		cache.endUpdates();
+	}
+
+	~UpdateBatch()
+	{
+		if(committed) return;
+
+		// The write threw, listeners must not throw again while unwinding
+		try
+		{
+			cache.endUpdates();
+		}
+		catch(const std::exception& e)
+		{
+			printf("[ElevationCache] update listener failed: %s\n", e.what());
+		}
+		catch(...)
+		{
+			printf("[ElevationCache] update listener failed\n");
+		}
+	}
+
+private:
+	eleman::ElevationCache& cache;
+	bool committed = false;
+};
+
 eleman::ElevationCache::ElevationCache() : ElevationCache(100, 10.0)
 {
 
@@ -77,6 +123,82 @@ std::vector< eleman::ElevationData > eleman::ElevationCache::get(const std::vect
 	return data;
 }
 
+void eleman::ElevationCache::get(const double* latitude, const double* longitude, size_t count, double* elevation, uint8_t* status,
+								 ElevationRegion::Interpolation interpolation)
+{
+	getBatch(latitude, longitude, count, elevation, status, interpolation);
+}
+
+void eleman::ElevationCache::get(const double* latitude, const double* longitude, size_t count, float* elevation, uint8_t* status,
+								 ElevationRegion::Interpolation interpolation)
+{
+	getBatch(latitude, longitude, count, elevation, status, interpolation);
+}
+
+template <typename T>
+void eleman::ElevationCache::getBatch(const double* latitude, const double* longitude, size_t count, T* elevation, uint8_t* status,
+									  ElevationRegion::Interpolation interpolation)
+{
+	// Cell IDs of the upper bounds (90 / 180) belong to the last row/column of cells
+	static const double maxLatitude = std::nextafter(90.0, 0.0);
+	static const double maxLongitude = std::nextafter(180.0, 0.0);
+
+	auto valid = [&](size_t i)
+	{
+		return latitude[i] >= -90.0 && latitude[i] <= 90.0 && longitude[i] >= -180.0 && longitude[i] <= 180.0;
+	};
+
+	ElevationCacheCell* cell = nullptr;
+	auto lookup = [&](size_t i)
+	{
+		double lat = latitude[i];
+		double lon = longitude[i];
+		if(!valid(i))
+		{
+			elevation[i] = NAN;
+			if(status) status[i] = QUERY_OUT_OF_RANGE;
+			return;
+		}
+
+		// Consecutive positions mostly stay in the same cell
+		cell = cellFor(std::min(lat, maxLatitude), std::min(lon, maxLongitude), cell);
+		double value = cell->get(lat, lon, interpolation);
+
+		elevation[i] = T(value);
+		if(status) status[i] = std::isnan(value) ? QUERY_UNKNOWN : QUERY_OK;
+	};
+
+	if(batchOrder == INPUT_ORDER || count < 2)
+	{
+		for(size_t i = 0; i < count; i++)
+			lookup(i);
+		return;
+	}
+
+	// Cell coordinates extended by as many fractional bits as fit into 32 bits, the curve passes
+	// every cell in one go and orders the positions inside the cells as well
+	double scale = cellDivisions;
+	while(360.0 * scale * 2.0 < 4294967296.0) scale *= 2.0;
+
+	// Visit the positions sorted along the curve, results are written back to their input slot
+	batchKeys.resize(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		uint64_t key = UINT64_MAX;
+		if(valid(i))
+		{
+			uint32_t x = std::min((longitude[i] + 180.0) * scale, 4294967295.0);
+			uint32_t y = std::min((latitude[i] + 90.0) * scale, 4294967295.0);
+			key = batchOrder == HILBERT_ORDER ? hilbertIndex(x, y) : mortonIndex(x, y);
+		}
+		batchKeys[i] = {key, i};
+	}
+	std::sort(batchKeys.begin(), batchKeys.end());
+
+	for(const auto& key : batchKeys)
+		lookup(key.second);
+}
+
 eleman::ElevationRegion eleman::ElevationCache::get(double lat0, double lon0, double lat1, double lon1, double precision, eleman::ElevationRegion::Interpolation interpolation)
 {
 	ElevationRegion region(lat0, lon0, lat1, lon1, precision);
@@ -94,35 +216,300 @@ eleman::ElevationRegion eleman::ElevationCache::get(double lat0, double lon0, do
 void eleman::ElevationCache::fillRegion(eleman::ElevationRegion& region, ElevationRegion::Interpolation interpolation)
 {
 	// Load all required cells
-	std::vector<uint64_t> ids = cellsForRegion(region.getLat0(), region.getLon0(), region.getLat1(), region.getLon1());
-	for(uint64_t& id : ids)
-		loadCell(id);
+	loadCells(cellsForRegion(region.getLat0(), region.getLon0(), region.getLat1(), region.getLon1()));
 
-	// Retrieve data for region
-	for(uint32_t y = 0; y < region.getGridSizeLat(); y++)
+	fillRegion(region, 0, 0, region.getGridSizeLon() - 1, region.getGridSizeLat() - 1, interpolation);
+}
+
+void eleman::ElevationCache::fillRegion(ElevationRegion& region, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+										ElevationRegion::Interpolation interpolation)
+{
+	x1 = std::min(x1, region.getGridSizeLon() - 1);
+	y1 = std::min(y1, region.getGridSizeLat() - 1);
+	bool wholeRows = x0 == 0 && x1 == region.getGridSizeLon() - 1;
+
+	// Coarse regions average the footprint of every sample, point sampling would alias
+	double metersLon, metersLat;
+	region.gridSpacing((y0 + y1) / 2, metersLon, metersLat);
+	bool area = areaDownsampling && interpolation != ElevationRegion::NEAREST && std::min(metersLon, metersLat) >= 2.0 * precision;
+	if(area)
 	{
-		for(uint32_t x = 0; x < region.getGridSizeLon(); x++)
+		// Footprints reach half a sample beyond the rows and columns, their cells are loaded once up front
+		double latMin = 90.0, latMax = -90.0, lonMin = 180.0, lonMax = -180.0;
+		for(double gridLat : {y0 - 0.5, y1 + 0.5})
 		{
-			// Calculate lat/lon for each grid position in region
-			double lat, lon;
-			region.gridToPos(y, x, lat, lon);
+			for(double gridLon : {x0 - 0.5, x1 + 0.5})
+			{
+				double latitude, longitude;
+				region.gridFloatToPos(gridLat, gridLon, latitude, longitude);
+				latMin = std::min(latMin, latitude);
+				latMax = std::max(latMax, latitude);
+				lonMin = std::min(lonMin, longitude);
+				lonMax = std::max(lonMax, longitude);
+			}
+		}
+		loadCells(cellsForRegion(std::max(latMin, -90.0), std::max(lonMin, -180.0),
+								 std::nextafter(std::min(latMax, 90.0), latMin), std::nextafter(std::min(lonMax, 180.0), lonMin)));
+	}
 
-			// Retrieve appropriate cell
-			uint64_t cellID = toCellID(lat, lon, cellDivisions);
-			ElevationCacheCell* cell = getCell(cellID);
+	// Retrieve data for region
+	std::vector<double> lat(region.getGridSizeLon()), lon(region.getGridSizeLon());
+	ElevationCacheCell* cell = nullptr;
+	for(uint32_t y = y0; y <= y1; y++)
+	{
+		// Calculate lat/lon for each grid position in the row (batched for projected regions)
+		if(wholeRows)
+			region.gridRowToPos(y, lat.data(), lon.data());
+		else
+			for(uint32_t x = x0; x <= x1; x++)
+				region.gridToPos(y, x, lat[x], lon[x]);
+
+		for(uint32_t x = x0; x <= x1; x++)
+		{
+			double elevation = NAN;
+			if(area)
+			{
+				double latitude0, longitude0, latitude1, longitude1;
+				region.gridFloatToPos(y - 0.5, x - 0.5, latitude0, longitude0);
+				region.gridFloatToPos(y + 0.5, x + 0.5, latitude1, longitude1);
+				elevation = areaMean(latitude0, longitude0, latitude1, longitude1);
+			}
+
+			// Point sampling also requests missing samples from the vendor, incomplete footprints end up here as well
+			if(std::isnan(elevation))
+			{
+				// Retrieve appropriate cell
+				cell = cellFor(lat[x], lon[x], cell);
+				elevation = cell->get(lat[x], lon[x], interpolation);
+			}
 
 			// Retrieve data and store in grid
-			region.setGrid(x, y, cell->get(lat, lon, interpolation));
+			region.setGrid(x, y, elevation);
+		}
+	}
+}
+
+double eleman::ElevationCache::areaMean(double latitude0, double longitude0, double latitude1, double longitude1)
+{
+	double lat0 = std::max(std::min(latitude0, latitude1), -90.0);
+	double lat1 = std::min(std::max(latitude0, latitude1), 90.0);
+	double lon0 = std::max(std::min(longitude0, longitude1), -180.0);
+	double lon1 = std::min(std::max(longitude0, longitude1), 180.0);
+	if(!(lat0 < lat1 && lon0 < lon1)) return NAN;
+
+	uint64_t cellX0, cellY0, cellX1, cellY1;
+	toCellXY(lat0, lon0, cellDivisions, cellX0, cellY0);
+	toCellXY(std::nextafter(lat1, lat0), std::nextafter(lon1, lon0), cellDivisions, cellX1, cellY1);
+
+	double sum = 0.0;
+	uint64_t count = 0;
+	for(uint64_t cellY = cellY0; cellY <= cellY1; cellY++)
+	{
+		for(uint64_t cellX = cellX0; cellX <= cellX1; cellX++)
+		{
+			// Loaded by fillRegion, looked up without counting an access for every output sample
+			const ElevationCacheCell* cell = findCell(toCellID(cellX, cellY, cellDivisions));
+			if(cell == nullptr) return NAN;
+
+			// Half open box clipped to the cell, samples on the shared edges are counted by one cell only
+			double boxLat0 = std::max(lat0, cell->getLat0()), boxLat1 = std::min(lat1, cell->getLat1());
+			double boxLon0 = std::max(lon0, cell->getLon0()), boxLon1 = std::min(lon1, cell->getLon1());
+			double gridLat0, gridLon0, gridLat1, gridLon1;
+			cell->posToGridFloat(boxLat0, boxLon0, gridLat0, gridLon0);
+			cell->posToGridFloat(boxLat1, boxLon1, gridLat1, gridLon1);
+
+			const double epsilon = 1e-6;
+			int64_t x0 = std::ceil(gridLon0 - epsilon), x1 = int64_t(std::ceil(gridLon1 - epsilon)) - 1;
+			int64_t y0 = std::ceil(gridLat0 - epsilon), y1 = int64_t(std::ceil(gridLat1 - epsilon)) - 1;
+			x1 = std::min<int64_t>(x1, cell->getGridSizeLon() - 1);
+			y1 = std::min<int64_t>(y1, cell->getGridSizeLat() - 1);
+			if(x0 > x1 || y0 > y1) continue;
+
+			// A partial mean would depend on which samples happen to be cached
+			double cellSum;
+			uint64_t cellCount;
+			cell->sumGrid(x0, y0, x1, y1, cellSum, cellCount);
+			if(cellCount < uint64_t(x1 - x0 + 1) * uint64_t(y1 - y0 + 1)) return NAN;
+			sum += cellSum;
+			count += cellCount;
+		}
+	}
+	return count > 0 ? sum / count : NAN;
+}
+
+void eleman::ElevationCache::streamRegion(double lat0, double lon0, double lat1, double lon1, double precision, uint32_t stripRows,
+										  const std::function<void(const ElevationRegion& strip, uint32_t firstRow)>& callback,
+										  ElevationRegion::Interpolation interpolation)
+{
+	if(stripRows < 2)
+		throw std::runtime_error("[ElevationCache] strips need at least two rows");
+
+	// Same grid as ElevationRegion would use for the whole area
+	uint32_t sizeLat, sizeLon;
+	double referenceLatitude = std::min(std::abs(lat0), std::abs(lat1));
+	calculateGridSize(lat1 - lat0, lon1 - lon0, referenceLatitude, precision, sizeLat, sizeLon);
+
+	for(uint32_t firstRow = 0; ; )
+	{
+		uint32_t lastRow = std::min(firstRow + stripRows - 1, sizeLat - 1);
+		// A single row has no spacing to interpolate with
+		double stripLat0 = sizeLat > 1 ? interpolate(firstRow, 0.0, lat0, sizeLat - 1.0, lat1) : lat0;
+		double stripLat1 = sizeLat > 1 ? interpolate(lastRow, 0.0, lat0, sizeLat - 1.0, lat1) : lat0;
+
+		ElevationRegion strip(stripLat0, lon0, stripLat1, lon1, lastRow - firstRow + 1, sizeLon);
+		fillRegion(strip, interpolation);
+		callback(strip, firstRow);
+
+		if(lastRow + 1 >= sizeLat) break;
+		firstRow = lastRow;
+	}
+}
+
+
+
+
+
+eleman::ElevationProfile eleman::ElevationCache::profile(const std::vector<Position>& polyline, double spacing, bool climb)
+{
+	if(spacing <= 0.0)
+		throw std::runtime_error("[ElevationCache] profile spacing has to be positive");
+
+	ElevationProfile profile;
+	if(polyline.empty()) return profile;
+
+	ElevationCacheCell* cell = nullptr;
+	auto sample = [&](double lat, double lon) {
+		cell = cellFor(lat, lon, cell);
+		double gridLat, gridLon;
+		cell->posToGridFloat(lat, lon, gridLat, gridLon);
+		double elevation = cell->getGridLinear(gridLat, gridLon);
+		// Not cached yet, take the regular path which requests missing data
+		if(std::isnan(elevation))
+			elevation = cell->get(lat, lon);
+
+		profile.elevation.push_back(elevation);
+	};
+
+	double traveled = 0.0;	// Distance at the start of the current segment
+	double next = 0.0;		// Distance of the next sample
+	for(size_t i = 0; i + 1 < polyline.size(); i++)
+	{
+		const Position& a = polyline[i];
+		const Position& b = polyline[i + 1];
+		double dLat = b.latitude - a.latitude;
+		double dLon = b.longitude - a.longitude;
+		double length = std::hypot(degrees2meters(dLat, 0.0), degrees2meters(dLon, (a.latitude + b.latitude) / 2.0));
+		if(length <= 0.0) continue;
+
+		// Walk the segment incrementally
+		double offset = next - traveled;
+		double stepLat = dLat * spacing / length;
+		double stepLon = dLon * spacing / length;
+		double lat = a.latitude + dLat * offset / length;
+		double lon = a.longitude + dLon * offset / length;
+		for(; offset < length; offset += spacing, lat += stepLat, lon += stepLon)
+		{
+			profile.distance.push_back(traveled + offset);
+			sample(lat, lon);
+		}
+
+		traveled += length;
+		next = traveled + offset - length;
+	}
+
+	// Always end at the last vertex
+	if(profile.distance.empty() || profile.distance.back() < traveled)
+	{
+		profile.distance.push_back(traveled);
+		sample(polyline.back().latitude, polyline.back().longitude);
+	}
+
+	if(climb)
+	{
+		profile.ascent.resize(profile.elevation.size());
+		profile.descent.resize(profile.elevation.size());
+		double ascent = 0.0, descent = 0.0;
+		for(size_t i = 0; i < profile.elevation.size(); i++)
+		{
+			double delta = i > 0 ? profile.elevation[i] - profile.elevation[i - 1] : 0.0;
+			if(delta > 0.0) ascent += delta;
+			if(delta < 0.0) descent -= delta;
+			profile.ascent[i] = ascent;
+			profile.descent[i] = descent;
 		}
 	}
+
+	return profile;
+}
+
+double eleman::ElevationCache::minElevation(double latitude0, double longitude0, double latitude1, double longitude1)
+{
+	double min = NAN;
+	std::vector<uint64_t> ids = cellsForRegion(latitude0, longitude0, latitude1, longitude1);
+	loadCells(ids);
+	for(uint64_t& id : ids)
+		min = std::fmin(min, getCell(id)->minElevation(latitude0, longitude0, latitude1, longitude1));
+	return min;
+}
+
+double eleman::ElevationCache::maxElevation(double latitude0, double longitude0, double latitude1, double longitude1)
+{
+	double max = NAN;
+	std::vector<uint64_t> ids = cellsForRegion(latitude0, longitude0, latitude1, longitude1);
+	loadCells(ids);
+	for(uint64_t& id : ids)
+		max = std::fmax(max, getCell(id)->maxElevation(latitude0, longitude0, latitude1, longitude1));
+	return max;
+}
+
+static void polygonBounds(const std::vector<eleman::Position>& polygon, double& lat0, double& lon0, double& lat1, double& lon1)
+{
+	lat0 = lon0 = +INFINITY;
+	lat1 = lon1 = -INFINITY;
+	for(const eleman::Position& pos : polygon)
+	{
+		lat0 = std::min(lat0, pos.latitude);
+		lon0 = std::min(lon0, pos.longitude);
+		lat1 = std::max(lat1, pos.latitude);
+		lon1 = std::max(lon1, pos.longitude);
+	}
 }
 
+double eleman::ElevationCache::minElevation(const std::vector<Position>& polygon)
+{
+	if(polygon.size() < 3) return NAN;
 
+	double lat0, lon0, lat1, lon1;
+	polygonBounds(polygon, lat0, lon0, lat1, lon1);
+
+	double min = NAN;
+	std::vector<uint64_t> ids = cellsForRegion(lat0, lon0, lat1, lon1);
+	loadCells(ids);
+	for(uint64_t& id : ids)
+		min = std::fmin(min, getCell(id)->minElevation(polygon));
+	return min;
+}
+
+double eleman::ElevationCache::maxElevation(const std::vector<Position>& polygon)
+{
+	if(polygon.size() < 3) return NAN;
+
+	double lat0, lon0, lat1, lon1;
+	polygonBounds(polygon, lat0, lon0, lat1, lon1);
+
+	double max = NAN;
+	std::vector<uint64_t> ids = cellsForRegion(lat0, lon0, lat1, lon1);
+	loadCells(ids);
+	for(uint64_t& id : ids)
+		max = std::fmax(max, getCell(id)->maxElevation(polygon));
+	return max;
+}
 
 
 
 uint32_t eleman::ElevationCache::precacheCells(double latitude0, double longitude0, double latitude1, double longitude1)
 {
+	UpdateBatch batch(*this);
 	uint32_t count = 0;
 	std::vector<uint64_t> ids = cellsForRegion(latitude0, longitude0, latitude1, longitude1);
 	for(uint64_t& id : ids)
@@ -132,11 +519,13 @@ uint32_t eleman::ElevationCache::precacheCells(double latitude0, double longitud
 		count += getCell(id)->precacheCell();
 		if(!wasLoaded) unloadCell(id);
 	}
+	batch.commit();
 	return count;
 }
 
 uint32_t eleman::ElevationCache::precacheRadius(double latitude, double longitude, double radius)
 {
+	UpdateBatch batch(*this);
 	double radiusLat = meters2degrees(radius, 0.0);	// Latitude does not change
 	double radiusLon = meters2degrees(radius, latitude);
 
@@ -150,6 +539,7 @@ uint32_t eleman::ElevationCache::precacheRadius(double latitude, double longitud
 		count += getCell(id)->precacheRadius(latitude, longitude, radius);
 		if(!wasLoaded) unloadCell(id);
 	}
+	batch.commit();
 	return count;
 }
 
@@ -161,6 +551,7 @@ uint32_t eleman::ElevationCache::precacheRegion(Position pos0, Position pos1)
 
 uint32_t eleman::ElevationCache::precacheRegion(double latitude0, double longitude0, double latitude1, double longitude1)
 {
+	UpdateBatch batch(*this);
 	uint32_t count = 0;
 	std::vector<uint64_t> ids = cellsForRegion(latitude0, longitude0, latitude1, longitude1);
 	for(uint64_t& id : ids)
@@ -170,10 +561,75 @@ uint32_t eleman::ElevationCache::precacheRegion(double latitude0, double longitu
 		count += getCell(id)->precacheRegion(latitude0, longitude0, latitude1, longitude1);
 		if(!wasLoaded) unloadCell(id);
 	}
+	batch.commit();
 	return count;
 }
 
 
+uint32_t eleman::ElevationCache::addUpdateListener(const std::function<void(const CacheUpdate& update)>& listener)
+{
+	std::lock_guard<std::recursive_mutex> lock(listenerMutex);
+	updateListeners[nextListenerID] = listener;
+	return nextListenerID++;
+}
+
+void eleman::ElevationCache::removeUpdateListener(uint32_t listenerID)
+{
+	std::lock_guard<std::recursive_mutex> lock(listenerMutex);
+	updateListeners.erase(listenerID);
+}
+
+void eleman::ElevationCache::beginUpdates()
+{
+	updateDepth++;
+}
+
+void eleman::ElevationCache::endUpdates()
+{
+	if(updateDepth == 0 || --updateDepth > 0) return;
+
+	// Listeners may write to the cache again
+	std::map<uint64_t, CacheUpdate> updates;
+	updates.swap(pendingUpdates);
+	std::lock_guard<std::recursive_mutex> lock(listenerMutex);
+	for(const auto& updatePair : updates)
+	{
+		for(const auto& listenerPair : updateListeners)
+			listenerPair.second(updatePair.second);
+	}
+}
+
+void eleman::ElevationCache::noteUpdate(const ElevationCacheCell& cell, uint32_t x, uint32_t y)
+{
+	std::lock_guard<std::recursive_mutex> lock(listenerMutex);
+	if(updateListeners.empty()) return;
+
+	CacheUpdate update = {};
+	update.cellID = cell.getID();
+	update.x0 = update.x1 = x;
+	update.y0 = update.y1 = y;
+	auto pending = pendingUpdates.find(update.cellID);
+	if(updateDepth > 0 && pending != pendingUpdates.end())
+	{
+		update.x0 = std::min(x, pending->second.x0);
+		update.y0 = std::min(y, pending->second.y0);
+		update.x1 = std::max(x, pending->second.x1);
+		update.y1 = std::max(y, pending->second.y1);
+	}
+
+	// Positions are resolved right away, bulk writes may unload the cell before publishing
+	cell.gridToPos(update.y0, update.x0, update.lat0, update.lon0);
+	cell.gridToPos(update.y1, update.x1, update.lat1, update.lon1);
+
+	if(updateDepth > 0)
+	{
+		pendingUpdates[update.cellID] = update;
+		return;
+	}
+	for(const auto& listenerPair : updateListeners)
+		listenerPair.second(update);
+}
+
 void eleman::ElevationCache::processCacheMiss(const eleman::CacheMiss& cacheMiss)
 {
 	ElevationVendor* vendor = manager->getVendor();
@@ -191,6 +647,7 @@ void eleman::ElevationCache::processCacheMiss(const eleman::CacheMiss& cacheMiss
 
 void eleman::ElevationCache::processMissing(const std::vector<CacheMiss>& missing)
 {
+	UpdateBatch batch(*this);
 	// Prepare request
 	std::vector<Position> positions;
 	for(const CacheMiss& miss : missing)
@@ -209,6 +666,7 @@ void eleman::ElevationCache::processMissing(const std::vector<CacheMiss>& missin
 		ElevationCacheCell* cell = getCell(missing[i].cellID);
 		cell->setGrid(missing[i].x, missing[i].y, response.results[i].elevation);
 	}
+	batch.commit();
 }
 
 uint32_t eleman::ElevationCache::reportMissing(std::vector< eleman::CacheMiss >& missing, uint32_t limit) const
@@ -238,15 +696,114 @@ bool eleman::ElevationCache::loadCell(uint64_t cellID)
 	if(isCellLoaded(cellID))
 		return false;
 
+	auto warm = warmCells.find(cellID);
+	if(warm != warmCells.end())
+	{
+		ElevationCacheCell& inflated = inflate(warm);
+		inflated.refreshHalo();
+		refreshNeighborHalos(inflated);
+		return true;
+	}
+
 	printf("Loading cell %lu...\n", cellID);
-	ElevationCacheCell cell(this, cellID, cellDivisions, precision);
-	if(io)
-		io->load(cell);
-	cells.insert({cellID, cell});
+	// Built in place, copying would move mapped cell files to the heap
+	ElevationCacheCell& loaded = cells.emplace(std::piecewise_construct, std::forward_as_tuple(cellID),
+											   std::forward_as_tuple(this, cellID, cellDivisions, precision)).first->second;
+	try
+	{
+		if(io)
+			io->load(loaded);
+		loaded.allocateGrids();
+	}
+	catch(...)
+	{
+		cells.erase(cellID);
+		throw;
+	}
+
+	// Both sides of every shared border see each other now
+	loaded.refreshHalo();
+	refreshNeighborHalos(loaded);
 
 	return true;
 }
 
+uint32_t eleman::ElevationCache::loadCells(const std::vector<uint64_t>& cellIDs)
+{
+	struct Loading
+	{
+		uint64_t cellID;
+		ElevationCacheCell* cell;
+		std::future<bool> loaded;
+	};
+
+	// Every read is queued before the first cell is decoded
+	std::vector<Loading> loading;
+	std::exception_ptr error;
+	for(uint64_t cellID : cellIDs)
+	{
+		if(isCellLoaded(cellID)) continue;
+
+		try
+		{
+			// Warm cells are inflated right away, nothing to wait for
+			auto warm = warmCells.find(cellID);
+			if(warm != warmCells.end())
+			{
+				loading.push_back({cellID, &inflate(warm), std::future<bool>()});
+				continue;
+			}
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+			break;
+		}
+
+		printf("Loading cell %lu...\n", cellID);
+		ElevationCacheCell& cell = cells.emplace(std::piecewise_construct, std::forward_as_tuple(cellID),
+												 std::forward_as_tuple(this, cellID, cellDivisions, precision)).first->second;
+		try
+		{
+			loading.push_back({cellID, &cell, io ? io->loadAsync(cell) : std::future<bool>()});
+		}
+		catch(...)
+		{
+			cells.erase(cellID);
+			error = std::current_exception();
+			break;
+		}
+	}
+
+	uint32_t count = 0;
+	for(Loading& load : loading)
+	{
+		try
+		{
+			if(load.loaded.valid()) load.loaded.get();
+			load.cell->allocateGrids();
+			count++;
+		}
+		catch(...)
+		{
+			if(!error) error = std::current_exception();
+			cells.erase(load.cellID);
+			load.cell = nullptr;
+		}
+	}
+
+	// Halos once all cells are there
+	for(Loading& load : loading)
+	{
+		if(!load.cell) continue;
+		load.cell->refreshHalo();
+		refreshNeighborHalos(*load.cell);
+	}
+
+	if(error) std::rethrow_exception(error);
+	return count;
+}
+
 eleman::ElevationCacheCell* eleman::ElevationCache::getCell(uint64_t cellID)
 {
 	if(!isCellLoaded(cellID))
@@ -257,31 +814,29 @@ eleman::ElevationCacheCell* eleman::ElevationCache::getCell(uint64_t cellID)
 	if(it == cells.end())
 		return nullptr;
 
+	it->second.accesses++;
 	return &it->second;
 }
 
 bool eleman::ElevationCache::unloadCell(uint64_t cellID)
 {
-	if(!isCellLoaded(cellID))
+	ElevationCacheCell* cell = findCell(cellID);
+	if(cell == nullptr)
 		return false;
 
-	ElevationCacheCell* cell = getCell(cellID);
-
-	if(io)
-		io->store(*cell);
-
-	cells.erase(cellID);
+	demote(*cell);
+	trimWarm();
 
 	return true;
 }
 
 void eleman::ElevationCache::unloadAll()
 {
-	while(cells.size() > 0)
-	{
-		uint64_t cellID = (*cells.begin()).first;
-		unloadCell(cellID);
-	}
+	// Stored together, the queue keeps the encoded cells
+	flush();
+	cells.clear();
+	warmCells.clear();
+	warmBytes = 0;
 	printf("All Cells unloaded\n");
 }
 
@@ -319,12 +874,226 @@ std::vector<uint64_t> eleman::ElevationCache::cellsForRegion(double latitude0, d
 	return ids;
 }
 
+eleman::ElevationCacheCell* eleman::ElevationCache::cellFor(double latitude, double longitude, ElevationCacheCell* cell)
+{
+	if(cell != nullptr && cell->contains(latitude, longitude))
+		return cell;
+	return getCell(toCellID(latitude, longitude, cellDivisions));
+}
+
+std::vector<uint64_t> eleman::ElevationCache::neighborCells(uint64_t cellID) const
+{
+	uint64_t x, y;
+	fromCellID(cellID, x, y, cellDivisions);
+	const int64_t numLon = 360 * int64_t(cellDivisions);
+	const int64_t numLat = 180 * int64_t(cellDivisions);
+
+	std::vector<uint64_t> ids;
+	for(int64_t dy = -1; dy <= 1; dy++)
+	{
+		for(int64_t dx = -1; dx <= 1; dx++)
+		{
+			int64_t nx = int64_t(x) + dx;
+			int64_t ny = int64_t(y) + dy;
+			if((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= numLon || ny >= numLat) continue;
+			ids.push_back(toCellID(uint64_t(nx), uint64_t(ny), cellDivisions));
+		}
+	}
+	return ids;
+}
+
+eleman::ElevationCacheCell* eleman::ElevationCache::findCell(uint64_t cellID)
+{
+	auto it = cells.find(cellID);
+	return it == cells.end() ? nullptr : &it->second;
+}
+
+void eleman::ElevationCache::updateNeighborHalos(const ElevationCacheCell& cell, uint32_t x, uint32_t y)
+{
+	if(haloWidth == 0) return;
+
+	// Only samples close to the border show up in a neighbour's halo
+	const uint32_t margin = haloWidth + 1;
+	bool west	= x <= margin;
+	bool east	= x + margin >= cell.getGridSizeLon() - 1;
+	bool south	= y <= margin;
+	bool north	= y + margin >= cell.getGridSizeLat() - 1;
+	if(!west && !east && !south && !north) return;
+
+	// Walks the neighbours on the touched sides only, this runs for every written sample and must not allocate
+	uint64_t cellX, cellY;
+	fromCellID(cell.getID(), cellX, cellY, cellDivisions);
+	const int64_t numLon = 360 * int64_t(cellDivisions);
+	const int64_t numLat = 180 * int64_t(cellDivisions);
+	for(int64_t dy = south ? -1 : 0; dy <= (north ? 1 : 0); dy++)
+	{
+		for(int64_t dx = west ? -1 : 0; dx <= (east ? 1 : 0); dx++)
+		{
+			int64_t nx = int64_t(cellX) + dx;
+			int64_t ny = int64_t(cellY) + dy;
+			if((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= numLon || ny >= numLat) continue;
+
+			ElevationCacheCell* neighbor = findCell(toCellID(uint64_t(nx), uint64_t(ny), cellDivisions));
+			if(neighbor) neighbor->updateHalo(cell, x, y);
+		}
+	}
+}
+
+void eleman::ElevationCache::refreshNeighborHalos(const ElevationCacheCell& cell)
+{
+	for(uint64_t neighborID : neighborCells(cell.getID()))
+	{
+		ElevationCacheCell* neighbor = findCell(neighborID);
+		if(neighbor) neighbor->refreshHalo();
+	}
+}
+
 uint32_t eleman::ElevationCache::cellsLoaded()
 {
 	return cells.size();
 }
 
 
+void eleman::ElevationCache::setMemoryBudget(size_t hotBytes, size_t warmBytes)
+{
+	hotBudget = hotBytes;
+	warmBudget = warmBytes;
+	trimWarm();
+}
+
+uint32_t eleman::ElevationCache::balanceTiers()
+{
+	uint32_t demoted = 0;
+	std::vector<std::future<bool>> stores;
+	if(hotBudget > 0)
+	{
+		size_t hot = 0;
+		std::vector<std::pair<uint32_t, uint64_t>> candidates;
+		for(auto& cellPair : cells)
+		{
+			hot += cellPair.second.memory();
+			candidates.push_back({cellPair.second.accesses, cellPair.first});
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		// All dirty cells are queued before the first one is demoted, demote() waits for its write
+		std::vector<uint64_t> demoting;
+		for(const auto& candidate : candidates)
+		{
+			if(hot <= hotBudget) break;
+
+			ElevationCacheCell& cell = cells.at(candidate.second);
+			hot -= cell.memory();
+			if(io && cell.isDirty())
+				stores.push_back(io->storeAsync(cell));
+			demoting.push_back(candidate.second);
+		}
+		for(uint64_t cellID : demoting)
+		{
+			demote(cells.at(cellID));
+			demoted++;
+		}
+	}
+	trimWarm();
+
+	// Frequencies fade, cells used a lot long ago do not stay hot forever
+	for(auto& cellPair : cells)
+		cellPair.second.accesses /= 2;
+	for(auto& warmPair : warmCells)
+		warmPair.second.accesses /= 2;
+
+	std::exception_ptr error;
+	for(std::future<bool>& store : stores)
+	{
+		try
+		{
+			store.get();
+		}
+		catch(...)
+		{
+			if(!error) error = std::current_exception();
+		}
+	}
+	if(error) std::rethrow_exception(error);
+	return demoted;
+}
+
+uint32_t eleman::ElevationCache::cellsWarm() const
+{
+	return warmCells.size();
+}
+
+size_t eleman::ElevationCache::memoryWarm() const
+{
+	return warmBytes;
+}
+
+void eleman::ElevationCache::demote(ElevationCacheCell& cell)
+{
+	if(io)
+		io->store(cell);
+
+	uint64_t cellID = cell.getID();
+	if(warmBudget > 0)
+	{
+		WarmCell& warm = warmCells[cellID];
+		// Exact copy, inflated cells carry on as if they were never demoted
+		ElevationCodec::compress(cell.elevationData->view(), cell.statusData->view(), ElevationCodec::FAST, 0.0, warm.data);
+		warm.data.shrink_to_fit();
+		warm.known = cell.size();
+		warm.accesses = cell.accesses;
+		warm.dirty = cell.isDirty();
+		warm.stored = cell.stored;
+		warmBytes += warm.data.size();
+	}
+	cells.erase(cellID);
+}
+
+eleman::ElevationCacheCell& eleman::ElevationCache::inflate(std::map<uint64_t, WarmCell>::iterator warm)
+{
+	uint64_t cellID = warm->first;
+	ElevationCacheCell& cell = cells.emplace(std::piecewise_construct, std::forward_as_tuple(cellID),
+											 std::forward_as_tuple(this, cellID, cellDivisions, precision)).first->second;
+	cell.allocateGrids();
+	if(!ElevationCodec::decompress(warm->second.data.data(), warm->second.data.size(), cell.elevationData->view(),
+								   cell.statusData->view()))
+	{
+		cells.erase(cellID);
+		throw std::runtime_error("[ElevationCache] warm cell " + std::to_string(cellID) + " is damaged");
+	}
+
+	// The tracked changes are not kept, dirty cells are rewritten as a whole
+	cell.dirty = warm->second.dirty;
+	cell.stored = warm->second.stored;
+	cell.changesOverflow = warm->second.dirty;
+	cell.accesses = warm->second.accesses;
+
+	warmBytes -= warm->second.data.size();
+	warmCells.erase(warm);
+	return cell;
+}
+
+void eleman::ElevationCache::trimWarm()
+{
+	if(warmBytes <= warmBudget) return;
+
+	std::vector<std::pair<uint32_t, uint64_t>> candidates;
+	for(const auto& warmPair : warmCells)
+		candidates.push_back({warmPair.second.accesses, warmPair.first});
+	std::sort(candidates.begin(), candidates.end());
+
+	// Cells are stored before they are demoted, dirty warm cells belong to caches without IO and are their only copy
+	for(const auto& candidate : candidates)
+	{
+		if(warmBytes <= warmBudget) break;
+		auto warm = warmCells.find(candidate.second);
+		if(warm->second.dirty) continue;
+		warmBytes -= warm->second.data.size();
+		warmCells.erase(warm);
+	}
+}
+
+
 void eleman::ElevationCache::clear()
 {
 	// TODO Delete all cache files via ElevationIO
@@ -333,6 +1102,7 @@ void eleman::ElevationCache::clear()
 
 bool eleman::ElevationCache::clearRadius(double latitude, double longitude, double radius)
 {
+	UpdateBatch batch(*this);
 	double radiusLat = meters2degrees(radius, 0.0);	// Latitude does not change
 	double radiusLon = meters2degrees(radius, latitude);
 
@@ -346,6 +1116,7 @@ bool eleman::ElevationCache::clearRadius(double latitude, double longitude, doub
 		success &= getCell(id)->clearRadius(latitude, longitude, radius);
 		if(!wasLoaded) unloadCell(id);
 	}
+	batch.commit();
 	return success;
 }
 
@@ -356,6 +1127,7 @@ bool eleman::ElevationCache::clearRegion(eleman::Position pos0, eleman::Position
 
 bool eleman::ElevationCache::clearRegion(double latitude0, double longitude0, double latitude1, double longitude1)
 {
+	UpdateBatch batch(*this);
 	bool success = true;
 	std::vector<uint64_t> ids = cellsForRegion(latitude0, longitude0, latitude1, longitude1);
 	for(uint64_t& id : ids)
@@ -365,21 +1137,113 @@ bool eleman::ElevationCache::clearRegion(double latitude0, double longitude0, do
 		success &= getCell(id)->clearRegion(latitude0, longitude0, latitude1, longitude1);
 		if(!wasLoaded) unloadCell(id);
 	}
+	batch.commit();
 	return success;
 }
 
+double eleman::ElevationCache::coverage(double latitude0, double longitude0, double latitude1, double longitude1)
+{
+	uint64_t known = 0, samples = 0;
+	for(uint64_t id : cellsForRegion(latitude0, longitude0, latitude1, longitude1))
+	{
+		auto it = cells.find(id);
+		if(it != cells.end())
+		{
+			known += it->second.size();
+			samples += it->second.sizeTotal();
+			continue;
+		}
+
+		// Warm cells may have changed since they were stored
+		auto warm = warmCells.find(id);
+		ManifestEntry entry;
+		if(warm != warmCells.end())
+		{
+			known += warm->second.known;
+		}
+		else if(io && io->getCellInfo(*this, id, entry))
+		{
+			known += entry.known;
+			samples += entry.samples;
+			continue;
+		}
+
+		// Never stored or warm, same grid size as a constructed cell
+		double lat0, lon0;
+		fromCellID(id, lat0, lon0, cellDivisions);
+		lat0 = roundDigits(lat0, 9);
+		lon0 = roundDigits(lon0, 9);
+		double lat1 = roundDigits(lat0 + 1.0 / cellDivisions, 9);
+		double lon1 = roundDigits(lon0 + 1.0 / cellDivisions, 9);
+		uint32_t sizeLat, sizeLon;
+		calculateGridSize(lat1 - lat0, lon1 - lon0, std::min(std::abs(lat0), std::abs(lat1)), precision, sizeLat, sizeLon);
+		samples += uint64_t(sizeLat) * sizeLon;
+	}
+	return samples > 0 ? double(known) / samples : 0.0;
+}
+
 void eleman::ElevationCache::flush()
 {
 	if(io == nullptr) return;
 
-	for(auto cellPair : cells)
+	// Every cell is encoded and queued before waiting for the first file
+	std::vector<std::future<bool>> stores;
+	for(auto& cellPair : cells)
+		stores.push_back(io->storeAsync(cellPair.second));
+
+	std::exception_ptr error;
+	for(std::future<bool>& store : stores)
 	{
-		io->store(cellPair.second);
+		try
+		{
+			store.get();
+		}
+		catch(...)
+		{
+			if(!error) error = std::current_exception();
+		}
 	}
+	if(error) std::rethrow_exception(error);
+
+	io->flush();
 }
 
 
 
+void eleman::ElevationCache::setAreaDownsampling(bool enabled)
+{
+	areaDownsampling = enabled;
+}
+
+bool eleman::ElevationCache::getAreaDownsampling() const
+{
+	return areaDownsampling;
+}
+
+void eleman::ElevationCache::setBatchOrder(BatchOrder order)
+{
+	batchOrder = order;
+}
+
+eleman::ElevationCache::BatchOrder eleman::ElevationCache::getBatchOrder() const
+{
+	return batchOrder;
+}
+
+void eleman::ElevationCache::setHaloWidth(uint8_t width)
+{
+	haloWidth = width;
+	for(auto& cellPair : cells)
+		cellPair.second.resizeHalo(width);
+	for(auto& cellPair : cells)
+		cellPair.second.refreshHalo();
+}
+
+uint8_t eleman::ElevationCache::getHaloWidth() const
+{
+	return haloWidth;
+}
+
 uint16_t eleman::ElevationCache::getCellDivisions() const
 {
 	return cellDivisions;
@@ -421,7 +1285,7 @@ size_t eleman::ElevationCache::memory() const
 	{
 		memory += cellPair.second.memory();
 	}
-	return memory;
+	return memory + warmBytes;
 }
 
 void eleman::ElevationCache::setManager(eleman::ElevationManager* manager)
@@ -512,8 +1376,10 @@ eleman::ElevationCacheCell::ElevationCacheCell(ElevationCache* cache, uint64_t i
 					  referenceLatitude, precision,
 					  sizeLat, sizeLon);
 
-	statusData		= std::make_shared<Grid<bool>>(sizeLon, sizeLat, false);
-	elevationData	= std::make_shared<Grid<double>>(sizeLon, sizeLat, NAN);
+	// Cells that will be mapped get their grids from the IO, filling them here would be thrown away
+	if(!cache || !cache->getIO() || !cache->getIO()->getMemoryMapping())
+		allocateGrids();
+	resizeHalo(cache ? cache->getHaloWidth() : 0);
 
 	printf("Constructing cell from ID %lu (%f - %f / %f - %f)\n", id, lat0, lat1, lon0, lon1);
 }
@@ -541,8 +1407,10 @@ eleman::ElevationCacheCell::ElevationCacheCell(ElevationCache* cache, uint64_t x
 					  referenceLatitude, precision,
 					  sizeLat, sizeLon);
 
-	statusData		= std::make_shared<Grid<bool>>(sizeLon, sizeLat, false);
-	elevationData	= std::make_shared<Grid<double>>(sizeLon, sizeLat, NAN);
+	// Cells that will be mapped get their grids from the IO, filling them here would be thrown away
+	if(!cache || !cache->getIO() || !cache->getIO()->getMemoryMapping())
+		allocateGrids();
+	resizeHalo(cache ? cache->getHaloWidth() : 0);
 
 	printf("Constructing cell from XY %lu/%lu (%f - %f / %f - %f)\n", x, y, lat0, lat1, lon0, lon1);
 }
@@ -646,9 +1514,9 @@ uint32_t eleman::ElevationCacheCell::precacheCell()
 	{
 		uint32_t y, x;
 		posToGrid(result.latitude, result.longitude, y, x);
-		statusData->set(x, y, true);
-		elevationData->set(x, y, result.elevation);
+		storeSample(x, y, result.elevation);
 	}
+	invalidatePyramid();
 	dirty = true;
 	return positions.size();
 }
@@ -694,9 +1562,9 @@ uint32_t eleman::ElevationCacheCell::precacheRegion(double latitude0, double lon
 		posToGrid(result.latitude, result.longitude, y, x);
 		printf("Pos %f %f to cell %d %d\n", result.latitude, result.longitude, x, y);
 		printf("%d %d\n", sizeLat, sizeLon);
-		statusData->set(x, y, true);
-		elevationData->set(x, y, result.elevation);
+		storeSample(x, y, result.elevation);
 	}
+	invalidatePyramid();
 	dirty = true;
 	return positions.size();
 }
@@ -737,9 +1605,9 @@ uint32_t eleman::ElevationCacheCell::precacheRadius(double latitude, double long
 	{
 		uint32_t y, x;
 		posToGrid(result.latitude, result.longitude, y, x);
-		statusData->set(x, y, true);
-		elevationData->set(x, y, result.elevation);
+		storeSample(x, y, result.elevation);
 	}
+	invalidatePyramid();
 	dirty = true;
 	return positions.size();
 }
@@ -802,8 +1670,8 @@ uint32_t eleman::ElevationCacheCell::reportMissingNeighbors(std::vector<CacheMis
 // 			printf("Checking location %d %d\n", x, y);
 
 			if(limit > 0 && count >= limit) return count;
-			if(x < 0 || x >= sizeLon) continue;
-			if(y < 0 || y >= sizeLat) continue;
+			if(x < 0 || x >= int32_t(sizeLon)) continue;
+			if(y < 0 || y >= int32_t(sizeLat)) continue;
 			if(statusData->get(x, y)) continue;
 
 			CacheMiss miss;
@@ -823,9 +1691,14 @@ uint32_t eleman::ElevationCacheCell::reportMissingNeighbors(std::vector<CacheMis
 void eleman::ElevationCacheCell::clearGrid(uint32_t x, uint32_t y)
 {
 	printf("Clearing data in cell %lu\n", id);
+	promote();
+	bool wasKnown = statusData->get(x, y);
 	ElevationRegion::setGrid(x, y, NAN);
 	statusData->set(x, y, false);
 	dirty = true;
+	noteChange(x, y, wasKnown);
+	cache->updateNeighborHalos(*this, x, y);
+	cache->noteUpdate(*this, x, y);
 }
 
 double eleman::ElevationCacheCell::getGrid(uint32_t x, uint32_t y) const
@@ -847,9 +1720,186 @@ double eleman::ElevationCacheCell::getGrid(uint32_t x, uint32_t y) const
 void eleman::ElevationCacheCell::setGrid(uint32_t x, uint32_t y, double value)
 {
 	printf("Setting data in cell %lu\n", id);
+	promote();
+	bool wasKnown = statusData->get(x, y);
 	ElevationRegion::setGrid(x, y, value);
 	statusData->set(x, y, true);
 	dirty = true;
+	noteChange(x, y, wasKnown);
+	cache->updateNeighborHalos(*this, x, y);
+	cache->noteUpdate(*this, x, y);
+}
+
+double eleman::ElevationCacheCell::getGridExtended(int32_t x, int32_t y) const
+{
+	if(x >= 0 && y >= 0 && x < int32_t(sizeLon) && y < int32_t(sizeLat))
+		return getGrid(x, y);
+
+	double value = getGridHalo(x, y);
+	if(!std::isnan(value)) return value;
+
+	// Neighbour unknown or beyond the halo
+	return getGrid(std::clamp<int32_t>(x, 0, sizeLon - 1), std::clamp<int32_t>(y, 0, sizeLat - 1));
+}
+
+double eleman::ElevationCacheCell::getGridHalo(int32_t x, int32_t y) const
+{
+	const int32_t H = haloWidth;
+	const int32_t W = sizeLon, L = sizeLat;
+	if(x < -H || y < -H || x >= W + H || y >= L + H) return NAN;
+
+	if(y < 0)	return haloSouth.get(x + H, y + H);
+	if(y >= L)	return haloNorth.get(x + H, y - L);
+	if(x < 0)	return haloWest.get(x + H, y);
+	if(x >= W)	return haloEast.get(x - W, y);
+	return elevationData->get(x, y);
+}
+
+uint8_t eleman::ElevationCacheCell::getHaloWidth() const
+{
+	return haloWidth;
+}
+
+void eleman::ElevationCacheCell::refreshHalo()
+{
+	const int32_t H = haloWidth;
+	const int32_t W = sizeLon, L = sizeLat;
+
+	for(int32_t k = 0; k < H; k++)
+	{
+		for(int32_t x = -H; x < W + H; x++)
+		{
+			setHalo(x, -1 - k, haloSample(x, -1 - k));
+			setHalo(x, L + k, haloSample(x, L + k));
+		}
+		for(int32_t y = 0; y < L; y++)
+		{
+			setHalo(-1 - k, y, haloSample(-1 - k, y));
+			setHalo(W + k, y, haloSample(W + k, y));
+		}
+	}
+}
+
+void eleman::ElevationCacheCell::storeSample(uint32_t x, uint32_t y, double elevation)
+{
+	promote();
+	bool wasKnown = statusData->get(x, y);
+	statusData->set(x, y, true);
+	elevationData->set(x, y, elevation);
+	noteChange(x, y, wasKnown);
+	cache->updateNeighborHalos(*this, x, y);
+	cache->noteUpdate(*this, x, y);
+}
+
+void eleman::ElevationCacheCell::noteChange(uint32_t x, uint32_t y, bool wasKnown)
+{
+	if(!stored || changesOverflow) return;
+
+	// Writes while the log is off can not be logged later, the cell file has to be rewritten
+	if(cache->getIO() == nullptr || !cache->getIO()->getUpdateLog())
+	{
+		changesOverflow = true;
+		changes = std::vector<uint32_t>();
+		return;
+	}
+
+	knownChange += int64_t(statusData->get(x, y)) - int64_t(wasKnown);
+
+	// A log entry costs about as much as one and a half samples of the cell file
+	if(changes.size() >= size_t(sizeLon) * sizeLat / 8)
+	{
+		changesOverflow = true;
+		changes = std::vector<uint32_t>();
+		return;
+	}
+	changes.push_back(y * sizeLon + x);
+}
+
+void eleman::ElevationCacheCell::allocateGrids()
+{
+	if(statusData && elevationData) return;
+
+	statusData		= std::make_shared<Grid<bool>>(sizeLon, sizeLat, false);
+	elevationData	= std::make_shared<Grid<double>>(sizeLon, sizeLat, NAN);
+}
+
+void eleman::ElevationCacheCell::promote()
+{
+	if(!isMapped()) return;
+
+	// Copies always live on the heap, the pyramid still points to the mapping
+	elevationData = std::make_shared<Grid<double>>(*elevationData);
+	statusData = std::make_shared<Grid<bool>>(*statusData);
+	invalidatePyramid();
+}
+
+void eleman::ElevationCacheCell::resizeHalo(uint8_t width)
+{
+	haloWidth = width;
+	haloSouth	= Grid<double>(sizeLon + 2 * width, width, NAN);
+	haloNorth	= Grid<double>(sizeLon + 2 * width, width, NAN);
+	haloWest	= Grid<double>(width, sizeLat, NAN);
+	haloEast	= Grid<double>(width, sizeLat, NAN);
+}
+
+void eleman::ElevationCacheCell::setHalo(int32_t x, int32_t y, double value)
+{
+	const int32_t H = haloWidth;
+	const int32_t W = sizeLon, L = sizeLat;
+
+	if(y < 0)		haloSouth.set(x + H, y + H, value);
+	else if(y >= L)	haloNorth.set(x + H, y - L, value);
+	else if(x < 0)	haloWest.set(x + H, y, value);
+	else if(x >= W)	haloEast.set(x - W, y, value);
+}
+
+double eleman::ElevationCacheCell::haloSample(int32_t x, int32_t y) const
+{
+	double latitude, longitude;
+	gridFloatToPos(y, x, latitude, longitude);
+	if(latitude < -90.0 || latitude >= 90.0 || longitude < -180.0 || longitude >= 180.0) return NAN;
+
+	// Sample of the neighbour the position lies in, rounding may put it back into this cell
+	uint64_t ownerID = ElevationCache::toCellID(latitude, longitude, cache->getCellDivisions());
+	if(ownerID == id) return NAN;
+	const ElevationCacheCell* owner = cache->findCell(ownerID);
+	if(owner == nullptr) return NAN;
+
+	// Columns line up with the neighbours east and west (exact copy),
+	// north and south the longitude spacing may differ and the samples get resampled
+	double gridLat, gridLon;
+	owner->posToGridFloat(latitude, longitude, gridLat, gridLon);
+	return owner->getGridLinear(gridLat, gridLon);
+}
+
+void eleman::ElevationCacheCell::updateHalo(const ElevationCacheCell& source, uint32_t x, uint32_t y)
+{
+	if(haloWidth == 0) return;
+
+	// Halo samples interpolated from the changed sample lie within one grid step of it
+	double latitude0, longitude0, latitude1, longitude1;
+	source.gridFloatToPos(y - 1.0, x - 1.0, latitude0, longitude0);
+	source.gridFloatToPos(y + 1.0, x + 1.0, latitude1, longitude1);
+
+	double gridLat0, gridLon0, gridLat1, gridLon1;
+	posToGridFloat(latitude0, longitude0, gridLat0, gridLon0);
+	posToGridFloat(latitude1, longitude1, gridLat1, gridLon1);
+
+	const int32_t H = haloWidth;
+	const int32_t W = sizeLon, L = sizeLat;
+	int32_t xBegin	= std::max<int32_t>(std::ceil(std::min(gridLon0, gridLon1) - 1e-6), -H);
+	int32_t xEnd	= std::min<int32_t>(std::floor(std::max(gridLon0, gridLon1) + 1e-6), W + H - 1);
+	int32_t yBegin	= std::max<int32_t>(std::ceil(std::min(gridLat0, gridLat1) - 1e-6), -H);
+	int32_t yEnd	= std::min<int32_t>(std::floor(std::max(gridLat0, gridLat1) + 1e-6), L + H - 1);
+
+	for(int32_t gy = yBegin; gy <= yEnd; gy++)
+	{
+		for(int32_t gx = xBegin; gx <= xEnd; gx++)
+		{
+			if(gx >= 0 && gy >= 0 && gx < W && gy < L) continue;
+			setHalo(gx, gy, haloSample(gx, gy));
+		}
+	}
 }
 
 
@@ -864,9 +1914,19 @@ double eleman::ElevationCacheCell::getPrecision() const
 	return precision;
 }
 
+bool eleman::ElevationCacheCell::contains(double latitude, double longitude) const
+{
+	return latitude >= lat0 && latitude <= lat1 && longitude >= lon0 && longitude <= lon1;
+}
+
 bool eleman::ElevationCacheCell::isDirty() const
 {
-	return dirty;
+	return dirty || (written && !*written);
+}
+
+bool eleman::ElevationCacheCell::isMapped() const
+{
+	return elevationData->isMapped() || statusData->isMapped();
 }
 
 
@@ -885,7 +1945,8 @@ size_t eleman::ElevationCacheCell::size() const
 
 size_t eleman::ElevationCacheCell::memory() const
 {
-	return sizeof(ElevationCacheCell) + statusData->memory() + elevationData->memory();
+	return sizeof(ElevationCacheCell) + statusData->memory() + elevationData->memory()
+		+ haloSouth.memory() + haloNorth.memory() + haloWest.memory() + haloEast.memory();
 }
 
 
@@ -0,0 +1,367 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationcodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	// Compressed grid: stream header, then the status bitmap (one bit per sample, row by row) followed by the
+	// residuals of the known samples as zigzag varints. HIGH entropy codes bitmap and residuals together and puts the
+	// symbol frequencies in front. Host byte order, which is little endian on all supported platforms.
+	// Quantization 0 codes the bit patterns of the samples as integers (sign and magnitude turned into two's
+	// complement), without the low bits all of them share.
+	struct StreamHeader
+	{
+		uint8_t level;
+		uint8_t reserved[3];
+		uint32_t width, height;
+		uint32_t shift;			// Dropped low bits of lossless samples
+		double quantization;
+		uint64_t rawSize;		// Bytes of bitmap and residuals before entropy coding
+	};
+	static_assert(sizeof(StreamHeader) == 32, "Stream header has to stay 32 bytes");
+
+	// rANS with 12 bit probabilities, byte wise renormalization
+	const uint32_t RANS_BITS = 12;
+	const uint32_t RANS_SCALE = 1 << RANS_BITS;
+	const uint32_t RANS_LOW = 1 << 23;
+
+	// Median edge detector, picks west or north at edges and the plane through all three otherwise
+	// Selects instead of branches, the choice flips randomly on noisy terrain
+	inline int64_t predict(int64_t west, int64_t north, int64_t northWest)
+	{
+		int64_t low = std::min(west, north);
+		int64_t high = std::max(west, north);
+		// Wraps around for huge lossless samples, decoding wraps the same way
+		int64_t prediction = int64_t(uint64_t(west) + uint64_t(north) - uint64_t(northWest));
+		prediction = northWest >= high ? low : prediction;
+		prediction = northWest <= low ? high : prediction;
+		return prediction;
+	}
+
+	inline void putVarint(std::vector<uint8_t>& buffer, int64_t value)
+	{
+		uint64_t zigzag = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+		while(zigzag >= 0x80)
+		{
+			buffer.push_back(uint8_t(zigzag) | 0x80);
+			zigzag >>= 7;
+		}
+		buffer.push_back(uint8_t(zigzag));
+	}
+
+	inline int64_t wrappingSub(int64_t a, int64_t b)
+	{
+		return int64_t(uint64_t(a) - uint64_t(b));
+	}
+
+	inline int64_t wrappingAdd(int64_t a, int64_t b)
+	{
+		return int64_t(uint64_t(a) + uint64_t(b));
+	}
+
+	// Order preserving integer of a lossless sample, negative zero becomes zero
+	inline int64_t sampleBits(double sample)
+	{
+		uint64_t bits;
+		memcpy(&bits, &sample, sizeof(bits));
+		int64_t magnitude = int64_t(bits & ~(uint64_t(1) << 63));
+		return bits >> 63 ? -magnitude : magnitude;
+	}
+
+	inline double bitsSample(int64_t value)
+	{
+		uint64_t bits = value < 0 ? uint64_t(-value) | (uint64_t(1) << 63) : uint64_t(value);
+		double sample;
+		memcpy(&sample, &bits, sizeof(sample));
+		return sample;
+	}
+
+	inline bool getVarint(const uint8_t*& data, const uint8_t* end, int64_t& value)
+	{
+		// Most residuals fit a single byte
+		if(data != end && *data < 0x80)
+		{
+			uint64_t zigzag = *data++;
+			value = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+			return true;
+		}
+
+		uint64_t zigzag = 0;
+		for(uint32_t shift = 0; shift < 64; shift += 7)
+		{
+			if(data == end) return false;
+			uint8_t byte = *data++;
+			zigzag |= uint64_t(byte & 0x7f) << shift;
+			if(byte < 0x80)
+			{
+				value = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Scales the symbol counts to RANS_SCALE, every present symbol keeps at least a frequency of 1
+	void normalizeFrequencies(const uint64_t counts[256], uint64_t total, uint16_t frequencies[256])
+	{
+		int64_t sum = 0;
+		for(uint32_t s = 0; s < 256; s++)
+		{
+			frequencies[s] = counts[s] == 0 ? 0 : std::max<uint64_t>(1, counts[s] * RANS_SCALE / total);
+			sum += frequencies[s];
+		}
+
+		while(sum != RANS_SCALE)
+		{
+			uint16_t* largest = std::max_element(frequencies, frequencies + 256);
+			if(sum < RANS_SCALE)
+			{
+				*largest += RANS_SCALE - sum;
+				sum = RANS_SCALE;
+			}
+			else
+			{
+				int64_t step = std::min<int64_t>(sum - RANS_SCALE, *largest - 1);
+				if(step == 0) step = 1;
+				*largest -= step;
+				sum -= step;
+			}
+		}
+	}
+
+	void ransEncode(const uint8_t* data, size_t size, std::vector<uint8_t>& buffer)
+	{
+		uint64_t counts[256] = {};
+		for(size_t i = 0; i < size; i++) counts[data[i]]++;
+
+		uint16_t frequencies[256] = {};
+		uint32_t starts[256];
+		if(size > 0) normalizeFrequencies(counts, size, frequencies);
+		for(uint32_t s = 0, start = 0; s < 256; s++)
+		{
+			starts[s] = start;
+			start += frequencies[s];
+		}
+
+		size_t tableOffset = buffer.size();
+		buffer.resize(tableOffset + sizeof(frequencies));
+		memcpy(buffer.data() + tableOffset, frequencies, sizeof(frequencies));
+
+		// Symbols are encoded back to front, the bytes are reversed afterwards so decoding runs forward
+		std::vector<uint8_t> reversed;
+		reversed.reserve(size / 2 + 16);
+		uint32_t state = RANS_LOW;
+		for(size_t i = size; i-- > 0;)
+		{
+			uint32_t frequency = frequencies[data[i]];
+			uint32_t limit = ((RANS_LOW >> RANS_BITS) << 8) * frequency;
+			while(state >= limit)
+			{
+				reversed.push_back(state & 0xff);
+				state >>= 8;
+			}
+			state = ((state / frequency) << RANS_BITS) + (state % frequency) + starts[data[i]];
+		}
+		for(int32_t shift = 24; shift >= 0; shift -= 8)
+			reversed.push_back((state >> shift) & 0xff);
+
+		buffer.insert(buffer.end(), reversed.rbegin(), reversed.rend());
+	}
+
+	bool ransDecode(const uint8_t* data, size_t size, uint8_t* output, size_t outputSize)
+	{
+		uint16_t frequencies[256];
+		if(size < sizeof(frequencies) + 4) return false;
+		memcpy(frequencies, data, sizeof(frequencies));
+		const uint8_t* end = data + size;
+		data += sizeof(frequencies);
+
+		uint32_t starts[256];
+		uint8_t symbols[RANS_SCALE];
+		uint32_t start = 0;
+		for(uint32_t s = 0; s < 256; s++)
+		{
+			starts[s] = start;
+			if(start + frequencies[s] > RANS_SCALE) return false;
+			std::fill_n(symbols + start, frequencies[s], uint8_t(s));
+			start += frequencies[s];
+		}
+		if(start != RANS_SCALE && outputSize > 0) return false;
+
+		uint32_t state;
+		memcpy(&state, data, sizeof(state));
+		data += sizeof(state);
+
+		for(size_t i = 0; i < outputSize; i++)
+		{
+			uint32_t slot = state & (RANS_SCALE - 1);
+			uint8_t symbol = symbols[slot];
+			output[i] = symbol;
+			state = frequencies[symbol] * (state >> RANS_BITS) + slot - starts[symbol];
+			while(state < RANS_LOW)
+			{
+				if(data == end) return false;
+				state = (state << 8) | *data++;
+			}
+		}
+		return true;
+	}
+}
+
+void eleman::ElevationCodec::compress(GridView<const double> samples, GridView<const bool> status, Level level, double quantization,
+									  std::vector<uint8_t>& buffer)
+{
+	if(!(quantization >= 0.0))
+		throw std::runtime_error("[ElevationCodec] quantization must not be negative");
+	if(samples.getWidth() != status.getWidth() || samples.getHeight() != status.getHeight())
+		throw std::runtime_error("[ElevationCodec] samples and status differ in size");
+
+	uint32_t width = samples.getWidth(), height = samples.getHeight();
+	size_t bitmapBytes = (size_t(width) * height + 7) / 8;
+
+	// Samples with few significant bits (whole meters for instance) share their trailing zeros
+	bool lossless = quantization == 0.0;
+	uint32_t shift = 63;
+	if(lossless)
+	{
+		uint64_t bits = 0;
+		for(uint32_t y = 0; y < height; y++)
+		{
+			const double* row = samples.row(y);
+			const bool* known = status.row(y);
+			for(uint32_t x = 0; x < width; x++)
+			{
+				if(known[x] && std::isfinite(row[x])) bits |= uint64_t(sampleBits(row[x]));
+			}
+		}
+		while(shift > 0 && (bits & ((uint64_t(1) << shift) - 1)) != 0) shift--;
+	}
+	else
+	{
+		shift = 0;
+	}
+
+	std::vector<uint8_t> raw(bitmapBytes, 0);
+	raw.reserve(bitmapBytes + size_t(width) * height);
+
+	// Unknown samples take their prediction, they cost nothing and keep the neighbours predictable.
+	// The first row is predicted from the west only, the first column from the north only.
+	std::vector<int64_t> previous(width), current(width);
+	double scale = lossless ? 0.0 : 1.0 / quantization;
+	size_t bit = 0;
+	for(uint32_t y = 0; y < height; y++)
+	{
+		const double* row = samples.row(y);
+		const bool* known = status.row(y);
+		int64_t west = y > 0 ? previous[0] : 0;
+		int64_t northWest = west;
+		for(uint32_t x = 0; x < width; x++, bit++)
+		{
+			int64_t north = y > 0 ? previous[x] : west;
+			int64_t prediction = predict(west, north, y > 0 ? northWest : west);
+			northWest = north;
+
+			if(!known[x] || !std::isfinite(row[x]))
+			{
+				current[x] = west = prediction;
+				continue;
+			}
+
+			raw[bit / 8] |= 1 << (bit % 8);
+			current[x] = west = lossless ? sampleBits(row[x]) >> shift : std::llround(row[x] * scale);
+			putVarint(raw, wrappingSub(west, prediction));
+		}
+		previous.swap(current);
+	}
+
+	StreamHeader header = {};
+	header.level = level;
+	header.width = width;
+	header.height = height;
+	header.shift = shift;
+	header.quantization = quantization;
+	header.rawSize = raw.size();
+
+	size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(header));
+	memcpy(buffer.data() + offset, &header, sizeof(header));
+
+	if(level == HIGH)
+		ransEncode(raw.data(), raw.size(), buffer);
+	else
+		buffer.insert(buffer.end(), raw.begin(), raw.end());
+}
+
+bool eleman::ElevationCodec::decompress(const uint8_t* data, size_t size, GridView<double> samples, GridView<bool> status)
+{
+	if(size < sizeof(StreamHeader)) return false;
+
+	StreamHeader header;
+	memcpy(&header, data, sizeof(header));
+	if(header.level != FAST && header.level != HIGH) return false;
+	if(header.width != samples.getWidth() || header.height != samples.getHeight()) return false;
+	if(header.width != status.getWidth() || header.height != status.getHeight()) return false;
+	if(!(header.quantization >= 0.0) || header.shift > 63 || (header.shift > 0 && header.quantization != 0.0)) return false;
+	bool lossless = header.quantization == 0.0;
+
+	// Residuals take at most ten bytes each
+	uint32_t width = header.width, height = header.height;
+	size_t bitmapBytes = (size_t(width) * height + 7) / 8;
+	if(header.rawSize < bitmapBytes || header.rawSize > bitmapBytes + size_t(width) * height * 10) return false;
+
+	const uint8_t* raw = data + sizeof(StreamHeader);
+	std::vector<uint8_t> decoded;
+	if(header.level == HIGH)
+	{
+		decoded.resize(header.rawSize);
+		if(!ransDecode(raw, size - sizeof(StreamHeader), decoded.data(), decoded.size())) return false;
+		raw = decoded.data();
+	}
+	else if(size - sizeof(StreamHeader) != header.rawSize)
+	{
+		return false;
+	}
+
+	const uint8_t* bitmap = raw;
+	const uint8_t* residuals = raw + bitmapBytes;
+	const uint8_t* end = raw + header.rawSize;
+
+	// Same walk as compress(), west and north west stay in registers instead of going through the rows
+	std::vector<int64_t> previous(width), current(width);
+	size_t bit = 0;
+	for(uint32_t y = 0; y < height; y++)
+	{
+		double* row = samples.row(y);
+		bool* known = status.row(y);
+		int64_t west = y > 0 ? previous[0] : 0;
+		int64_t northWest = west;
+		for(uint32_t x = 0; x < width; x++, bit++)
+		{
+			int64_t north = y > 0 ? previous[x] : west;
+			int64_t prediction = predict(west, north, y > 0 ? northWest : west);
+			northWest = north;
+
+			known[x] = (bitmap[bit / 8] >> (bit % 8)) & 1;
+			if(!known[x])
+			{
+				current[x] = west = prediction;
+				row[x] = NAN;
+				continue;
+			}
+
+			int64_t residual;
+			if(!getVarint(residuals, end, residual)) return false;
+			current[x] = west = wrappingAdd(prediction, residual);
+			row[x] = lossless ? bitsSample(int64_t(uint64_t(west) << header.shift)) : west * header.quantization;
+		}
+		previous.swap(current);
+	}
+
+	return residuals == end;
+}
@@ -0,0 +1,393 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationcontour.h"
+
+#include "eleman/elevationcache.h"
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <list>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+
+/**
+ * Stitches directed segments into polylines. Open ends are indexed by level and the global id of the
+ * grid edge they lie on, a segment or fragment is attached to whatever ends on the same edge.
+ */
+class eleman::ElevationContour::Builder
+{
+public:
+	// Segment from edge "from" to edge "to" with the corresponding crossing points
+	void segment(int64_t level, double elevation, uint64_t from, uint64_t to, const Position& p0, const Position& p1)
+	{
+		auto f = tails.find({level, from});
+		auto g = heads.find({level, to});
+
+		if(f != tails.end())
+		{
+			auto first = f->second;
+			tails.erase(f);
+			first->points.push_back(p1);
+			first->tail = to;
+
+			if(g == heads.end())
+			{
+				tails[{level, to}] = first;
+				return;
+			}
+
+			auto second = g->second;
+			heads.erase(g);
+			if(first == second)
+				close(first);
+			else
+				concatenate(first, second);
+		}
+		else if(g != heads.end())
+		{
+			auto second = g->second;
+			heads.erase(g);
+			second->points.push_front(p0);
+			second->head = from;
+			heads[{level, from}] = second;
+		}
+		else
+		{
+			open.push_back({level, elevation, from, to, {p0, p1}});
+			heads[{level, from}] = std::prev(open.end());
+			tails[{level, to}] = std::prev(open.end());
+		}
+	}
+
+	// Takes over all lines of another builder, fragments ending on the same edges are joined
+	void merge(Builder& other)
+	{
+		for(ContourLine& line : other.closed)
+			closed.push_back(std::move(line));
+		for(Fragment& fragment : other.open)
+			join(std::move(fragment));
+
+		other.closed.clear();
+		other.open.clear();
+		other.heads.clear();
+		other.tails.clear();
+	}
+
+	std::vector<ContourLine> finish()
+	{
+		std::vector<ContourLine> lines = std::move(closed);
+		for(Fragment& fragment : open)
+		{
+			ContourLine line = toLine(fragment, false);
+			if(line.points.size() > 1)
+				lines.push_back(std::move(line));
+		}
+
+		closed.clear();
+		open.clear();
+		heads.clear();
+		tails.clear();
+		return lines;
+	}
+
+private:
+	struct Fragment {
+		int64_t level;
+		double elevation;
+		uint64_t head, tail;	// Edges of the first and last point
+		std::deque<Position> points;
+	};
+
+	struct Key {
+		int64_t level;
+		uint64_t edge;
+		bool operator==(const Key& other) const { return level == other.level && edge == other.edge; }
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const { return std::hash<uint64_t>()(key.edge ^ (uint64_t(key.level) * 0x9E3779B97F4A7C15ull)); }
+	};
+
+	typedef std::list<Fragment>::iterator Iterator;
+
+	std::list<Fragment> open;
+	std::unordered_map<Key, Iterator, KeyHash> heads, tails;
+	std::vector<ContourLine> closed;
+
+	void join(Fragment&& fragment)
+	{
+		auto f = tails.find({fragment.level, fragment.head});
+		auto g = heads.find({fragment.level, fragment.tail});
+
+		if(f != tails.end())
+		{
+			auto first = f->second;
+			tails.erase(f);
+			first->points.insert(first->points.end(), fragment.points.begin() + 1, fragment.points.end());
+			first->tail = fragment.tail;
+
+			if(g == heads.end())
+			{
+				tails[{first->level, first->tail}] = first;
+				return;
+			}
+
+			auto second = g->second;
+			heads.erase(g);
+			if(first == second)
+				close(first);
+			else
+				concatenate(first, second);
+		}
+		else if(g != heads.end())
+		{
+			auto second = g->second;
+			heads.erase(g);
+			second->points.insert(second->points.begin(), fragment.points.begin(), fragment.points.end() - 1);
+			second->head = fragment.head;
+			heads[{second->level, second->head}] = second;
+		}
+		else
+		{
+			open.push_back(std::move(fragment));
+			heads[{open.back().level, open.back().head}] = std::prev(open.end());
+			tails[{open.back().level, open.back().tail}] = std::prev(open.end());
+		}
+	}
+
+	// First ends on the edge second starts at, the entries of that edge are already removed
+	void concatenate(Iterator first, Iterator second)
+	{
+		// Copy the shorter one
+		if(first->points.size() >= second->points.size())
+		{
+			first->points.insert(first->points.end(), second->points.begin() + 1, second->points.end());
+			first->tail = second->tail;
+			tails[{first->level, first->tail}] = first;
+			open.erase(second);
+		}
+		else
+		{
+			second->points.insert(second->points.begin(), first->points.begin(), first->points.end() - 1);
+			second->head = first->head;
+			heads[{second->level, second->head}] = second;
+			open.erase(first);
+		}
+	}
+
+	void close(Iterator fragment)
+	{
+		// Same edge, but the point may have been computed in another strip
+		fragment->points.back() = fragment->points.front();
+		ContourLine line = toLine(*fragment, true);
+		if(line.points.size() > 1)
+			closed.push_back(std::move(line));
+		open.erase(fragment);
+	}
+
+	static ContourLine toLine(Fragment& fragment, bool isClosed)
+	{
+		ContourLine line;
+		line.elevation = fragment.elevation;
+		line.closed = isClosed;
+		line.points.assign(fragment.points.begin(), fragment.points.end());
+
+		// Lines through samples lying exactly on the level produce zero length segments (or collapse to a single point)
+		auto last = std::unique(line.points.begin(), line.points.end(), [](const Position& a, const Position& b) {
+			return a.latitude == b.latitude && a.longitude == b.longitude;
+		});
+		line.points.erase(last, line.points.end());
+		return line;
+	}
+};
+
+
+eleman::ElevationContour::ElevationContour(double interval, double base)
+{
+	if(!(interval > 0.0))
+		throw std::runtime_error("[ElevationContour] interval has to be positive");
+
+	this->interval = interval;
+	this->base = base;
+}
+
+eleman::ElevationContour::ElevationContour(const std::vector<double>& levels)
+{
+	this->interval = 0.0;
+	this->base = 0.0;
+	this->levels = levels;
+
+	std::sort(this->levels.begin(), this->levels.end());
+	this->levels.erase(std::unique(this->levels.begin(), this->levels.end()), this->levels.end());
+}
+
+eleman::ElevationContour::~ElevationContour()
+{
+
+}
+
+
+std::vector<eleman::ContourLine> eleman::ElevationContour::trace(const ElevationRegion& region, uint32_t threads) const
+{
+	Builder builder;
+	traceRegion(region, 0, builder, threads);
+	return builder.finish();
+}
+
+std::vector<eleman::ContourLine> eleman::ElevationContour::trace(ElevationCache& cache, uint64_t cellID, uint32_t threads) const
+{
+	return trace(*cache.getCell(cellID), threads);
+}
+
+std::vector<eleman::ContourLine> eleman::ElevationContour::trace(ElevationCache& cache, double lat0, double lon0, double lat1, double lon1, double precision,
+																 uint32_t stripRows, uint32_t threads) const
+{
+	// Strips share their boundary row, so every square is traced exactly once
+	Builder builder;
+	cache.streamRegion(lat0, lon0, lat1, lon1, precision, stripRows, [&](const ElevationRegion& strip, uint32_t firstRow)
+	{
+		traceRegion(strip, firstRow, builder, threads);
+	});
+	return builder.finish();
+}
+
+
+double eleman::ElevationContour::level(int64_t k) const
+{
+	if(interval > 0.0)
+		return base + k * interval;
+	return levels[k];
+}
+
+bool eleman::ElevationContour::levelRange(double min, double max, int64_t& k0, int64_t& k1) const
+{
+	if(interval > 0.0)
+	{
+		// Correct the estimate so it agrees exactly with level()
+		k0 = std::floor((min - base) / interval);
+		while(level(k0) <= min) k0++;
+		while(level(k0 - 1) > min) k0--;
+
+		k1 = std::floor((max - base) / interval);
+		while(level(k1) > max) k1--;
+		while(level(k1 + 1) <= max) k1++;
+	}
+	else
+	{
+		k0 = std::upper_bound(levels.begin(), levels.end(), min) - levels.begin();
+		k1 = std::upper_bound(levels.begin(), levels.end(), max) - levels.begin() - 1;
+	}
+	return k0 <= k1;
+}
+
+void eleman::ElevationContour::traceRows(const ElevationRegion& region, uint32_t rowOffset, uint32_t y0, uint32_t y1, Builder& builder) const
+{
+	const Grid<double>& grid = region.getElevationData();
+	const uint64_t width = grid.getWidth();
+
+	for(uint32_t y = y0; y < y1; y++)
+	{
+		const double* lower = grid.row(y);
+		const double* upper = grid.row(y + 1);
+		const uint64_t row = (uint64_t(rowOffset) + y) * width;
+
+		for(uint32_t x = 0; x + 1 < width; x++)
+		{
+			// Corners counter clockwise starting at the lower left
+			const double v[4] = {lower[x], lower[x + 1], upper[x + 1], upper[x]};
+			if(std::isnan(v[0] + v[1] + v[2] + v[3])) continue;
+
+			int64_t k0, k1;
+			double min = std::min(std::min(v[0], v[1]), std::min(v[2], v[3]));
+			double max = std::max(std::max(v[0], v[1]), std::max(v[2], v[3]));
+			if(!levelRange(min, max, k0, k1)) continue;
+
+			// Global edge ids, even for edges along a row and odd for edges along a column
+			const uint64_t edges[4] = {
+				(row + x) * 2,
+				(row + x + 1) * 2 + 1,
+				(row + width + x) * 2,
+				(row + x) * 2 + 1
+			};
+
+			for(int64_t k = k0; k <= k1; k++)
+			{
+				const double elevation = level(k);
+
+				bool high[4];
+				for(int i = 0; i < 4; i++)
+					high[i] = v[i] >= elevation;
+
+				// Edge i runs from corner i to corner i + 1
+				int crossings[4];
+				int count = 0;
+				for(int i = 0; i < 4; i++)
+				{
+					if(high[i] != high[(i + 1) % 4])
+						crossings[count++] = i;
+				}
+
+				// Interpolate along each edge in grid order so neighbouring squares get the same point
+				auto point = [&](int edge)
+				{
+					double gridLat = y, gridLon = x;
+					switch(edge)
+					{
+						case 0: gridLon += (elevation - v[0]) / (v[1] - v[0]); break;
+						case 1: gridLon += 1.0; gridLat += (elevation - v[1]) / (v[2] - v[1]); break;
+						case 2: gridLat += 1.0; gridLon += (elevation - v[3]) / (v[2] - v[3]); break;
+						case 3: gridLat += (elevation - v[0]) / (v[3] - v[0]); break;
+					}
+
+					Position pos;
+					region.gridFloatToPos(gridLat, gridLon, pos.latitude, pos.longitude);
+					return pos;
+				};
+
+				// Segments leave where the boundary goes from high to low, so high ground stays on the left.
+				// Saddles connect through the center if its average is high.
+				const bool center = (v[0] + v[1] + v[2] + v[3]) / 4.0 >= elevation;
+				for(int j = 0; j < count; j++)
+				{
+					int from = crossings[j];
+					if(!high[from]) continue;
+
+					int to = (count == 2 || center) ? crossings[(j + 1) % count] : crossings[(j + count - 1) % count];
+					builder.segment(k, elevation, edges[from], edges[to], point(from), point(to));
+				}
+			}
+		}
+	}
+}
+
+void eleman::ElevationContour::traceRegion(const ElevationRegion& region, uint32_t rowOffset, Builder& builder, uint32_t threads) const
+{
+	uint32_t rows = region.getGridSizeLat();
+	if(rows < 2 || region.getGridSizeLon() < 2) return;
+
+	if(threads == 0)
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	uint32_t bands = std::min(threads, rows - 1);
+	if(bands == 1)
+	{
+		traceRows(region, rowOffset, 0, rows - 1, builder);
+		return;
+	}
+
+	// Every band stitches its own lines, they are merged at the seams afterwards
+	std::vector<Builder> builders(bands);
+	uint32_t bandRows = (rows - 1 + bands - 1) / bands;
+	parallelFor(0, bands, [&](uint32_t b0, uint32_t b1)
+	{
+		for(uint32_t b = b0; b < b1; b++)
+			traceRows(region, rowOffset, std::min(b * bandRows, rows - 1), std::min((b + 1) * bandRows, rows - 1), builders[b]);
+	}, threads);
+
+	for(Builder& band : builders)
+		builder.merge(band);
+}
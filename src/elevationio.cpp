@@ -6,9 +6,16 @@
 #include "eleman/elevationutils.h"
 #include "eleman/elevationmanager.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <fstream>
 #include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <sys/stat.h>
 
 eleman::ElevationIO::ElevationIO(std::filesystem::path cacheDir)
 {
@@ -16,122 +23,1876 @@ eleman::ElevationIO::ElevationIO(std::filesystem::path cacheDir)
 	createCacheDir();
 }
 
+eleman::ElevationIO::ElevationIO()
+{
+
+}
+
 eleman::ElevationIO::~ElevationIO()
 {
+	// Completions of queued stores refer to the IO
+	std::map<std::filesystem::path, std::shared_future<void>> stores;
+	{
+		std::lock_guard<std::mutex> lock(storeMutex);
+		stores.swap(pendingStores);
+	}
+	for(auto& store : stores)
+		store.second.wait();
+
+	// Pending compactions are dropped, their logs are still replayed on load
+	{
+		std::lock_guard<std::mutex> lock(compactionMutex);
+		stopping = true;
+	}
+	compactionSignal.notify_all();
+	if(compactor.joinable()) compactor.join();
+}
+
+namespace
+{
+	// Binary cell files are written in host byte order, which is little endian on all supported platforms.
+	// Layout: header, status bitmap (one bit per sample, row by row, padded to 8 bytes),
+	// samples (sizeLat x sizeLon of the sample type, unknown samples NAN), checksum of everything before.
+	// Compressed encodings replace bitmap and samples by an ElevationCodec stream.
+	// PAGED follows the header with the offsets of the status (one byte per sample) and the float64 samples,
+	// both start at page boundaries and their rows are not padded, so they can be mapped as grids.
+	const char CELL_MAGIC[4] = {'E', 'D', 'C', '\0'};
+	const uint16_t CELL_VERSION = 1;
+
+	struct CellHeader
+	{
+		char magic[4];
+		uint16_t version;
+		uint8_t sampleType;
+		uint8_t encoding;
+		uint64_t id;
+		uint64_t x, y;
+		uint32_t sizeLat, sizeLon;
+		double precision;
+		uint64_t known;			// Amount of known samples
+		uint64_t payloadSize;	// Bytes between header and checksum
+	};
+	static_assert(sizeof(CellHeader) == 64, "Cell header has to stay 64 bytes");
+
+	struct PagedLayout
+	{
+		uint64_t statusOffset;
+		uint64_t samplesOffset;
+	};
+
+	// Update logs are a sequence of records: record header, then the entries, each the sample index (row by row,
+	// uint32) and the sample (float64, NAN clears it) without padding. Same byte order as cell files.
+	// Appends interrupted by a crash leave a torn record behind, it ends the log and is truncated on load.
+	const char LOG_MAGIC[4] = {'E', 'D', 'L', '\0'};
+
+	struct LogRecord
+	{
+		char magic[4];
+		uint32_t count;			// Amount of entries
+		uint64_t id;
+		uint64_t checksum;		// Checksum of the entries
+	};
+	static_assert(sizeof(LogRecord) == 24, "Log record header has to stay 24 bytes");
+
+	const size_t LOG_ENTRY_SIZE = sizeof(uint32_t) + sizeof(double);
+
+	// Pages of common systems, larger pages are respected when writing
+	const size_t PAGE_ALIGNMENT = 4096;
+
+	size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Header of a cell file, fields that depend on the contents are left empty
+	CellHeader cellIdentity(uint64_t id, uint64_t x, uint64_t y, uint32_t sizeLat, uint32_t sizeLon, double precision)
+	{
+		CellHeader header = {};
+		memcpy(header.magic, CELL_MAGIC, sizeof(header.magic));
+		header.version		= CELL_VERSION;
+		header.id			= id;
+		header.x			= x;
+		header.y			= y;
+		header.sizeLat		= sizeLat;
+		header.sizeLon		= sizeLon;
+		header.precision	= precision;
+		return header;
+	}
+
+	// False if the header is damaged or unknown, throws if the file belongs to another cell
+	bool checkHeader(const CellHeader& header, const CellHeader& identity)
+	{
+		if(header.version != CELL_VERSION || header.encoding > eleman::ElevationIO::PAGED || header.sampleType > eleman::ElevationIO::FLOAT32)
+			return false;
+
+		if(header.id != identity.id || header.x != identity.x || header.y != identity.y)
+			throw std::runtime_error("[ElevationIO] cell file belongs to another cell");
+		if(header.sizeLat != identity.sizeLat || header.sizeLon != identity.sizeLon || header.precision != identity.precision)
+			throw std::runtime_error("[ElevationIO] cell file has a different grid size or precision");
+		return true;
+	}
+
+	// Magic, size and checksum of a whole cell file
+	bool checkFile(const uint8_t* data, size_t size, CellHeader& header)
+	{
+		if(size < sizeof(CellHeader) + sizeof(uint64_t) || memcmp(data, CELL_MAGIC, sizeof(CELL_MAGIC)) != 0) return false;
+
+		memcpy(&header, data, sizeof(header));
+		if(header.payloadSize != size - sizeof(CellHeader) - sizeof(uint64_t)) return false;
+
+		uint64_t sum;
+		memcpy(&sum, data + size - sizeof(uint64_t), sizeof(sum));
+		return eleman::checksum(data, size - sizeof(uint64_t)) == sum;
+	}
+
+	// Header of a binary cell file without reading the rest, false for JSON and damaged files
+	bool readHeader(const std::filesystem::path& filepath, size_t size, CellHeader& header)
+	{
+		if(size < sizeof(CellHeader) + sizeof(uint64_t)) return false;
+
+		std::ifstream file(filepath, std::ios::binary);
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		return file && memcmp(header.magic, CELL_MAGIC, sizeof(CELL_MAGIC)) == 0 && header.version == CELL_VERSION
+			&& header.payloadSize == size - sizeof(CellHeader) - sizeof(uint64_t)
+			&& header.known <= uint64_t(header.sizeLat) * header.sizeLon;
+	}
+
+	// Known samples of an encoded binary cell file
+	uint64_t knownSamples(const std::vector<uint8_t>& buffer)
+	{
+		CellHeader header;
+		memcpy(&header, buffer.data(), sizeof(header));
+		return header.known;
+	}
+
+	// Offsets are in range, do not overlap and the samples end where the checksum starts
+	bool checkLayout(const PagedLayout& layout, uint32_t sizeLat, uint32_t sizeLon, size_t size)
+	{
+		size_t samples = size_t(sizeLat) * sizeLon;
+		return layout.statusOffset >= sizeof(CellHeader) + sizeof(PagedLayout)
+			&& layout.samplesOffset >= layout.statusOffset + samples
+			&& layout.samplesOffset % sizeof(double) == 0
+			&& layout.samplesOffset + samples * sizeof(double) + sizeof(uint64_t) == size;
+	}
+
+	size_t bitmapSize(uint32_t sizeLat, uint32_t sizeLon)
+	{
+		return (size_t(sizeLat) * sizeLon + 63) / 64 * 8;
+	}
+
+	size_t sampleSize(uint8_t sampleType)
+	{
+		return sampleType == eleman::ElevationIO::FLOAT32 ? sizeof(float) : sizeof(double);
+	}
+
+	void encodeGrids(CellHeader header, GridView<const double> samples, GridView<const bool> status, uint8_t sampleType,
+					 uint8_t encoding, double quantization, std::vector<uint8_t>& buffer)
+	{
+		header.sampleType	= sampleType;
+		header.encoding		= encoding;
+		uint32_t sizeLat = header.sizeLat, sizeLon = header.sizeLon;
+
+		if(encoding == eleman::ElevationIO::PAGED)
+		{
+			size_t alignment = std::max(PAGE_ALIGNMENT, eleman::MappedFile::pageSize());
+			size_t count = size_t(sizeLat) * sizeLon;
+			PagedLayout layout;
+			layout.statusOffset = alignUp(sizeof(CellHeader) + sizeof(PagedLayout), alignment);
+			layout.samplesOffset = alignUp(layout.statusOffset + count, alignment);
+			buffer.assign(layout.samplesOffset + count * sizeof(double) + sizeof(uint64_t), 0);
+
+			uint64_t known = 0;
+			for(uint32_t y = 0; y < sizeLat; y++)
+			{
+				const bool* row = status.row(y);
+				memcpy(buffer.data() + layout.statusOffset + size_t(y) * sizeLon, row, sizeLon);
+				memcpy(buffer.data() + layout.samplesOffset + size_t(y) * sizeLon * sizeof(double), samples.row(y),
+					   sizeLon * sizeof(double));
+				known += std::count(row, row + sizeLon, true);
+			}
+
+			header.sampleType = eleman::ElevationIO::FLOAT64;
+			header.known = known;
+			header.payloadSize = buffer.size() - sizeof(CellHeader) - sizeof(uint64_t);
+			memcpy(buffer.data(), &header, sizeof(header));
+			memcpy(buffer.data() + sizeof(CellHeader), &layout, sizeof(layout));
+
+			uint64_t sum = eleman::checksum(buffer.data(), buffer.size() - sizeof(sum));
+			memcpy(buffer.data() + buffer.size() - sizeof(sum), &sum, sizeof(sum));
+			return;
+		}
+
+		if(encoding != eleman::ElevationIO::RAW)
+		{
+			// Compressed samples are always decoded to doubles
+			header.sampleType = eleman::ElevationIO::FLOAT64;
+			for(uint32_t y = 0; y < sizeLat; y++)
+				header.known += std::count(status.row(y), status.row(y) + sizeLon, true);
+
+			buffer.assign(sizeof(CellHeader), 0);
+			eleman::ElevationCodec::compress(samples, status, eleman::ElevationCodec::Level(encoding), quantization, buffer);
+			header.payloadSize = buffer.size() - sizeof(CellHeader);
+			memcpy(buffer.data(), &header, sizeof(header));
+
+			uint64_t sum = eleman::checksum(buffer.data(), buffer.size());
+			buffer.resize(buffer.size() + sizeof(sum));
+			memcpy(buffer.data() + buffer.size() - sizeof(sum), &sum, sizeof(sum));
+			return;
+		}
+
+		size_t bitmapBytes = bitmapSize(sizeLat, sizeLon);
+		size_t sampleBytes = size_t(sizeLat) * sizeLon * sampleSize(sampleType);
+		buffer.assign(sizeof(CellHeader) + bitmapBytes + sampleBytes + sizeof(uint64_t), 0);
+
+		// Status bitmap
+		uint8_t* bitmap = buffer.data() + sizeof(CellHeader);
+		uint64_t known = 0;
+		size_t bit = 0;
+		for(uint32_t y = 0; y < sizeLat; y++)
+		{
+			const bool* row = status.row(y);
+			for(uint32_t x = 0; x < sizeLon; x++, bit++)
+			{
+				if(!row[x]) continue;
+				bitmap[bit / 8] |= 1 << (bit % 8);
+				known++;
+			}
+		}
+
+		// Samples, rows are contiguous in the file but padded in the grid
+		uint8_t* target = bitmap + bitmapBytes;
+		for(uint32_t y = 0; y < sizeLat; y++)
+		{
+			const double* row = samples.row(y);
+			if(sampleType == eleman::ElevationIO::FLOAT64)
+			{
+				memcpy(target + size_t(y) * sizeLon * sizeof(double), row, sizeLon * sizeof(double));
+				continue;
+			}
+
+			float* floats = reinterpret_cast<float*>(target) + size_t(y) * sizeLon;
+			for(uint32_t x = 0; x < sizeLon; x++)
+				floats[x] = row[x];
+		}
+
+		header.known		= known;
+		header.payloadSize	= bitmapBytes + sampleBytes;
+		memcpy(buffer.data(), &header, sizeof(header));
+
+		uint64_t sum = eleman::checksum(buffer.data(), buffer.size() - sizeof(uint64_t));
+		memcpy(buffer.data() + buffer.size() - sizeof(uint64_t), &sum, sizeof(sum));
+	}
+
+	bool decodeGrids(const uint8_t* data, size_t size, const CellHeader& identity, GridView<double> samples, GridView<bool> status)
+	{
+		CellHeader header;
+		if(!checkFile(data, size, header) || !checkHeader(header, identity)) return false;
+		uint32_t sizeLat = header.sizeLat, sizeLon = header.sizeLon;
+
+		if(header.encoding == eleman::ElevationIO::PAGED)
+		{
+			PagedLayout layout;
+			if(size < sizeof(CellHeader) + sizeof(PagedLayout)) return false;
+			memcpy(&layout, data + sizeof(CellHeader), sizeof(layout));
+			if(!checkLayout(layout, sizeLat, sizeLon, size)) return false;
+
+			for(uint32_t y = 0; y < sizeLat; y++)
+			{
+				memcpy(status.row(y), data + layout.statusOffset + size_t(y) * sizeLon, sizeLon);
+				memcpy(samples.row(y), data + layout.samplesOffset + size_t(y) * sizeLon * sizeof(double), sizeLon * sizeof(double));
+			}
+			return true;
+		}
+
+		if(header.encoding != eleman::ElevationIO::RAW)
+			return eleman::ElevationCodec::decompress(data + sizeof(CellHeader), header.payloadSize, samples, status);
+
+		size_t bitmapBytes = bitmapSize(sizeLat, sizeLon);
+		if(header.payloadSize != bitmapBytes + size_t(sizeLat) * sizeLon * sampleSize(header.sampleType)) return false;
+
+		const uint8_t* bitmap = data + sizeof(CellHeader);
+		size_t bit = 0;
+		for(uint32_t y = 0; y < sizeLat; y++)
+		{
+			bool* row = status.row(y);
+			for(uint32_t x = 0; x < sizeLon; x++, bit++)
+				row[x] = (bitmap[bit / 8] >> (bit % 8)) & 1;
+		}
+
+		const uint8_t* source = bitmap + bitmapBytes;
+		for(uint32_t y = 0; y < sizeLat; y++)
+		{
+			double* row = samples.row(y);
+			if(header.sampleType == eleman::ElevationIO::FLOAT64)
+			{
+				memcpy(row, source + size_t(y) * sizeLon * sizeof(double), sizeLon * sizeof(double));
+				continue;
+			}
+
+			// The file may not be aligned for floats
+			const uint8_t* floats = source + size_t(y) * sizeLon * sizeof(float);
+			for(uint32_t x = 0; x < sizeLon; x++)
+			{
+				float value;
+				memcpy(&value, floats + x * sizeof(float), sizeof(float));
+				row[x] = value;
+			}
+		}
+
+		return true;
+	}
+
+	std::filesystem::path logPath(const std::filesystem::path& filepath)
+	{
+		std::filesystem::path logpath = filepath;
+		logpath.replace_extension(".edl");
+		return logpath;
+	}
+
+	// Calls apply(index, sample) for the entries of all intact records, returns the bytes they span
+	template <typename Apply>
+	size_t parseLog(const std::vector<uint8_t>& log, uint64_t id, size_t samples, Apply apply)
+	{
+		size_t position = 0;
+		while(log.size() - position >= sizeof(LogRecord))
+		{
+			LogRecord record;
+			memcpy(&record, log.data() + position, sizeof(record));
+			size_t entriesSize = size_t(record.count) * LOG_ENTRY_SIZE;
+			if(memcmp(record.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || record.id != id) break;
+			if(entriesSize > log.size() - position - sizeof(record)) break;
+
+			const uint8_t* entry = log.data() + position + sizeof(record);
+			if(eleman::checksum(entry, entriesSize) != record.checksum) break;
+
+			for(uint32_t i = 0; i < record.count; i++, entry += LOG_ENTRY_SIZE)
+			{
+				uint32_t index;
+				double sample;
+				memcpy(&index, entry, sizeof(index));
+				memcpy(&sample, entry + sizeof(index), sizeof(sample));
+				if(index < samples) apply(index, sample);
+			}
+			position += sizeof(record) + entriesSize;
+		}
+		return position;
+	}
+
+	bool readFile(const std::filesystem::path& filepath, std::vector<uint8_t>& buffer)
+	{
+		std::error_code error;
+		size_t size = std::filesystem::file_size(filepath, error);
+		if(error) return false;
+
+		std::ifstream file(filepath, std::ios::binary);
+		buffer.resize(size);
+		file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+		return bool(file);
+	}
+
+	void writeFile(const std::filesystem::path& filepath, const std::vector<uint8_t>& buffer)
+	{
+		std::ofstream file(filepath, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		file.close();
+		if(!file)
+			throw std::runtime_error("[ElevationIO] could not write " + filepath.string());
+	}
+
+	// Streams JSON cell files ({"cache": {"data": [{"elevation", "x", "y"}, ...], "id", "sizeLat", "sizeLon", "x", "y"}})
+	// without building a document, the samples are kept until the grid size is known
+	struct JSONCell : nlohmann::json_sax<nlohmann::json>
+	{
+		struct Sample
+		{
+			uint32_t x, y;
+			double elevation;
+		};
+
+		uint64_t id = 0, x = 0, y = 0;
+		uint32_t sizeLat = 0, sizeLon = 0;
+		std::vector<Sample> samples;
+		uint8_t fields = 0;		// Bits of the cache fields found
+
+		bool null() override { return value(0, NAN); }
+		bool boolean(bool) override { return false; }
+		bool number_integer(number_integer_t value) override { return value >= 0 && this->value(value, value); }
+		bool number_unsigned(number_unsigned_t value) override { return this->value(value, value); }
+		bool number_float(number_float_t value, const string_t&) override { return this->value(0, value); }
+		bool string(string_t&) override { return false; }
+		bool binary(binary_t&) override { return false; }
+
+		bool start_object(std::size_t) override
+		{
+			depth++;
+			if(depth == 3) samples.push_back({UINT32_MAX, UINT32_MAX, NAN});
+			return depth <= 3;
+		}
+		bool end_object() override { depth--; return true; }
+		bool start_array(std::size_t) override { return depth == 2 && field == "data"; }
+		bool end_array() override { return true; }
+		bool key(string_t& key) override { field = key; return true; }
+		bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override { return false; }
+
+		// All cache fields were found
+		bool complete() const { return fields == 0x1f; }
+
+	private:
+		int depth = 0;
+		std::string field;		// Last key
+
+		bool value(uint64_t integer, double real)
+		{
+			if(depth == 3)
+			{
+				Sample& sample = samples.back();
+				if(field == "x") sample.x = integer;
+				else if(field == "y") sample.y = integer;
+				else if(field == "elevation") sample.elevation = real;
+				return true;
+			}
+
+			if(depth != 2) return false;
+			if(field == "id") { id = integer; fields |= 1; }
+			else if(field == "x") { x = integer; fields |= 2; }
+			else if(field == "y") { y = integer; fields |= 4; }
+			else if(field == "sizeLat") { sizeLat = integer; fields |= 8; }
+			else if(field == "sizeLon") { sizeLon = integer; fields |= 16; }
+			return true;
+		}
+	};
+
+	// False if the text is no complete JSON cell file
+	bool parseJSON(const uint8_t* text, size_t size, JSONCell& cell)
+	{
+		return nlohmann::json::sax_parse(text, text + size, &cell) && cell.complete();
+	}
+
+	bool applyJSON(const JSONCell& parsed, GridView<double> samples, GridView<bool> status)
+	{
+		for(const JSONCell::Sample& sample : parsed.samples)
+		{
+			if(sample.x >= parsed.sizeLon || sample.y >= parsed.sizeLat) return false;
+			samples.row(sample.y)[sample.x] = sample.elevation;
+			status.row(sample.y)[sample.x] = true;
+		}
+		return true;
+	}
+
+	void encodeJSONGrids(const CellHeader& identity, GridView<const double> samples, GridView<const bool> status,
+						 std::vector<uint8_t>& buffer)
+	{
+		nlohmann::json jsonData;
+		jsonData["cache"]["id"]		= identity.id;
+		jsonData["cache"]["x"]		= identity.x;
+		jsonData["cache"]["y"]		= identity.y;
+		jsonData["cache"]["sizeLat"]= identity.sizeLat;
+		jsonData["cache"]["sizeLon"]= identity.sizeLon;
+
+		uint32_t count = 0;
+		for(uint32_t y = 0; y < identity.sizeLat; y++)
+		{
+			for(uint32_t x = 0; x < identity.sizeLon; x++)
+			{
+				if(!status.row(y)[x]) continue;
+
+				nlohmann::json object = nlohmann::json::object();
+				object["x"]	= x;
+				object["y"]	= y;
+				object["elevation"]	= samples.row(y)[x];
+
+				jsonData["cache"]["data"][count++] = object;
+			}
+		}
+
+		std::string text = jsonData.dump(1, '\t');
+		buffer.assign(text.begin(), text.end());
+	}
+
+	// Precision of the cache directory of a cell file, NAN if the directory is not named after one
+	double directoryPrecision(const std::filesystem::path& filepath)
+	{
+		std::string name = filepath.parent_path().filename().string();
+		return name.size() == 16 ? eleman::fromHex(name) : NAN;
+	}
+
+	// Decodes any cell file on its own, JSON files take the precision of their directory.
+	// Returns false if the file is damaged.
+	bool decodeFile(const std::filesystem::path& filepath, const std::vector<uint8_t>& file, CellHeader& identity,
+					Grid<double>& samples, Grid<bool>& status)
+	{
+		if(eleman::ElevationIO::isBinary(file.data(), file.size()))
+		{
+			CellHeader header;
+			if(!checkFile(file.data(), file.size(), header)) return false;
+			identity = cellIdentity(header.id, header.x, header.y, header.sizeLat, header.sizeLon, header.precision);
+			samples = Grid<double>(header.sizeLon, header.sizeLat, NAN);
+			status = Grid<bool>(header.sizeLon, header.sizeLat, false);
+			return decodeGrids(file.data(), file.size(), identity, samples.view(), status.view());
+		}
+
+		JSONCell parsed;
+		double precision = directoryPrecision(filepath);
+		if(std::isnan(precision) || !parseJSON(file.data(), file.size(), parsed)) return false;
+		identity = cellIdentity(parsed.id, parsed.x, parsed.y, parsed.sizeLat, parsed.sizeLon, precision);
+		samples = Grid<double>(parsed.sizeLon, parsed.sizeLat, NAN);
+		status = Grid<bool>(parsed.sizeLon, parsed.sizeLat, false);
+		return applyJSON(parsed, samples.view(), status.view());
+	}
+
+	// Largest difference between an original sample and its stored version
+	double sampleTolerance(const uint8_t* data, size_t size, double sample, double quantization)
+	{
+		if(!eleman::ElevationIO::isBinary(data, size)) return 0.0;
+
+		CellHeader header;
+		memcpy(&header, data, sizeof(header));
+		if(header.encoding == eleman::ElevationIO::FAST || header.encoding == eleman::ElevationIO::HIGH)
+			return quantization / 2.0 * (1.0 + 1e-6) + 1e-12 * std::abs(sample);
+		if(header.sampleType == eleman::ElevationIO::FLOAT32)
+			return 1e-7 * std::abs(sample);
+		return 0.0;
+	}
+
+	// Decodes a written cell file again and compares it to the grids it was written from
+	bool verifyFile(const std::filesystem::path& filepath, const std::vector<uint8_t>& file, const CellHeader& identity,
+					const Grid<double>& samples, const Grid<bool>& status, double quantization)
+	{
+		CellHeader decodedIdentity;
+		Grid<double> decodedSamples;
+		Grid<bool> decodedStatus;
+		if(!decodeFile(filepath, file, decodedIdentity, decodedSamples, decodedStatus)) return false;
+		if(decodedIdentity.id != identity.id || decodedIdentity.x != identity.x || decodedIdentity.y != identity.y
+		   || decodedIdentity.sizeLat != identity.sizeLat || decodedIdentity.sizeLon != identity.sizeLon
+		   || decodedIdentity.precision != identity.precision)
+			return false;
+
+		for(uint32_t y = 0; y < identity.sizeLat; y++)
+		{
+			for(uint32_t x = 0; x < identity.sizeLon; x++)
+			{
+				if(decodedStatus.get(x, y) != status.get(x, y)) return false;
+				if(!status.get(x, y)) continue;
+
+				double sample = samples.get(x, y);
+				double tolerance = sampleTolerance(file.data(), file.size(), sample, quantization);
+				if(!(std::abs(decodedSamples.get(x, y) - sample) <= tolerance)) return false;
+			}
+		}
+		return true;
+	}
+
+	// Estimated bytes a migration of the cell file holds at once: the file, the decoded grids and the new file
+	size_t migrationMemory(const std::filesystem::path& filepath, size_t size)
+	{
+		std::ifstream file(filepath, std::ios::binary);
+		std::vector<char> buffer(std::min<size_t>(size, 256));
+
+		// Binary files start with their header, the keys of JSON files are sorted and the grid size comes last
+		file.read(buffer.data(), std::min(buffer.size(), sizeof(CellHeader)));
+		size_t samples = 0;
+		if(file && eleman::ElevationIO::isBinary(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size()))
+		{
+			CellHeader header;
+			memcpy(&header, buffer.data(), sizeof(header));
+			samples = size_t(header.sizeLat) * header.sizeLon;
+		}
+		else
+		{
+			file.clear();
+			file.seekg(size - buffer.size());
+			file.read(buffer.data(), buffer.size());
+			std::string tail(buffer.data(), file.gcount());
+			size_t lat = tail.find("\"sizeLat\":"), lon = tail.find("\"sizeLon\":");
+			if(lat != std::string::npos && lon != std::string::npos)
+				samples = std::strtoull(tail.c_str() + lat + 10, nullptr, 10) * std::strtoull(tail.c_str() + lon + 10, nullptr, 10);
+		}
+
+		// Grids are decoded twice with verification, parsed JSON samples take less than their text
+		return 2 * size + samples * (sizeof(double) + sizeof(bool)) * 2 + size / 2;
+	}
+
+	// Identifies a file version, a changed one was replaced or appended to
+	struct FileState
+	{
+		bool exists = false;
+		uint64_t inode = 0;
+		uint64_t size = 0;
+		int64_t modified = 0;
+
+		bool operator==(const FileState& other) const
+		{
+			return exists == other.exists && inode == other.inode && size == other.size && modified == other.modified;
+		}
+		bool operator!=(const FileState& other) const { return !(*this == other); }
+	};
+
+	FileState fileState(const std::filesystem::path& filepath)
+	{
+		FileState state;
+		struct stat info;
+		if(::stat(filepath.c_str(), &info) != 0) return state;
+
+		state.exists = true;
+		state.inode = info.st_ino;
+		state.size = info.st_size;
+		state.modified = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+		return state;
+	}
+
+	// Loads record the access in the manifest at most this often (seconds), every record is a write
+	const int64_t ACCESS_RESOLUTION = 600;
+	// Seconds per sample of vendors with unknown limits, like 100 locations per request and a request per second
+	const double DEFAULT_REFETCH_COST = 0.01;
+
+	int64_t currentTime()
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	std::string cellFilename(uint64_t cellID, const std::string& fileExtension)
+	{
+		// Called for every load and store, cheaper than a stringstream
+		std::string filename = std::to_string(cellID);
+		if(filename.size() < 2) filename.insert(0, 2 - filename.size(), '0');
+		filename += ".";
+		filename += fileExtension;
+		return filename;
+	}
+
+	std::future<bool> readyFuture(bool value)
+	{
+		std::promise<bool> promise;
+		promise.set_value(value);
+		return promise.get_future();
+	}
+
+	// Bounds the bytes held by concurrent migrations, a single larger one still runs alone
+	class MemoryBudget
+	{
+	public:
+		MemoryBudget(size_t limit) : limit(limit) {}
+
+		void acquire(size_t bytes)
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			released.wait(lock, [&]() { return used == 0 || used + bytes <= limit; });
+			used += bytes;
+		}
+
+		void release(size_t bytes)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				used -= bytes;
+			}
+			released.notify_all();
+		}
+
+	private:
+		size_t limit;
+		size_t used = 0;
+		std::mutex mutex;
+		std::condition_variable released;
+	};
+}
+
+// TODO Rethink meaning of return value
+bool eleman::ElevationIO::store(eleman::ElevationCacheCell& cell)
+{
+	if(!cell.isDirty()) return false;
+
+	std::filesystem::path dir;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		dir = layerOf(*cell.cache, cell.precision).directory;
+	}
+	std::string filepath = dir / getFilename(cell);
+	waitForStore(cell, filepath);
+	if(!cell.isDirty()) return false;
+	if(updateLog && appendLog(cell, filepath))
+	{
+		markStored(cell);
+		enforceQuota();
+		return true;
+	}
+
+	std::filesystem::create_directories(dir);
+	printf("Storing cell %u in %s\n", cell.getID(), filepath.c_str());
+
+	std::vector<uint8_t> buffer;
+	encodeCell(cell, buffer);
+
+	// Written next to the old file and swapped in, an interrupted store never leaves a torn file behind
+	std::filesystem::path temporary = filepath;
+	temporary += ".tmp";
+	writeFile(temporary, buffer);
+	{
+		// The log belongs to the replaced file
+		std::lock_guard<std::mutex> lock(logMutex);
+		std::filesystem::rename(temporary, filepath);
+		std::filesystem::remove(logPath(filepath));
+	}
+
+	ManifestEntry entry;
+	entry.known = isBinary(buffer.data(), buffer.size()) ? knownSamples(buffer) : cell.size();
+	entry.samples = size_t(cell.sizeLat) * cell.sizeLon;
+	entry.bytes = buffer.size();
+	entry.accessed = currentTime();
+	updateManifest(filepath, cell.id, entry);
+
+	markStored(cell);
+	cell.stored = format == BINARY;
+
+	enforceQuota();
+	return true;
+}
+
+bool eleman::ElevationIO::load(eleman::ElevationCacheCell& cell)
+{
+	// Cells missing in the manifest were never stored
+	std::filesystem::path filepath;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		Layer& layer = layerOf(*cell.cache, cell.precision);
+		if(!layer.manifest->contains(cell.id)) return false;
+		layer.manifest->touch(cell.id, currentTime(), ACCESS_RESOLUTION);
+		filepath = layer.directory / getFilename(cell);
+	}
+	waitForStore(filepath);
+	std::filesystem::path logpath = logPath(filepath);
+
+	bool loaded = false, current = true;
+	{
+		// Keeps the compactor from swapping cell file and log in between
+		std::lock_guard<std::mutex> lock(logMutex);
+
+		std::vector<uint8_t> file, log;
+		bool logRead = readFile(logpath, log);
+		std::error_code error;
+		size_t size = std::filesystem::file_size(filepath, error);
+		if(!error && memoryMapping && mapCell(cell, filepath, size))
+		{
+			printf("Loading cell %u from %s\n", cell.getID(), filepath.c_str());
+			cell.invalidatePyramid();
+			markStored(cell);
+			if(logRead) replayLog(cell, logpath, log);
+			loaded = true;
+			current = format == BINARY && encoding == PAGED;
+		}
+		else
+		{
+			bool fileRead = !error && readFile(filepath, file);
+			loaded = loadFiles(cell, filepath, fileRead ? &file : nullptr, logRead ? &log : nullptr, current);
+		}
+	}
+
+	if(loaded && !current) migrateLoaded(cell, filepath);
+	return loaded;
+}
+
+void eleman::ElevationIO::flush()
+{
+
+}
+
+std::future<bool> eleman::ElevationIO::loadAsync(ElevationCacheCell& cell)
+{
+	// Mapped cells are not read up front, other backends load on their own
+	if(!queue || memoryMapping || cacheDir.empty())
+		return std::async(std::launch::deferred, [this, &cell]() { return load(cell); });
+
+	std::filesystem::path filepath;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		Layer& layer = layerOf(*cell.cache, cell.precision);
+		if(!layer.manifest->contains(cell.id)) return readyFuture(false);
+		layer.manifest->touch(cell.id, currentTime(), ACCESS_RESOLUTION);
+		filepath = layer.directory / getFilename(cell);
+	}
+	waitForStore(filepath);
+	std::filesystem::path logpath = logPath(filepath);
+
+	// Both files are read without the log mutex, if either changed meanwhile the cell is loaded again
+	FileState fileBefore = fileState(filepath), logBefore = fileState(logpath);
+	std::shared_ptr<std::vector<uint8_t>> file = std::make_shared<std::vector<uint8_t>>();
+	std::shared_ptr<std::vector<uint8_t>> log = std::make_shared<std::vector<uint8_t>>();
+	std::shared_future<bool> fileRead = fileBefore.exists ? queue->read(filepath, file) : readyFuture(false);
+	std::shared_future<bool> logRead = logBefore.exists ? queue->read(logpath, log) : readyFuture(false);
+
+	return std::async(std::launch::deferred, [=, &cell]()
+	{
+		bool loaded = false, current = true, changed;
+		{
+			std::lock_guard<std::mutex> lock(logMutex);
+			changed = fileState(filepath) != fileBefore || fileState(logpath) != logBefore;
+			if(!changed)
+				loaded = loadFiles(cell, filepath, fileRead.get() ? file.get() : nullptr, logRead.get() ? log.get() : nullptr, current);
+		}
+		if(changed)
+		{
+			// Wait for the reads, they refer to the buffers
+			fileRead.wait();
+			logRead.wait();
+			return load(cell);
+		}
+
+		if(loaded && !current) migrateLoaded(cell, filepath);
+		return loaded;
+	});
+}
+
+std::future<bool> eleman::ElevationIO::storeAsync(ElevationCacheCell& cell)
+{
+	if(!queue || cacheDir.empty() || !cell.isDirty())
+		return readyFuture(store(cell));
+
+	std::filesystem::path dir;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		dir = layerOf(*cell.cache, cell.precision).directory;
+	}
+	std::filesystem::path filepath = dir / getFilename(cell);
+	waitForStore(cell, filepath);
+	if(!cell.isDirty()) return readyFuture(false);
+	if(updateLog && appendLog(cell, filepath))
+	{
+		markStored(cell);
+		enforceQuota();
+		return readyFuture(true);
+	}
+
+	std::filesystem::create_directories(dir);
+	printf("Storing cell %u in %s\n", cell.getID(), filepath.c_str());
+
+	std::vector<uint8_t> buffer;
+	encodeCell(cell, buffer);
+
+	ManifestEntry entry;
+	entry.known = isBinary(buffer.data(), buffer.size()) ? knownSamples(buffer) : cell.size();
+	entry.samples = size_t(cell.sizeLat) * cell.sizeLon;
+	entry.bytes = buffer.size();
+	entry.accessed = currentTime();
+	uint64_t cellID = cell.id;
+
+	// Swapped in by the queue like store() does. Later changes are tracked against the new file right away,
+	// but the cell stays dirty until the file is in place and the next store rewrites it if the write failed.
+	std::filesystem::path temporary = filepath;
+	temporary += ".tmp";
+	std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+	std::shared_future<void> written = queue->write(temporary, std::move(buffer), [this, temporary, filepath, cellID, entry, done]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(logMutex);
+			std::filesystem::rename(temporary, filepath);
+			std::filesystem::remove(logPath(filepath));
+		}
+		*done = true;
+		updateManifest(filepath, cellID, entry);
+		enforceQuota();
+	});
+
+	markStored(cell);
+	cell.stored = format == BINARY;
+	cell.written = done;
+
+	{
+		std::lock_guard<std::mutex> lock(storeMutex);
+		for(auto it = pendingStores.begin(); it != pendingStores.end();)
+		{
+			if(it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				it = pendingStores.erase(it);
+			else
+				++it;
+		}
+		pendingStores[filepath] = written;
+	}
+
+	return std::async(std::launch::deferred, [written]()
+	{
+		written.get();
+		return true;
+	});
+}
+
+void eleman::ElevationIO::setQueue(ElevationIOQueue* queue)
+{
+	this->queue = queue;
+}
+
+eleman::ElevationIOQueue* eleman::ElevationIO::getQueue() const
+{
+	return queue;
+}
+
+void eleman::ElevationIO::setFormat(Format format)
+{
+	this->format = format;
+}
+
+eleman::ElevationIO::Format eleman::ElevationIO::getFormat() const
+{
+	return format;
+}
+
+void eleman::ElevationIO::setSampleType(SampleType sampleType)
+{
+	this->sampleType = sampleType;
+}
+
+eleman::ElevationIO::SampleType eleman::ElevationIO::getSampleType() const
+{
+	return sampleType;
+}
+
+void eleman::ElevationIO::setEncoding(Encoding encoding, double quantization)
+{
+	if(encoding != RAW && !(quantization > 0.0))
+		throw std::runtime_error("[ElevationIO] quantization has to be positive");
+
+	this->encoding = encoding;
+	this->quantization = quantization;
+}
+
+eleman::ElevationIO::Encoding eleman::ElevationIO::getEncoding() const
+{
+	return encoding;
+}
+
+double eleman::ElevationIO::getQuantization() const
+{
+	return quantization;
+}
+
+void eleman::ElevationIO::setMemoryMapping(bool enabled)
+{
+	memoryMapping = enabled;
+}
+
+bool eleman::ElevationIO::getMemoryMapping() const
+{
+	return memoryMapping;
+}
+
+void eleman::ElevationIO::setUpdateLog(bool enabled, double compactionRatio, uint64_t compactionBytes)
+{
+	if(!(compactionRatio > 0.0))
+		throw std::runtime_error("[ElevationIO] compaction ratio has to be positive");
+
+	updateLog = enabled;
+	this->compactionRatio = compactionRatio;
+	this->compactionBytes = compactionBytes;
+}
+
+bool eleman::ElevationIO::getUpdateLog() const
+{
+	return updateLog;
+}
+
+uint32_t eleman::ElevationIO::compactLogs()
+{
+	if(cacheDir.empty() || !std::filesystem::exists(cacheDir)) return 0;
+
+	// Collected first, compacting changes the directories
+	std::vector<std::filesystem::path> filepaths;
+	for(const std::filesystem::directory_entry& file : std::filesystem::recursive_directory_iterator(cacheDir))
+	{
+		if(!file.is_regular_file() || file.path().extension() != ".edl") continue;
+		filepaths.push_back(file.path());
+		filepaths.back().replace_extension(".edc");
+	}
+
+	uint32_t count = 0;
+	for(const std::filesystem::path& filepath : filepaths)
+		count += compactLog(filepath);
+	return count;
+}
+
+eleman::ElevationIO::MigrationReport eleman::ElevationIO::migrate(uint32_t threads, size_t memoryLimit)
+{
+	MigrationReport report;
+	if(cacheDir.empty() || !std::filesystem::exists(cacheDir)) return report;
+
+	std::vector<std::filesystem::path> filepaths;
+	for(const std::filesystem::directory_entry& file : std::filesystem::recursive_directory_iterator(cacheDir))
+	{
+		if(file.is_regular_file() && file.path().extension() == ".edc")
+			filepaths.push_back(file.path());
+	}
+	report.cells = filepaths.size();
+	printf("Migrating %zu cell files below %s\n", filepaths.size(), cacheDir.c_str());
+
+	// Their manifests are kept up to date while rewriting, with the access times
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		openLayers();
+	}
+
+	if(threads == 0)
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	// Every worker takes the next file, their sizes differ too much for fixed chunks
+	std::atomic<size_t> next(0);
+	std::mutex reportMutex;
+	MemoryBudget budget(memoryLimit);
+	parallelFor(0, threads, [&](uint32_t, uint32_t)
+	{
+		for(size_t i = next++; i < filepaths.size(); i = next++)
+		{
+			const std::filesystem::path& filepath = filepaths[i];
+			FileState file = fileState(filepath), log = fileState(logPath(filepath));
+			if(!file.exists) continue;
+
+			uint8_t header[sizeof(CellHeader)];
+			std::ifstream stream(filepath, std::ios::binary);
+			stream.read(reinterpret_cast<char*>(header), sizeof(header));
+			bool current = !log.exists && isCurrent(header, stream.gcount());
+			stream.close();
+
+			uint64_t bytes = file.size;
+			bool migrated = false;
+			if(!current)
+			{
+				size_t memory = migrationMemory(filepath, file.size);
+				budget.acquire(memory);
+				try
+				{
+					migrated = rewriteCellFile(filepath, true, bytes);
+				}
+				catch(const std::exception& e)
+				{
+					printf("Could not migrate %s: %s\n", filepath.c_str(), e.what());
+				}
+				budget.release(memory);
+			}
+
+			std::lock_guard<std::mutex> lock(reportMutex);
+			report.bytesBefore += file.size + log.size;
+			report.bytesAfter += migrated || current ? bytes : file.size + log.size;
+			report.migrated += migrated;
+			report.failed += !migrated && !current;
+		}
+	}, threads);
+
+	// Every file is read back, decoded in full and counted into a fresh manifest of its directory
+	std::map<std::filesystem::path, std::map<uint64_t, ManifestEntry>> directories;
+	std::set<std::filesystem::path> incomplete;
+	next = 0;
+	parallelFor(0, threads, [&](uint32_t, uint32_t)
+	{
+		for(size_t i = next++; i < filepaths.size(); i = next++)
+		{
+			const std::filesystem::path& filepath = filepaths[i];
+			std::vector<uint8_t> buffer;
+			if(!readFile(filepath, buffer)) continue;
+
+			size_t memory = 2 * buffer.size();
+			budget.acquire(memory);
+			CellHeader identity;
+			Grid<double> samples;
+			Grid<bool> status;
+			bool intact = isCurrent(buffer.data(), buffer.size()) && decodeFile(filepath, buffer, identity, samples, status);
+			budget.release(memory);
+			if(!intact)
+			{
+				printf("Cell file %s is not migrated\n", filepath.c_str());
+				std::lock_guard<std::mutex> lock(reportMutex);
+				incomplete.insert(filepath.parent_path());
+				continue;
+			}
+
+			ManifestEntry entry;
+			for(uint32_t y = 0; y < identity.sizeLat; y++)
+				entry.known += std::count(status.view().row(y), status.view().row(y) + identity.sizeLon, true);
+			entry.samples = size_t(identity.sizeLat) * identity.sizeLon;
+			entry.bytes = buffer.size();
+			std::error_code error;
+			uint64_t logSize = std::filesystem::file_size(logPath(filepath), error);
+			if(!error) entry.bytes += logSize;
+
+			std::lock_guard<std::mutex> lock(reportMutex);
+			directories[filepath.parent_path()][identity.id] = entry;
+			report.verified++;
+		}
+	}, threads);
+
+	// Manifests of layers were kept up to date, other directories would be rebuilt on first use.
+	// Directories with files left behind keep their stale manifest, the rebuild lists every readable file.
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		for(const auto& directory : directories)
+		{
+			if(findLayer(directory.first) || incomplete.count(directory.first)) continue;
+			ElevationManifest manifest(directory.first);
+			manifest.reset(directory.second);
+		}
+	}
+
+	printf("Migrated %lu of %lu cell files, %lu failed, %lu verified\n", (unsigned long)report.migrated,
+		   (unsigned long)report.cells, (unsigned long)report.failed, (unsigned long)report.verified);
+	return report;
+}
+
+void eleman::ElevationIO::setMigrateOnLoad(bool enabled)
+{
+	migrateOnLoad = enabled;
+}
 
+bool eleman::ElevationIO::getMigrateOnLoad() const
+{
+	return migrateOnLoad;
 }
 
-// TODO Rethink meaning of return value
-bool eleman::ElevationIO::store(eleman::ElevationCacheCell& cell)
+void eleman::ElevationIO::setQuota(uint64_t bytes)
 {
-	if(!cell.isDirty()) return false;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		quota = bytes;
+		// Cells of every cache count, not only of those used so far
+		if(quota > 0) openLayers();
+	}
+	enforceQuota();
+}
 
-	std::filesystem::path dir = getDirectory(cacheDir, cell);
-	std::string filepath = dir / getFilename(cell);
-	std::filesystem::create_directories(dir);
-	printf("Storing cell %u in %s\n", cell.getID(), filepath.c_str());
+uint64_t eleman::ElevationIO::getQuota() const
+{
+	return quota;
+}
 
+uint64_t eleman::ElevationIO::getUsage()
+{
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	uint64_t usage = 0;
+	for(const std::unique_ptr<Layer>& layer : layers)
+		usage += layer->manifest->getBytes();
+	return usage;
+}
+
+uint32_t eleman::ElevationIO::pinArea(double latitude0, double longitude0, double latitude1, double longitude1)
+{
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	pins[nextPin] = {std::min(latitude0, latitude1), std::min(longitude0, longitude1),
+					 std::max(latitude0, latitude1), std::max(longitude0, longitude1)};
+	return nextPin++;
+}
 
-	nlohmann::json jsonData;
-	jsonData["cache"]["id"]		= cell.id;
-	jsonData["cache"]["x"]		= cell.x;
-	jsonData["cache"]["y"]		= cell.y;
-	jsonData["cache"]["sizeLat"]= cell.sizeLat;
-	jsonData["cache"]["sizeLon"]= cell.sizeLon;
+void eleman::ElevationIO::unpinArea(uint32_t pinID)
+{
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	pins.erase(pinID);
+}
 
-	uint32_t count = 0;
-	for(uint32_t y = 0; y < cell.sizeLat; y++)
+void eleman::ElevationIO::setRefetchCost(const std::string& vendorID, double secondsPerSample)
+{
+	if(!(secondsPerSample >= 0.0))
+		throw std::runtime_error("[ElevationIO] refetch cost must not be negative");
+
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	refetchCosts[vendorID] = secondsPerSample;
+}
+
+uint32_t eleman::ElevationIO::enforceQuota()
+{
+	struct Candidate
 	{
-		for(uint32_t x = 0; x < cell.sizeLon; x++)
-		{
-			if(!cell.statusData->get(x, y)) continue;
+		Layer* layer;
+		uint64_t cellID;
+		ManifestEntry entry;
+		double value;
+	};
+
+	std::vector<Candidate> candidates;
+	uint64_t excess;
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		if(quota == 0) return 0;
 
-			nlohmann::json object = nlohmann::json::object();
-			object["x"]	= x;
-			object["y"]	= y;
-			object["elevation"]	= cell.elevationData->get(x, y);
+		uint64_t usage = 0;
+		for(const std::unique_ptr<Layer>& layer : layers)
+			usage += layer->manifest->getBytes();
+		if(usage <= quota) return 0;
+		// Down to 90%, so the next stores do not evict again right away
+		excess = usage - (quota - quota / 10);
 
-			jsonData["cache"]["data"][count++] = object;
+		// Seconds to download a cell again per byte it takes, devalued the longer it was not used
+		int64_t now = currentTime();
+		for(const std::unique_ptr<Layer>& layer : layers)
+		{
+			auto cost = refetchCosts.find(layer->vendorID);
+			double secondsPerSample = cost != refetchCosts.end() ? cost->second : DEFAULT_REFETCH_COST;
+			for(const auto& entry : layer->manifest->getEntries())
+			{
+				if(isPinned(entry.first, layer->cellDivisions)) continue;
+
+				double idle = std::max<int64_t>(now - entry.second.accessed, 0);
+				double value = secondsPerSample * entry.second.known / std::max<uint64_t>(entry.second.bytes, 1) / (idle + 3600.0);
+				candidates.push_back({layer.get(), entry.first, entry.second, value});
+			}
 		}
 	}
 
-	std::ofstream file(filepath);
-	file << jsonData.dump(1, '\t');
-	file.close();
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.value < b.value; });
 
-	cell.dirty = false;
+	uint32_t evicted = 0;
+	uint64_t freed = 0;
+	for(const Candidate& candidate : candidates)
+	{
+		if(freed >= excess) break;
+
+		std::filesystem::path filepath = candidate.layer->directory / cellFilename(candidate.cellID, "edc");
+		std::lock_guard<std::mutex> logLock(logMutex);
+		std::lock_guard<std::mutex> manifestLock(manifestMutex);
+
+		// Stored or loaded since the candidates were collected
+		ManifestEntry entry;
+		if(!candidate.layer->manifest->get(candidate.cellID, entry) || entry.bytes != candidate.entry.bytes
+		   || entry.accessed != candidate.entry.accessed)
+			continue;
+
+		printf("Evicting cell %lu (%lu bytes) from %s\n", (unsigned long)candidate.cellID, (unsigned long)entry.bytes,
+			   candidate.layer->directory.c_str());
+		std::error_code error;
+		std::filesystem::remove(filepath, error);
+		std::filesystem::remove(logPath(filepath), error);
+		candidate.layer->manifest->remove(candidate.cellID);
+		freed += entry.bytes;
+		evicted++;
+	}
+
+	if(freed < excess)
+		printf("Cache quota exceeded by %lu bytes, the remaining cells are pinned\n", (unsigned long)(excess - freed));
+	return evicted;
+}
+
+bool eleman::ElevationIO::getCellInfo(ElevationCache& cache, uint64_t cellID, ManifestEntry& entry)
+{
+	if(cacheDir.empty()) return false;
+
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	return layerOf(cache, cache.getPrecision()).manifest->get(cellID, entry);
+}
+
+std::map<uint64_t, eleman::ManifestEntry> eleman::ElevationIO::getCellInfos(ElevationCache& cache)
+{
+	if(cacheDir.empty()) return {};
+
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	return layerOf(cache, cache.getPrecision()).manifest->getEntries();
+}
+
+
+void eleman::ElevationIO::encode(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer, SampleType sampleType,
+								 Encoding encoding, double quantization)
+{
+	CellHeader identity = cellIdentity(cell.id, cell.x, cell.y, cell.sizeLat, cell.sizeLon, cell.precision);
+	encodeGrids(identity, cell.elevationData->view(), cell.statusData->view(), sampleType, encoding, quantization, buffer);
+}
+
+bool eleman::ElevationIO::decode(const uint8_t* data, size_t size, ElevationCacheCell& cell)
+{
+	CellHeader identity = cellIdentity(cell.id, cell.x, cell.y, cell.sizeLat, cell.sizeLon, cell.precision);
+	return decodeGrids(data, size, identity, cell.elevationData->view(), cell.statusData->view());
+}
+
+bool eleman::ElevationIO::isBinary(const uint8_t* data, size_t size)
+{
+	return size >= sizeof(CELL_MAGIC) && memcmp(data, CELL_MAGIC, sizeof(CELL_MAGIC)) == 0;
+}
+
+bool eleman::ElevationIO::readCellFile(const std::filesystem::path& filepath, std::vector<uint8_t>& buffer)
+{
+	if(!readFile(filepath, buffer)) return false;
+
+	std::vector<uint8_t> log;
+	if(!std::filesystem::exists(logPath(filepath)) || !readFile(logPath(filepath), log)) return true;
+
+	CellHeader identity;
+	Grid<double> samples;
+	Grid<bool> status;
+	if(!decodeFile(filepath, buffer, identity, samples, status)) return true;
 
+	parseLog(log, identity.id, size_t(identity.sizeLat) * identity.sizeLon, [&](uint32_t index, double sample)
+	{
+		samples.set(index % identity.sizeLon, index / identity.sizeLon, sample);
+		status.set(index % identity.sizeLon, index / identity.sizeLon, !std::isnan(sample));
+	});
+
+	// Raw samples hold compressed ones exactly, the quantization of the file is not needed
+	uint8_t sampleType = FLOAT64;
+	if(isBinary(buffer.data(), buffer.size()))
+	{
+		CellHeader header;
+		memcpy(&header, buffer.data(), sizeof(header));
+		if(header.encoding == RAW) sampleType = header.sampleType;
+	}
+	encodeGrids(identity, samples.view(), status.view(), sampleType, RAW, 0.01, buffer);
 	return true;
 }
 
-bool eleman::ElevationIO::load(eleman::ElevationCacheCell& cell)
+
+bool eleman::ElevationIO::loadFiles(ElevationCacheCell& cell, const std::filesystem::path& filepath,
+									const std::vector<uint8_t>* file, const std::vector<uint8_t>* log, bool& current)
 {
-	std::string filepath = getDirectory(cacheDir, cell) / getFilename(cell);
-	if(!std::filesystem::exists(filepath)) return false;
+	bool loaded = false;
+	current = true;
+	if(file)
+	{
+		printf("Loading cell %u from %s\n", cell.getID(), filepath.c_str());
+		if(decodeCell(cell, file->data(), file->size()))
+		{
+			loaded = true;
+			current = isCurrent(file->data(), file->size());
+		}
+		else
+		{
+			printf("Cell file %s is damaged, ignoring it\n", filepath.c_str());
+		}
+	}
+
+	// Samples stored after the cell file was written
+	if(log && replayLog(cell, logPath(filepath), *log) > 0 && !loaded)
+	{
+		// The next store writes a complete cell file
+		cell.stored = false;
+		cell.dirty = true;
+		return true;
+	}
+
+	return loaded;
+}
 
-	printf("Loading cell %u from %s\n", cell.getID(), filepath.c_str());
+void eleman::ElevationIO::migrateLoaded(ElevationCacheCell& cell, const std::filesystem::path& filepath)
+{
+	// Files in another format are converted when they are touched, the loaded cell stays as it is
+	if(!migrateOnLoad) return;
 
-	std::ifstream file(filepath);
-	nlohmann::json parsed = nlohmann::json::parse(file);
-	file.close();
+	try
+	{
+		uint64_t bytes;
+		if(rewriteCellFile(filepath, true, bytes) && !cell.dirty)
+			cell.stored = format == BINARY;
+	}
+	catch(const std::exception& e)
+	{
+		printf("Could not migrate %s: %s\n", filepath.c_str(), e.what());
+	}
+}
 
-	if(parsed["cache"]["id"] != cell.id)
-		throw std::runtime_error("FUCK");
-	if(parsed["cache"]["x"]	!= cell.x)
-		throw std::runtime_error("FUCK");
-	if(parsed["cache"]["y"]	!= cell.y)
-		throw std::runtime_error("FUCK");
-	if(parsed["cache"]["sizeLat"]	!= cell.sizeLat)
-		throw std::runtime_error("FUCK");
-	if(parsed["cache"]["sizeLon"]	!= cell.sizeLon)
-		throw std::runtime_error("FUCK");
+bool eleman::ElevationIO::isPinned(uint64_t cellID, uint16_t cellDivisions) const
+{
+	if(pins.empty()) return false;
 
-	nlohmann::json data = parsed["cache"]["data"];
-	for(size_t i = 0; i < data.size(); i++)
+	double latitude0, longitude0;
+	ElevationCache::fromCellID(cellID, latitude0, longitude0, cellDivisions);
+	double latitude1 = latitude0 + 1.0 / cellDivisions, longitude1 = longitude0 + 1.0 / cellDivisions;
+	for(const auto& pin : pins)
 	{
-		uint32_t x = data[i]["x"];
-		uint32_t y = data[i]["y"];
-		double elevation = data[i]["elevation"];
+		const Pin& box = pin.second;
+		if(box.latitude0 <= latitude1 && box.latitude1 >= latitude0 && box.longitude0 <= longitude1 && box.longitude1 >= longitude0)
+			return true;
+	}
+	return false;
+}
 
-		cell.statusData->set(x, y, true);
-		cell.elevationData->set(x, y, elevation);
+void eleman::ElevationIO::waitForStore(const std::filesystem::path& filepath)
+{
+	std::shared_future<void> written;
+	{
+		std::lock_guard<std::mutex> lock(storeMutex);
+		auto it = pendingStores.find(filepath);
+		if(it == pendingStores.end()) return;
+		written = it->second;
 	}
-	cell.dirty = false;
+	written.wait();
+}
+
+void eleman::ElevationIO::waitForStore(ElevationCacheCell& cell, const std::filesystem::path& filepath)
+{
+	if(!cell.written) return;
 
+	waitForStore(filepath);
+	// The file lacks the samples stored with the failed write, the changes logged since do not apply to it
+	if(!*cell.written)
+	{
+		cell.dirty = true;
+		cell.changesOverflow = true;
+	}
+	cell.written.reset();
+}
+
+bool eleman::ElevationIO::mapCell(ElevationCacheCell& cell, const std::filesystem::path& filepath, size_t size)
+{
+	// Header and layout only, the samples stay on disk until they are touched
+	uint8_t data[sizeof(CellHeader) + sizeof(PagedLayout)];
+	if(size < sizeof(data) + sizeof(uint64_t)) return false;
+
+	std::ifstream file(filepath, std::ios::binary);
+	file.read(reinterpret_cast<char*>(data), sizeof(data));
+	if(!file || !isBinary(data, sizeof(data))) return false;
+
+	CellHeader header;
+	PagedLayout layout;
+	memcpy(&header, data, sizeof(header));
+	memcpy(&layout, data + sizeof(header), sizeof(layout));
+	if(header.encoding != PAGED || header.payloadSize != size - sizeof(CellHeader) - sizeof(uint64_t)) return false;
+	if(!checkHeader(header, cellIdentity(cell.id, cell.x, cell.y, cell.sizeLat, cell.sizeLon, cell.precision))) return false;
+	if(!checkLayout(layout, cell.sizeLat, cell.sizeLon, size)) return false;
+
+	// Written on a system with smaller pages
+	if(layout.statusOffset % MappedFile::pageSize() != 0 || layout.samplesOffset % MappedFile::pageSize() != 0) return false;
+
+	// Copy on write only guards against stray writes, the cell promotes itself to the heap before writing
+	cell.statusData = std::make_shared<Grid<bool>>(Grid<bool>::map(filepath, cell.sizeLon, cell.sizeLat,
+																	MappedFile::COPY_ON_WRITE, layout.statusOffset, sizeof(bool)));
+	cell.elevationData = std::make_shared<Grid<double>>(Grid<double>::map(filepath, cell.sizeLon, cell.sizeLat,
+																		   MappedFile::COPY_ON_WRITE, layout.samplesOffset, sizeof(double)));
+	return true;
+}
+
+
+void eleman::ElevationIO::encodeCell(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer) const
+{
+	if(format == JSON)
+		encodeJSON(cell, buffer);
+	else
+		encode(cell, buffer, sampleType, encoding, quantization);
+}
+
+bool eleman::ElevationIO::decodeCell(ElevationCacheCell& cell, const uint8_t* data, size_t size)
+{
+	cell.allocateGrids();
+
+	bool binary = isBinary(data, size);
+	bool loaded = binary ? decode(data, size, cell) : decodeJSON(cell, data, size);
+	if(!loaded) return false;
+
+	cell.invalidatePyramid();
+	markStored(cell);
+	// Logs are folded into binary files only, the next store converts the file
+	cell.stored = binary;
 	return true;
 }
 
+void eleman::ElevationIO::markStored(ElevationCacheCell& cell)
+{
+	cell.dirty = false;
+	cell.stored = true;
+	cell.changesOverflow = false;
+	cell.changes.clear();
+	cell.knownChange = 0;
+	cell.written.reset();
+}
+
+void eleman::ElevationIO::encodeJSON(const ElevationCacheCell& cell, std::vector<uint8_t>& buffer)
+{
+	CellHeader identity = cellIdentity(cell.id, cell.x, cell.y, cell.sizeLat, cell.sizeLon, cell.precision);
+	encodeJSONGrids(identity, cell.elevationData->view(), cell.statusData->view(), buffer);
+}
+
+bool eleman::ElevationIO::decodeJSON(ElevationCacheCell& cell, const uint8_t* text, size_t size)
+{
+	JSONCell parsed;
+	if(!parseJSON(text, size, parsed)) return false;
+
+	if(parsed.id != cell.id || parsed.x != cell.x || parsed.y != cell.y)
+		throw std::runtime_error("[ElevationIO] cell file belongs to another cell");
+	if(parsed.sizeLat != cell.sizeLat || parsed.sizeLon != cell.sizeLon)
+		throw std::runtime_error("[ElevationIO] cell file has a different grid size");
+
+	return applyJSON(parsed, cell.elevationData->view(), cell.statusData->view());
+}
+
+bool eleman::ElevationIO::isCurrent(const uint8_t* data, size_t size) const
+{
+	if(!isBinary(data, size)) return format == JSON;
+	if(format != BINARY || size < sizeof(CellHeader)) return false;
+
+	CellHeader header;
+	memcpy(&header, data, sizeof(header));
+	return header.encoding == encoding && (encoding != RAW || header.sampleType == sampleType);
+}
+
 
 void eleman::ElevationIO::createCacheDir()
 {
 	std::filesystem::create_directories(cacheDir);
 }
 
+eleman::ElevationIO::Layer& eleman::ElevationIO::layerOf(ElevationCache& cache, double precision)
+{
+	const ElevationVendor* vendor = cache.getManager()->getVendor();
+	std::string vendorID = vendor->getID();
+	uint16_t cellDivisions = cache.getCellDivisions();
+
+	// Downloading is limited by requests per second or per day, whatever takes longer
+	if(refetchCosts.find(vendorID) == refetchCosts.end())
+	{
+		double locations = std::max<double>(vendor->getLocationsPerRequest(), 1.0);
+		double perSecond = 1.0 / (locations * std::max<double>(vendor->getRequestsPerSecond(), 1.0));
+		double perDay = 86400.0 / (locations * std::max<double>(vendor->getRequestsPerDay(), 1.0));
+		refetchCosts[vendorID] = std::max(perSecond, perDay);
+	}
+
+	for(std::unique_ptr<Layer>& layer : layers)
+	{
+		if(layer->cellDivisions == cellDivisions && layer->precision == precision && layer->vendorID == vendorID)
+			return *layer;
+	}
+
+	std::unique_ptr<Layer> layer(new Layer());
+	layer->vendorID = vendorID;
+	layer->cellDivisions = cellDivisions;
+	layer->precision = precision;
+	layer->directory = getDirectory(cacheDir, cache, precision);
+	layer->manifest.reset(new ElevationManifest(layer->directory));
+	if(layer->manifest->isStale())
+		rebuildManifest(*layer->manifest);
+
+	layers.push_back(std::move(layer));
+	return *layers.back();
+}
+
+void eleman::ElevationIO::openLayers()
+{
+	if(cacheDir.empty() || !std::filesystem::exists(cacheDir)) return;
+
+	// Only the directories are listed (vendor/divisions/precision), not the cell files
+	for(const std::filesystem::directory_entry& vendor : std::filesystem::directory_iterator(cacheDir))
+	{
+		if(!vendor.is_directory()) continue;
+		for(const std::filesystem::directory_entry& divisions : std::filesystem::directory_iterator(vendor.path()))
+		{
+			std::string name = divisions.path().filename().string();
+			if(!divisions.is_directory() || name.empty() || name.find_first_not_of("0123456789") != std::string::npos) continue;
+
+			for(const std::filesystem::directory_entry& precision : std::filesystem::directory_iterator(divisions.path()))
+			{
+				double value = precision.path().filename().string().size() == 16 ? fromHex(precision.path().filename().string()) : NAN;
+				if(!precision.is_directory() || std::isnan(value) || findLayer(precision.path())) continue;
+
+				std::unique_ptr<Layer> layer(new Layer());
+				layer->vendorID = vendor.path().filename().string();
+				layer->cellDivisions = std::stoul(name);
+				layer->precision = value;
+				layer->directory = precision.path();
+				layer->manifest.reset(new ElevationManifest(layer->directory));
+				if(layer->manifest->isStale())
+					rebuildManifest(*layer->manifest);
+				layers.push_back(std::move(layer));
+			}
+		}
+	}
+}
+
+eleman::ElevationIO::Layer* eleman::ElevationIO::findLayer(const std::filesystem::path& directory)
+{
+	for(std::unique_ptr<Layer>& layer : layers)
+	{
+		if(layer->directory == directory) return layer.get();
+	}
+	return nullptr;
+}
+
+void eleman::ElevationIO::rebuildManifest(ElevationManifest& manifest)
+{
+	printf("Rebuilding manifest of %s\n", manifest.getDirectory().c_str());
+
+	std::map<uint64_t, ManifestEntry> entries;
+	for(const std::filesystem::directory_entry& file : std::filesystem::directory_iterator(manifest.getDirectory()))
+	{
+		if(!file.is_regular_file() || file.path().extension() != ".edc") continue;
+
+		uint64_t cellID;
+		try
+		{
+			cellID = std::stoull(file.path().stem().string());
+		}
+		catch(const std::exception&)
+		{
+			continue;
+		}
+
+		// Binary files carry their fill in the header, only JSON files are read and parsed completely.
+		// The checksum of binary files is left to the next load.
+		std::error_code error;
+		ManifestEntry entry;
+		CellHeader header;
+		entry.bytes = file.file_size(error);
+		if(error) continue;
+		if(readHeader(file.path(), entry.bytes, header))
+		{
+			entry.known = header.known;
+			entry.samples = size_t(header.sizeLat) * header.sizeLon;
+		}
+		else
+		{
+			std::vector<uint8_t> buffer;
+			JSONCell parsed;
+			if(!readFile(file.path(), buffer) || isBinary(buffer.data(), buffer.size())
+			   || !parseJSON(buffer.data(), buffer.size(), parsed)) continue;
+			entry.known = parsed.samples.size();
+			entry.samples = uint64_t(parsed.sizeLat) * parsed.sizeLon;
+		}
+
+		// Logged samples are counted once the log is compacted
+		uint64_t logSize = std::filesystem::file_size(logPath(file.path()), error);
+		if(!error) entry.bytes += logSize;
+		// The last write is the best guess for the last access
+		entry.accessed = fileState(file.path()).modified / 1000000000;
+
+		entries[cellID] = entry;
+	}
+
+	manifest.reset(entries);
+}
+
+void eleman::ElevationIO::updateManifest(const std::filesystem::path& filepath, uint64_t cellID, const ManifestEntry& entry)
+{
+	std::lock_guard<std::mutex> lock(manifestMutex);
+	Layer* layer = findLayer(filepath.parent_path());
+	if(!layer) return;
+
+	// Rewrites without an access (compaction, migration) keep the last one
+	ManifestEntry updated = entry, previous;
+	if(updated.accessed == 0)
+		updated.accessed = layer->manifest->get(cellID, previous) ? previous.accessed : currentTime();
+	layer->manifest->set(cellID, updated);
+}
+
+bool eleman::ElevationIO::appendLog(ElevationCacheCell& cell, const std::filesystem::path& filepath)
+{
+	if(format != BINARY || !cell.stored || cell.changesOverflow) return false;
+
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(filepath, error);
+	if(error) return false;
+	// Stores only happen for dirty cells, dirty without tracked changes means untracked writes
+	if(cell.changes.empty()) return false;
+
+	// Samples written several times are logged once
+	std::sort(cell.changes.begin(), cell.changes.end());
+	cell.changes.erase(std::unique(cell.changes.begin(), cell.changes.end()), cell.changes.end());
+
+	std::vector<uint8_t> buffer(sizeof(LogRecord) + cell.changes.size() * LOG_ENTRY_SIZE);
+	uint8_t* entry = buffer.data() + sizeof(LogRecord);
+	for(uint32_t index : cell.changes)
+	{
+		uint32_t x = index % cell.sizeLon, y = index / cell.sizeLon;
+		double sample = cell.statusData->get(x, y) ? cell.elevationData->get(x, y) : NAN;
+		memcpy(entry, &index, sizeof(index));
+		memcpy(entry + sizeof(index), &sample, sizeof(sample));
+		entry += LOG_ENTRY_SIZE;
+	}
+
+	LogRecord record = {};
+	memcpy(record.magic, LOG_MAGIC, sizeof(record.magic));
+	record.count = cell.changes.size();
+	record.id = cell.id;
+	record.checksum = checksum(buffer.data() + sizeof(record), buffer.size() - sizeof(record));
+	memcpy(buffer.data(), &record, sizeof(record));
+
+	std::filesystem::path logpath = logPath(filepath);
+	printf("Logging %zu samples of cell %u in %s\n", cell.changes.size(), cell.getID(), logpath.c_str());
+
+	uint64_t logSize;
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		std::ofstream log(logpath, std::ios::binary | std::ios::app);
+		log.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		logSize = log.tellp();
+		log.close();
+		if(!log)
+			throw std::runtime_error("[ElevationIO] could not write " + logpath.string());
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(manifestMutex);
+		Layer* layer = findLayer(filepath.parent_path());
+		ManifestEntry entry;
+		if(layer && layer->manifest->get(cell.id, entry))
+		{
+			entry.known += cell.knownChange;
+			entry.bytes = fileSize + logSize;
+			entry.accessed = currentTime();
+			layer->manifest->set(cell.id, entry);
+		}
+	}
+
+	if(logSize >= compactionBytes || logSize >= fileSize * compactionRatio)
+		scheduleCompaction(filepath);
+	return true;
+}
+
+size_t eleman::ElevationIO::replayLog(ElevationCacheCell& cell, const std::filesystem::path& logpath, const std::vector<uint8_t>& log)
+{
+	cell.allocateGrids();
+	size_t applied = 0;
+	size_t intact = parseLog(log, cell.id, size_t(cell.sizeLat) * cell.sizeLon, [&](uint32_t index, double sample)
+	{
+		cell.promote();
+		cell.elevationData->set(index % cell.sizeLon, index / cell.sizeLon, sample);
+		cell.statusData->set(index % cell.sizeLon, index / cell.sizeLon, !std::isnan(sample));
+		applied++;
+	});
+
+	// Appends continue behind the last intact record
+	if(intact < log.size())
+	{
+		printf("Log %s is torn after %zu bytes, truncating it\n", logpath.c_str(), intact);
+		std::filesystem::resize_file(logpath, intact);
+	}
+
+	if(applied > 0) cell.invalidatePyramid();
+	return applied;
+}
+
+void eleman::ElevationIO::scheduleCompaction(const std::filesystem::path& filepath)
+{
+	std::lock_guard<std::mutex> lock(compactionMutex);
+	if(!compactor.joinable())
+		compactor = std::thread(&ElevationIO::runCompactor, this);
+
+	compactionQueue.insert(filepath);
+	compactionSignal.notify_one();
+}
+
+void eleman::ElevationIO::runCompactor()
+{
+	std::unique_lock<std::mutex> lock(compactionMutex);
+	while(true)
+	{
+		compactionSignal.wait(lock, [this]() { return stopping || !compactionQueue.empty(); });
+		if(stopping) return;
+
+		std::filesystem::path filepath = *compactionQueue.begin();
+		compactionQueue.erase(compactionQueue.begin());
+
+		lock.unlock();
+		try
+		{
+			compactLog(filepath);
+		}
+		catch(const std::exception& e)
+		{
+			printf("Could not compact the log of %s: %s\n", filepath.c_str(), e.what());
+		}
+		lock.lock();
+	}
+}
+
+bool eleman::ElevationIO::compactLog(const std::filesystem::path& filepath)
+{
+	if(!std::filesystem::exists(logPath(filepath))) return false;
+
+	uint64_t bytes;
+	return rewriteCellFile(filepath, false, bytes);
+}
+
+bool eleman::ElevationIO::rewriteCellFile(const std::filesystem::path& filepath, bool verify, uint64_t& bytes)
+{
+	std::filesystem::path logpath = logPath(filepath);
+
+	// Read and converted without the log mutex, swapped in only if nobody changed the files in between
+	for(int attempt = 0; attempt < 3; attempt++)
+	{
+		FileState fileBefore = fileState(filepath), logBefore = fileState(logpath);
+		std::vector<uint8_t> file, log;
+		if(!fileBefore.exists || !readFile(filepath, file)) return false;
+		if(logBefore.exists && !readFile(logpath, log)) continue;
+
+		// The cell file describes itself, no cache cell is needed
+		CellHeader identity;
+		Grid<double> samples;
+		Grid<bool> status;
+		if(!decodeFile(filepath, file, identity, samples, status))
+		{
+			printf("Cell file %s is damaged, keeping it\n", filepath.c_str());
+			return false;
+		}
+
+		size_t applied = 0;
+		parseLog(log, identity.id, size_t(identity.sizeLat) * identity.sizeLon, [&](uint32_t index, double sample)
+		{
+			samples.set(index % identity.sizeLon, index / identity.sizeLon, sample);
+			status.set(index % identity.sizeLon, index / identity.sizeLon, !std::isnan(sample));
+			applied++;
+		});
+
+		std::vector<uint8_t> buffer;
+		if(format == JSON)
+			encodeJSONGrids(identity, samples.view(), status.view(), buffer);
+		else
+			encodeGrids(identity, samples.view(), status.view(), sampleType, encoding, quantization, buffer);
+
+		if(verify && !verifyFile(filepath, buffer, identity, samples, status, quantization))
+		{
+			printf("Verification of %s failed, keeping the old file\n", filepath.c_str());
+			return false;
+		}
+
+		// Not the temporary file of store(), which may run concurrently
+		std::filesystem::path temporary = filepath;
+		temporary += ".rewrite";
+		writeFile(temporary, buffer);
+		bool swapped;
+		{
+			std::lock_guard<std::mutex> lock(logMutex);
+			swapped = fileState(filepath) == fileBefore && fileState(logpath) == logBefore;
+			if(swapped)
+			{
+				std::filesystem::rename(temporary, filepath);
+				std::filesystem::remove(logpath);
+			}
+		}
+		if(!swapped)
+		{
+			// Stored or logged concurrently, start over from the new files
+			std::filesystem::remove(temporary);
+			continue;
+		}
+
+		ManifestEntry entry;
+		for(uint32_t y = 0; y < identity.sizeLat; y++)
+			entry.known += std::count(status.view().row(y), status.view().row(y) + identity.sizeLon, true);
+		entry.samples = size_t(identity.sizeLat) * identity.sizeLon;
+		entry.bytes = buffer.size();
+		updateManifest(filepath, identity.id, entry);
+
+		if(applied > 0) printf("Compacted %zu logged samples into %s\n", applied, filepath.c_str());
+		bytes = buffer.size();
+		return true;
+	}
+
+	printf("Cell file %s kept changing, leaving it as it is\n", filepath.c_str());
+	return false;
+}
+
 std::filesystem::path eleman::ElevationIO::getDirectory(const std::filesystem::path cacheDir, const eleman::ElevationCacheCell& cell)
+{
+	return getDirectory(cacheDir, *cell.cache, cell.getPrecision());
+}
+
+std::filesystem::path eleman::ElevationIO::getDirectory(const std::filesystem::path cacheDir, ElevationCache& cache, double precision)
 {
 	// By Vendor
 	std::filesystem::path dir = cacheDir;
-	dir /= cell.cache->getManager()->getVendor()->getID();
+	dir /= cache.getManager()->getVendor()->getID();
 
 	// By CellDivisions
 	std::stringstream ss;
-	ss << std::setw(4) << std::setfill('0') << cell.cache->getCellDivisions();
+	ss << std::setw(4) << std::setfill('0') << cache.getCellDivisions();
 	dir /= ss.str();
 
 	// By Precision
 	// TODO Maybe find better
-	dir /= toHex(cell.getPrecision());
+	dir /= toHex(precision);
 
 	return dir;
 }
 
 std::string eleman::ElevationIO::getFilename(const eleman::ElevationCacheCell& cell, const std::string& fileExtension)
 {
-	std::stringstream ss;
-	ss << std::setw(2) << std::setfill('0') << cell.getID();
-	ss << "." << fileExtension;
-
-	return ss.str();
+	return cellFilename(cell.getID(), fileExtension);
 }
 
 
@@ -0,0 +1,487 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationioqueue.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ELEMAN_IO_URING 1
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+	// Larger files are transferred in several chunks, single calls are limited to about 2 GB
+	const size_t CHUNK_SIZE = size_t(1) << 30;
+
+	std::string errorText(int error)
+	{
+		return strerror(error);
+	}
+}
+
+#ifdef ELEMAN_IO_URING
+// Submission and completion rings shared with the kernel, used without liburing
+struct eleman::ElevationIOQueue::Ring
+{
+	int fd = -1;
+	int event = -1;				// Signals queued requests, polled through the ring
+	uint32_t entries = 0;
+	uint32_t prepared = 0;		// Submissions written since the last enter
+	uint32_t inflight = 0;		// Requests taken from the queue
+
+	void* sqMemory = MAP_FAILED;
+	void* cqMemory = MAP_FAILED;
+	size_t sqSize = 0, cqSize = 0;
+	io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	size_t sqesSize = 0;
+
+	unsigned *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	io_uring_cqe* cqes;
+
+	std::vector<iovec> vectors;
+	std::vector<uint32_t> freeSlots;
+	std::vector<ElevationIOQueue::Request*> active;		// Request of every slot in flight
+	// Failed requests the kernel may still access, freed after the ring is closed
+	std::vector<std::unique_ptr<ElevationIOQueue::Request>> abandoned;
+
+	~Ring()
+	{
+		if(sqes != MAP_FAILED) munmap(sqes, sqesSize);
+		if(cqMemory != MAP_FAILED && cqMemory != sqMemory) munmap(cqMemory, cqSize);
+		if(sqMemory != MAP_FAILED) munmap(sqMemory, sqSize);
+		if(event >= 0) close(event);
+		if(fd >= 0) close(fd);
+	}
+
+	io_uring_sqe& next()
+	{
+		unsigned tail = *sqTail;
+		unsigned index = tail & *sqMask;
+		io_uring_sqe& sqe = sqes[index];
+		memset(&sqe, 0, sizeof(sqe));
+		sqArray[index] = index;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		prepared++;
+		return sqe;
+	}
+
+	// Waits until the queue signals new requests, completes with user data 0
+	void poll()
+	{
+		io_uring_sqe& sqe = next();
+		sqe.opcode = IORING_OP_POLL_ADD;
+		sqe.fd = event;
+		sqe.poll_events = POLLIN;
+		sqe.user_data = 0;
+	}
+};
+#else
+struct eleman::ElevationIOQueue::Ring
+{
+};
+#endif
+
+eleman::ElevationIOQueue::ElevationIOQueue(uint32_t depth, Backend backend, uint32_t threads)
+{
+	this->depth = std::max(depth, 1u);
+
+	if(backend != THREADS && openRing())
+	{
+		this->backend = IO_URING;
+		workers.emplace_back(&ElevationIOQueue::runRing, this);
+		return;
+	}
+	if(backend == IO_URING)
+		throw std::runtime_error("[ElevationIOQueue] io_uring is not available");
+
+	this->backend = THREADS;
+	if(threads == 0)
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	for(uint32_t i = 0; i < std::min(threads, this->depth); i++)
+		workers.emplace_back(&ElevationIOQueue::runWorker, this);
+}
+
+eleman::ElevationIOQueue::~ElevationIOQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	signal.notify_all();
+#ifdef ELEMAN_IO_URING
+	uint64_t one = 1;
+	if(ring && ::write(ring->event, &one, sizeof(one)) < 0)
+		printf("Could not wake the IO queue: %s\n", strerror(errno));
+#endif
+
+	for(std::thread& worker : workers)
+		worker.join();
+}
+
+std::future<bool> eleman::ElevationIOQueue::read(const std::filesystem::path& filepath, std::shared_ptr<std::vector<uint8_t>> buffer)
+{
+	std::unique_ptr<Request> request(new Request());
+	request->write = false;
+	request->filepath = filepath;
+	request->buffer = std::move(buffer);
+	std::future<bool> future = request->read.get_future();
+	enqueue(std::move(request));
+	return future;
+}
+
+std::future<void> eleman::ElevationIOQueue::write(const std::filesystem::path& filepath, std::vector<uint8_t> buffer,
+												  std::function<void()> completion)
+{
+	std::unique_ptr<Request> request(new Request());
+	request->write = true;
+	request->filepath = filepath;
+	request->data = std::move(buffer);
+	request->completion = std::move(completion);
+	std::future<void> future = request->written.get_future();
+	enqueue(std::move(request));
+	return future;
+}
+
+eleman::ElevationIOQueue::Backend eleman::ElevationIOQueue::getBackend() const
+{
+	return backend;
+}
+
+uint32_t eleman::ElevationIOQueue::getDepth() const
+{
+	return depth;
+}
+
+uint64_t eleman::ElevationIOQueue::getSubmissions() const
+{
+	return submissions;
+}
+
+
+void eleman::ElevationIOQueue::enqueue(std::unique_ptr<Request> request)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(stopping)
+			throw std::runtime_error("[ElevationIOQueue] queue is shutting down");
+		pending.push_back(std::move(request));
+	}
+
+#ifdef ELEMAN_IO_URING
+	if(ring)
+	{
+		uint64_t one = 1;
+		if(::write(ring->event, &one, sizeof(one)) < 0)
+			throw std::runtime_error("[ElevationIOQueue] could not signal the ring: " + errorText(errno));
+	}
+#endif
+	// Also wakes the ring thread once it fell back to blocking IO
+	signal.notify_one();
+}
+
+void eleman::ElevationIOQueue::runWorker()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true)
+	{
+		signal.wait(lock, [this]() { return stopping || !pending.empty(); });
+		if(pending.empty()) return;
+
+		std::unique_ptr<Request> request = std::move(pending.front());
+		pending.pop_front();
+		lock.unlock();
+		process(*request);
+		lock.lock();
+	}
+}
+
+void eleman::ElevationIOQueue::process(Request& request)
+{
+	if(request.write)
+		request.fd = ::open(request.filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	else
+		request.fd = ::open(request.filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(request.fd < 0)
+	{
+		finish(request, errorText(errno));
+		return;
+	}
+
+	struct stat info;
+	if(!request.write && fstat(request.fd, &info) != 0)
+	{
+		finish(request, errorText(errno));
+		return;
+	}
+	request.size = request.write ? request.data.size() : size_t(info.st_size);
+	if(!request.write) request.buffer->resize(request.size);
+
+	while(request.done < request.size)
+	{
+		size_t chunk = std::min(request.size - request.done, CHUNK_SIZE);
+		ssize_t done = request.write ? pwrite(request.fd, request.data.data() + request.done, chunk, request.done)
+									 : pread(request.fd, request.buffer->data() + request.done, chunk, request.done);
+		if(done < 0 && errno == EINTR) continue;
+		if(done <= 0)
+		{
+			finish(request, done < 0 ? errorText(errno) : "unexpected end of file");
+			return;
+		}
+		request.done += done;
+	}
+	finish(request, "");
+}
+
+void eleman::ElevationIOQueue::finish(Request& request, const std::string& error)
+{
+	std::string message = error;
+	if(request.fd >= 0 && close(request.fd) != 0 && message.empty() && request.write)
+		message = errorText(errno);
+	request.fd = -1;
+
+	if(!request.write)
+	{
+		if(!message.empty()) request.buffer->clear();
+		request.read.set_value(message.empty());
+		return;
+	}
+
+	if(!message.empty())
+	{
+		request.written.set_exception(std::make_exception_ptr(
+			std::runtime_error("[ElevationIOQueue] could not write " + request.filepath.string() + ": " + message)));
+		return;
+	}
+
+	try
+	{
+		if(request.completion) request.completion();
+		request.written.set_value();
+	}
+	catch(...)
+	{
+		request.written.set_exception(std::current_exception());
+	}
+}
+
+
+#ifdef ELEMAN_IO_URING
+bool eleman::ElevationIOQueue::openRing()
+{
+	std::unique_ptr<Ring> ring(new Ring());
+
+	// One submission per request plus the poll of the event
+	io_uring_params params = {};
+	ring->fd = syscall(__NR_io_uring_setup, depth + 1, &params);
+	if(ring->fd < 0) return false;
+	ring->entries = params.sq_entries;
+
+	ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(single) ring->sqSize = ring->cqSize = std::max(ring->sqSize, ring->cqSize);
+
+	ring->sqMemory = mmap(nullptr, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sqMemory == MAP_FAILED) return false;
+	ring->cqMemory = single ? ring->sqMemory
+							: mmap(nullptr, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if(ring->cqMemory == MAP_FAILED) return false;
+	ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void* sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) return false;
+	ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+	uint8_t* sq = static_cast<uint8_t*>(ring->sqMemory);
+	uint8_t* cq = static_cast<uint8_t*>(ring->cqMemory);
+	ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	ring->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	ring->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	ring->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(ring->event < 0) return false;
+
+	// Rings may be larger than requested
+	depth = std::min(depth, ring->entries - 1);
+	ring->vectors.resize(depth);
+	ring->active.assign(depth, nullptr);
+	for(uint32_t slot = depth; slot > 0; slot--)
+		ring->freeSlots.push_back(slot - 1);
+
+	this->ring = std::move(ring);
+	return true;
+}
+
+void eleman::ElevationIOQueue::runRing()
+{
+	ring->poll();
+	while(true)
+	{
+		// Everything queued since the last round is submitted together
+		std::vector<std::unique_ptr<Request>> batch;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(stopping && pending.empty() && ring->inflight == 0) return;
+			while(!pending.empty() && ring->inflight < depth)
+			{
+				batch.push_back(std::move(pending.front()));
+				pending.pop_front();
+				ring->inflight++;
+			}
+		}
+
+		for(std::unique_ptr<Request>& request : batch)
+		{
+			Request* started = request.release();
+			if(!start(*started))
+			{
+				delete started;
+				ring->inflight--;
+			}
+		}
+
+		// Submits and waits for at least one completion, the poll completes when requests are queued
+		int entered = syscall(__NR_io_uring_enter, ring->fd, ring->prepared, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		if(entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			// Requests in flight fail, queued and later ones are done with blocking IO on this thread
+			std::string error = errorText(errno);
+			printf("IO queue failed, falling back to blocking IO: %s\n", error.c_str());
+			for(Request*& request : ring->active)
+			{
+				if(!request) continue;
+				finish(*request, error);
+				ring->abandoned.emplace_back(request);
+				request = nullptr;
+			}
+			ring->inflight = 0;
+			runWorker();
+			return;
+		}
+		if(entered > 0 && ring->prepared > 0)
+		{
+			ring->prepared -= std::min<uint32_t>(entered, ring->prepared);
+			submissions++;
+		}
+
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++)
+		{
+			io_uring_cqe cqe = ring->cqes[head & *ring->cqMask];
+			__atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+
+			if(cqe.user_data == 0)
+			{
+				uint64_t value;
+				while(::read(ring->event, &value, sizeof(value)) > 0) {}
+				ring->poll();
+				continue;
+			}
+			complete(*reinterpret_cast<Request*>(cqe.user_data), cqe.res);
+		}
+	}
+}
+
+bool eleman::ElevationIOQueue::start(Request& request)
+{
+	if(request.write)
+		request.fd = ::open(request.filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	else
+		request.fd = ::open(request.filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if(request.fd < 0)
+	{
+		finish(request, errorText(errno));
+		return false;
+	}
+
+	struct stat info;
+	if(!request.write && fstat(request.fd, &info) != 0)
+	{
+		finish(request, errorText(errno));
+		return false;
+	}
+	request.size = request.write ? request.data.size() : size_t(info.st_size);
+	if(!request.write) request.buffer->resize(request.size);
+	if(request.size == 0)
+	{
+		finish(request, "");
+		return false;
+	}
+
+	request.slot = ring->freeSlots.back();
+	ring->freeSlots.pop_back();
+	ring->active[request.slot] = &request;
+	submit(request);
+	return true;
+}
+
+void eleman::ElevationIOQueue::submit(Request& request)
+{
+	iovec& vector = ring->vectors[request.slot];
+	uint8_t* data = request.write ? request.data.data() : request.buffer->data();
+	vector.iov_base = data + request.done;
+	vector.iov_len = std::min(request.size - request.done, CHUNK_SIZE);
+
+	io_uring_sqe& sqe = ring->next();
+	sqe.opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe.fd = request.fd;
+	sqe.off = request.done;
+	sqe.addr = reinterpret_cast<uint64_t>(&vector);
+	sqe.len = 1;
+	sqe.user_data = reinterpret_cast<uint64_t>(&request);
+}
+
+void eleman::ElevationIOQueue::complete(Request& request, int result)
+{
+	if(result == -EINTR || result == -EAGAIN)
+	{
+		submit(request);
+		return;
+	}
+
+	if(result > 0)
+	{
+		request.done += result;
+		if(request.done < request.size)
+		{
+			submit(request);
+			return;
+		}
+	}
+
+	finish(request, result < 0 ? errorText(-result) : result == 0 ? "unexpected end of file" : "");
+	ring->freeSlots.push_back(request.slot);
+	ring->active[request.slot] = nullptr;
+	ring->inflight--;
+	delete &request;
+}
+#else
+bool eleman::ElevationIOQueue::openRing()
+{
+	return false;
+}
+
+void eleman::ElevationIOQueue::runRing() {}
+bool eleman::ElevationIOQueue::start(Request&) { return false; }
+void eleman::ElevationIOQueue::submit(Request&) {}
+void eleman::ElevationIOQueue::complete(Request&, int) {}
+#endif
@@ -0,0 +1,179 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationlazyregion.h"
+
+#include "eleman/elevationcache.h"
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+
+eleman::ElevationLazyRegion::ElevationLazyRegion(ElevationCache* cache, double lat0, double lon0, double lat1, double lon1, double precision,
+												 Interpolation interpolation, uint32_t tileSize)
+{
+	this->cache = cache;
+	this->interpolation = interpolation;
+	this->lat0 = lat0;
+	this->lon0 = lon0;
+	this->lat1 = lat1;
+	this->lon1 = lon1;
+
+	double referenceLatitude = std::min(std::abs(lat0), std::abs(lat1));
+	calculateGridSize(lat1-lat0, lon1-lon0,
+					  referenceLatitude, precision,
+					  sizeLat, sizeLon);
+
+	initialize(tileSize);
+}
+
+eleman::ElevationLazyRegion::ElevationLazyRegion(ElevationCache* cache, double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon,
+												 Interpolation interpolation, uint32_t tileSize)
+{
+	this->cache = cache;
+	this->interpolation = interpolation;
+	this->lat0 = lat0;
+	this->lon0 = lon0;
+	this->lat1 = lat1;
+	this->lon1 = lon1;
+	this->sizeLat = gridSizeLat;
+	this->sizeLon = gridSizeLon;
+
+	initialize(tileSize);
+}
+
+// The base grids are not copied, initialize() allocates them and only evaluated tiles are copied below
+eleman::ElevationLazyRegion::ElevationLazyRegion(const ElevationLazyRegion& region) : ElevationRegion()
+{
+	this->cache = region.cache;
+	this->interpolation = region.interpolation;
+	this->lat0 = region.lat0;
+	this->lon0 = region.lon0;
+	this->lat1 = region.lat1;
+	this->lon1 = region.lon1;
+	this->sizeLat = region.sizeLat;
+	this->sizeLon = region.sizeLon;
+
+	initialize(region.tileSize);
+
+	// Only evaluated tiles hold samples worth copying
+	for(uint32_t tileY = 0; tileY < tilesLat; tileY++)
+	{
+		for(uint32_t tileX = 0; tileX < tilesLon; tileX++)
+		{
+			if(!region.tiles[tileY * tilesLon + tileX]) continue;
+
+			uint32_t x = tileX * tileSize, y = tileY * tileSize;
+			uint32_t width = std::min(tileSize, sizeLon - x), height = std::min(tileSize, sizeLat - y);
+			elevationData->view(x, y, width, height).copy(region.elevationData->view(x, y, width, height));
+			tiles[tileY * tilesLon + tileX] = true;
+		}
+	}
+	evaluated = region.evaluated;
+}
+
+eleman::ElevationLazyRegion::~ElevationLazyRegion()
+{
+
+}
+
+void eleman::ElevationLazyRegion::initialize(uint32_t tileSize)
+{
+	if(tileSize == 0)
+		throw std::runtime_error("[ElevationLazyRegion] tile size has to be at least 1");
+	if(cache == nullptr)
+		throw std::runtime_error("[ElevationLazyRegion] no cache given");
+
+	this->tileSize = tileSize;
+	tilesLon = (sizeLon + tileSize - 1) / tileSize;
+	tilesLat = (sizeLat + tileSize - 1) / tileSize;
+	tiles.assign(size_t(tilesLon) * tilesLat, false);
+
+	// Left uninitialized on purpose, every tile is written completely before it is read
+	elevationData = std::make_shared<Grid<double>>(sizeLon, sizeLat);
+
+	printf("[ElevationLazyRegion] Creating lazy region %d %d with %d tiles\n", sizeLat, sizeLon, tilesTotal());
+}
+
+
+double eleman::ElevationLazyRegion::getGrid(uint32_t x, uint32_t y) const
+{
+	uint32_t tileX = x / tileSize, tileY = y / tileSize;
+	if(!tiles[tileY * tilesLon + tileX])
+		evaluateTile(tileX, tileY);
+	return elevationData->get(x, y);
+}
+
+void eleman::ElevationLazyRegion::setGrid(uint32_t x, uint32_t y, double value)
+{
+	// Evaluating the tile later on would overwrite the value
+	evaluate(x, y, x, y);
+	ElevationRegion::setGrid(x, y, value);
+}
+
+void eleman::ElevationLazyRegion::evaluateAll()
+{
+	evaluate(0, 0, sizeLon - 1, sizeLat - 1);
+}
+
+bool eleman::ElevationLazyRegion::isEvaluated(uint32_t x, uint32_t y) const
+{
+	return tiles[(y / tileSize) * tilesLon + x / tileSize];
+}
+
+uint32_t eleman::ElevationLazyRegion::tilesEvaluated() const
+{
+	return evaluated;
+}
+
+uint32_t eleman::ElevationLazyRegion::tilesTotal() const
+{
+	return tilesLon * tilesLat;
+}
+
+uint32_t eleman::ElevationLazyRegion::getTileSize() const
+{
+	return tileSize;
+}
+
+
+void eleman::ElevationLazyRegion::evaluate(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	if(sizeLon == 0 || sizeLat == 0 || evaluated == tilesTotal()) return;
+
+	uint32_t tileX1 = std::min(x1, sizeLon - 1) / tileSize;
+	uint32_t tileY1 = std::min(y1, sizeLat - 1) / tileSize;
+	for(uint32_t tileY = y0 / tileSize; tileY <= tileY1; tileY++)
+	{
+		for(uint32_t tileX = x0 / tileSize; tileX <= tileX1; tileX++)
+		{
+			if(!tiles[tileY * tilesLon + tileX])
+				evaluateTile(tileX, tileY);
+		}
+	}
+}
+
+void eleman::ElevationLazyRegion::evaluateTile(uint32_t tileX, uint32_t tileY) const
+{
+	uint32_t x0 = tileX * tileSize, y0 = tileY * tileSize;
+	uint32_t width = std::min(tileSize, sizeLon - x0), height = std::min(tileSize, sizeLat - y0);
+
+	size_t count = size_t(width) * height;
+	latitudes.resize(count);
+	longitudes.resize(count);
+	elevations.resize(count);
+	for(uint32_t y = 0; y < height; y++)
+	{
+		for(uint32_t x = 0; x < width; x++)
+			gridToPos(y0 + y, x0 + x, latitudes[y * width + x], longitudes[y * width + x]);
+	}
+
+	cache->get(latitudes.data(), longitudes.data(), count, elevations.data(), nullptr, interpolation);
+
+	for(uint32_t y = 0; y < height; y++)
+		std::copy_n(elevations.data() + y * width, width, elevationData->row(y0 + y) + x0);
+
+	tiles[tileY * tilesLon + tileX] = true;
+	evaluated++;
+}
@@ -111,6 +111,24 @@ std::vector<eleman::ElevationData> eleman::ElevationManager::get(const std::vect
 	return cache->get(positions, interpolation);
 }
 
+void eleman::ElevationManager::get(const double* latitude, const double* longitude, size_t count, double* elevation, uint8_t* status,
+								   ElevationRegion::Interpolation interpolation)
+{
+	if(cache == nullptr)
+		throw std::runtime_error("No cache is set!");
+
+	cache->get(latitude, longitude, count, elevation, status, interpolation);
+}
+
+void eleman::ElevationManager::get(const double* latitude, const double* longitude, size_t count, float* elevation, uint8_t* status,
+								   ElevationRegion::Interpolation interpolation)
+{
+	if(cache == nullptr)
+		throw std::runtime_error("No cache is set!");
+
+	cache->get(latitude, longitude, count, elevation, status, interpolation);
+}
+
 eleman::ElevationRegion eleman::ElevationManager::get(double lat0, double lon0, double lat1, double lon1, double precision, ElevationRegion::Interpolation interpolation)
 {
 	if(cache == nullptr)
@@ -127,6 +145,31 @@ eleman::ElevationRegion eleman::ElevationManager::get(double lat0, double lon0,
 	return cache->get(lat0, lon0, lat1, lon1, gridSizeLat, gridSizeLon, interpolation);
 }
 
+eleman::ElevationLazyRegion eleman::ElevationManager::getLazy(double lat0, double lon0, double lat1, double lon1, double precision, ElevationRegion::Interpolation interpolation)
+{
+	if(cache == nullptr)
+		throw std::runtime_error("No cache is set!");
+
+	return ElevationLazyRegion(cache, lat0, lon0, lat1, lon1, precision, interpolation);
+}
+
+eleman::ElevationLazyRegion eleman::ElevationManager::getLazy(double lat0, double lon0, double lat1, double lon1, uint32_t gridSizeLat, uint32_t gridSizeLon, ElevationRegion::Interpolation interpolation)
+{
+	if(cache == nullptr)
+		throw std::runtime_error("No cache is set!");
+
+	return ElevationLazyRegion(cache, lat0, lon0, lat1, lon1, gridSizeLat, gridSizeLon, interpolation);
+}
+
+
+eleman::ElevationProfile eleman::ElevationManager::profile(const std::vector<Position>& polyline, double spacing, bool climb)
+{
+	if(cache == nullptr)
+		throw std::runtime_error("No cache is set!");
+
+	return cache->profile(polyline, spacing, climb);
+}
+
 
 uint32_t eleman::ElevationManager::getTotalRequests()
 {
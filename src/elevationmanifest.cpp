@@ -0,0 +1,243 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationmanifest.h"
+
+#include "eleman/elevationutils.h"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+	// Manifest file: header, then records in the order they were written, later records replace earlier ones and
+	// records without samples remove a cell. Rewritten with one record per cell once most records are replaced.
+	// Host byte order, which is little endian on all supported platforms.
+	const char MANIFEST_MAGIC[4] = {'E', 'D', 'M', '\0'};
+	// Version 1 had no access times, those manifests are rebuilt
+	const uint16_t MANIFEST_VERSION = 2;
+	const char* MANIFEST_FILENAME = "manifest.edm";
+
+	struct ManifestHeader
+	{
+		char magic[4];
+		uint16_t version;
+		uint16_t reserved;
+		uint64_t reserved2;
+	};
+	static_assert(sizeof(ManifestHeader) == 16, "Manifest header has to stay 16 bytes");
+
+	struct ManifestRecord
+	{
+		uint64_t cellID;
+		uint64_t known;
+		uint64_t samples;
+		uint64_t bytes;
+		int64_t accessed;
+		uint64_t checksum;		// Checksum of the fields before
+	};
+	static_assert(sizeof(ManifestRecord) == 48, "Manifest record has to stay 48 bytes");
+
+	ManifestRecord makeRecord(uint64_t cellID, const eleman::ManifestEntry& entry)
+	{
+		ManifestRecord record = {cellID, entry.known, entry.samples, entry.bytes, entry.accessed, 0};
+		record.checksum = eleman::checksum(&record, offsetof(ManifestRecord, checksum));
+		return record;
+	}
+}
+
+eleman::ElevationManifest::ElevationManifest(const std::filesystem::path& directory)
+{
+	this->directory = directory;
+	this->filepath = directory / MANIFEST_FILENAME;
+	read();
+}
+
+
+bool eleman::ElevationManifest::contains(uint64_t cellID) const
+{
+	return entries.find(cellID) != entries.end();
+}
+
+bool eleman::ElevationManifest::get(uint64_t cellID, ManifestEntry& entry) const
+{
+	auto it = entries.find(cellID);
+	if(it == entries.end()) return false;
+
+	entry = it->second;
+	return true;
+}
+
+void eleman::ElevationManifest::set(uint64_t cellID, const ManifestEntry& entry)
+{
+	ManifestEntry& stored = entries[cellID];
+	bytes += entry.bytes - stored.bytes;
+	stored = entry;
+	append(cellID, entry);
+}
+
+void eleman::ElevationManifest::remove(uint64_t cellID)
+{
+	auto it = entries.find(cellID);
+	if(it == entries.end()) return;
+
+	bytes -= it->second.bytes;
+	entries.erase(it);
+	append(cellID, ManifestEntry());
+}
+
+void eleman::ElevationManifest::touch(uint64_t cellID, int64_t time, int64_t resolution)
+{
+	auto it = entries.find(cellID);
+	if(it == entries.end() || time - it->second.accessed < resolution) return;
+
+	it->second.accessed = time;
+	append(cellID, it->second);
+}
+
+void eleman::ElevationManifest::reset(const std::map<uint64_t, ManifestEntry>& entries)
+{
+	this->entries = entries;
+	bytes = 0;
+	for(const auto& entry : entries)
+		bytes += entry.second.bytes;
+	rewrite();
+	stale = false;
+}
+
+
+const std::map<uint64_t, eleman::ManifestEntry>& eleman::ElevationManifest::getEntries() const
+{
+	return entries;
+}
+
+const std::filesystem::path& eleman::ElevationManifest::getDirectory() const
+{
+	return directory;
+}
+
+uint64_t eleman::ElevationManifest::getBytes() const
+{
+	return bytes;
+}
+
+bool eleman::ElevationManifest::isStale() const
+{
+	return stale;
+}
+
+
+void eleman::ElevationManifest::read()
+{
+	std::error_code error;
+	if(!std::filesystem::is_directory(directory, error)) return;
+
+	// Every change of the cell files is followed by a manifest write, a newer directory was changed by someone else
+	std::filesystem::file_time_type written = std::filesystem::last_write_time(filepath, error);
+	if(error || std::filesystem::last_write_time(directory) > written)
+	{
+		stale = true;
+		return;
+	}
+
+	size_t size = std::filesystem::file_size(filepath);
+	std::vector<uint8_t> buffer(size);
+	std::ifstream file(filepath, std::ios::binary);
+	file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+	ManifestHeader header;
+	if(!file || size < sizeof(header))
+	{
+		stale = true;
+		return;
+	}
+	memcpy(&header, buffer.data(), sizeof(header));
+	if(memcmp(header.magic, MANIFEST_MAGIC, sizeof(header.magic)) != 0 || header.version != MANIFEST_VERSION)
+	{
+		stale = true;
+		return;
+	}
+
+	size_t position = sizeof(header);
+	for(; position + sizeof(ManifestRecord) <= size; position += sizeof(ManifestRecord), records++)
+	{
+		ManifestRecord record;
+		memcpy(&record, buffer.data() + position, sizeof(record));
+		if(checksum(&record, offsetof(ManifestRecord, checksum)) != record.checksum) break;
+
+		if(record.samples == 0)
+			entries.erase(record.cellID);
+		else
+			entries[record.cellID] = {record.known, record.samples, record.bytes, record.accessed};
+	}
+
+	for(const auto& entry : entries)
+		bytes += entry.second.bytes;
+
+	// Appends continue behind the last intact record
+	if(position < size)
+	{
+		printf("Manifest %s is torn after %zu bytes, truncating it\n", filepath.c_str(), position);
+		std::filesystem::resize_file(filepath, position);
+	}
+}
+
+void eleman::ElevationManifest::append(uint64_t cellID, const ManifestEntry& entry)
+{
+	// Mostly replaced records
+	if(records >= 2 * entries.size() + 64)
+	{
+		rewrite();
+		return;
+	}
+
+	if(records == 0 && !std::filesystem::exists(filepath))
+	{
+		rewrite();
+		return;
+	}
+
+	ManifestRecord record = makeRecord(cellID, entry);
+	std::ofstream file(filepath, std::ios::binary | std::ios::app);
+	file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+	file.close();
+	if(!file)
+		throw std::runtime_error("[ElevationManifest] could not write " + filepath.string());
+	records++;
+}
+
+void eleman::ElevationManifest::rewrite()
+{
+	std::filesystem::create_directories(directory);
+
+	std::vector<uint8_t> buffer(sizeof(ManifestHeader) + entries.size() * sizeof(ManifestRecord));
+	ManifestHeader header = {};
+	memcpy(header.magic, MANIFEST_MAGIC, sizeof(header.magic));
+	header.version = MANIFEST_VERSION;
+	memcpy(buffer.data(), &header, sizeof(header));
+
+	uint8_t* target = buffer.data() + sizeof(header);
+	for(const auto& entry : entries)
+	{
+		ManifestRecord record = makeRecord(entry.first, entry.second);
+		memcpy(target, &record, sizeof(record));
+		target += sizeof(record);
+	}
+
+	std::filesystem::path temporary = filepath;
+	temporary += ".tmp";
+	std::ofstream file(temporary, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	file.close();
+	if(!file)
+		throw std::runtime_error("[ElevationManifest] could not write " + temporary.string());
+	std::filesystem::rename(temporary, filepath);
+
+	// Renaming touched the directory, the manifest has to stay the newer one
+	std::filesystem::last_write_time(filepath, std::filesystem::file_time_type::clock::now());
+	records = entries.size();
+}
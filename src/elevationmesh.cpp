@@ -0,0 +1,441 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationmesh.h"
+
+#include "eleman/elevationmanager.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+// Output is flushed to the file in blocks of this size
+static const size_t BUFFER_SIZE = 1 << 20;
+
+
+eleman::ElevationMesh::ElevationMesh(const ElevationRegion& region, double maxError, double scale, bool centerHorizontal, bool centerVertical)
+{
+	const Grid<double>& grid = region.getElevationData();
+	uint32_t width = grid.getWidth();
+	uint32_t height = grid.getHeight();
+
+	std::vector<uint32_t> samples;
+	if(maxError < 0.0)
+		buildFull(grid, samples);
+	else
+		buildRTIN(grid, maxError, samples);
+
+	// Spacing of the row closest to the equator
+	double metersLon, metersLat;
+	region.gridSpacing(std::abs(region.getLat0()) <= std::abs(region.getLat1()) ? 0 : height - 1, metersLon, metersLat);
+
+	// Values for moving output
+	double centerX = 0.0;
+	double centerY = 0.0;
+	double elevationOffset = 0.0;
+
+	if(centerHorizontal)
+	{
+		centerX = metersLon * (width - 1.0) / 2.0;
+		centerY = metersLat * (height - 1.0) / 2.0;
+	}
+
+	if(centerVertical)
+	{
+		double avg = (region.minElevation() + region.maxElevation()) / 2.0;
+		if(!std::isnan(avg)) elevationOffset = -avg;
+	}
+
+	positions.resize(samples.size() * 3);
+	uvs.resize(samples.size() * 2);
+	for(size_t i = 0; i < samples.size(); i++)
+	{
+		uint32_t x = samples[i] % width;
+		uint32_t y = samples[i] / width;
+
+		positions[i * 3 + 0] = scale * (x * metersLon - centerX);
+		positions[i * 3 + 1] = scale * (y * metersLat - centerY);
+		positions[i * 3 + 2] = scale * (grid.get(x, y) + elevationOffset);
+
+		uvs[i * 2 + 0] = width  > 1 ? x / (width  - 1.0) : 0.0;
+		uvs[i * 2 + 1] = height > 1 ? y / (height - 1.0) : 0.0;
+	}
+}
+
+eleman::ElevationMesh::~ElevationMesh()
+{
+
+}
+
+// Blender: Import OBJ Up-Axis Z, Forward-Axis Y
+bool eleman::ElevationMesh::writeOBJ(const std::string& filepath) const
+{
+	std::ofstream file(filepath);
+	if(!file) return false;
+
+	std::string buffer;
+	buffer.reserve(BUFFER_SIZE + 256);
+	auto flush = [&](bool force) {
+		if(!force && buffer.size() < BUFFER_SIZE) return;
+		file.write(buffer.data(), buffer.size());
+		buffer.clear();
+	};
+
+	char line[256];
+	buffer += "# EleMan v" + VERSION_STRING + "\n";
+
+	for(size_t i = 0; i < vertexCount(); i++)
+	{
+		snprintf(line, sizeof(line), "v %g %g %g\n", positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+		buffer += line;
+		flush(false);
+	}
+
+	for(size_t i = 0; i < vertexCount(); i++)
+	{
+		snprintf(line, sizeof(line), "vt %g %g\n", uvs[i * 2], uvs[i * 2 + 1]);
+		buffer += line;
+		flush(false);
+	}
+
+	// OBJ indices start at 1
+	for(size_t i = 0; i < triangleCount(); i++)
+	{
+		uint32_t a = indices[i * 3] + 1;
+		uint32_t b = indices[i * 3 + 1] + 1;
+		uint32_t c = indices[i * 3 + 2] + 1;
+		snprintf(line, sizeof(line), "f %u/%u %u/%u %u/%u\n", a, a, b, b, c, c);
+		buffer += line;
+		flush(false);
+	}
+
+	flush(true);
+	return file.good();
+}
+
+// Binary data is written in host byte order, which is little endian on all supported platforms
+bool eleman::ElevationMesh::writePLY(const std::string& filepath) const
+{
+	std::ofstream file(filepath, std::ios::binary);
+	if(!file) return false;
+
+	std::string header;
+	header += "ply\n";
+	header += "format binary_little_endian 1.0\n";
+	header += "comment EleMan v" + VERSION_STRING + "\n";
+	header += "element vertex " + std::to_string(vertexCount()) + "\n";
+	header += "property float x\n";
+	header += "property float y\n";
+	header += "property float z\n";
+	header += "property float s\n";
+	header += "property float t\n";
+	header += "element face " + std::to_string(triangleCount()) + "\n";
+	header += "property list uchar uint vertex_indices\n";
+	header += "end_header\n";
+	file.write(header.data(), header.size());
+
+	// Vertices are interleaved, faces are prefixed with their vertex count
+	std::vector<char> buffer;
+	buffer.reserve(BUFFER_SIZE + 32);
+	auto flush = [&](bool force) {
+		if(!force && buffer.size() < BUFFER_SIZE) return;
+		file.write(buffer.data(), buffer.size());
+		buffer.clear();
+	};
+	auto append = [&](const void* data, size_t size) {
+		const char* bytes = static_cast<const char*>(data);
+		buffer.insert(buffer.end(), bytes, bytes + size);
+	};
+
+	for(size_t i = 0; i < vertexCount(); i++)
+	{
+		append(&positions[i * 3], 3 * sizeof(float));
+		append(&uvs[i * 2], 2 * sizeof(float));
+		flush(false);
+	}
+
+	const uint8_t count = 3;
+	for(size_t i = 0; i < triangleCount(); i++)
+	{
+		append(&count, sizeof(count));
+		append(&indices[i * 3], 3 * sizeof(uint32_t));
+		flush(false);
+	}
+
+	flush(true);
+	return file.good();
+}
+
+bool eleman::ElevationMesh::writeGLB(const std::string& filepath) const
+{
+	std::ofstream file(filepath, std::ios::binary);
+	if(!file) return false;
+
+	// glTF is Y-up, rotate so that north points towards -Z
+	std::vector<float> rotated(positions.size());
+	float min[3] = {INFINITY, INFINITY, INFINITY};
+	float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for(size_t i = 0; i < vertexCount(); i++)
+	{
+		rotated[i * 3 + 0] = positions[i * 3 + 0];
+		rotated[i * 3 + 1] = positions[i * 3 + 2];
+		rotated[i * 3 + 2] = -positions[i * 3 + 1];
+		for(uint8_t axis = 0; axis < 3; axis++)
+		{
+			min[axis] = std::min(min[axis], rotated[i * 3 + axis]);
+			max[axis] = std::max(max[axis], rotated[i * 3 + axis]);
+		}
+	}
+
+	uint32_t positionBytes = rotated.size() * sizeof(float);
+	uint32_t uvBytes = uvs.size() * sizeof(float);
+	uint32_t indexBytes = indices.size() * sizeof(uint32_t);
+
+	nlohmann::json gltf;
+	gltf["asset"]["version"] = "2.0";
+	gltf["asset"]["generator"] = "EleMan v" + VERSION_STRING;
+	gltf["scene"] = 0;
+	gltf["scenes"][0]["nodes"] = {0};
+	gltf["nodes"][0]["mesh"] = 0;
+	gltf["meshes"][0]["primitives"][0]["attributes"]["POSITION"] = 0;
+	gltf["meshes"][0]["primitives"][0]["attributes"]["TEXCOORD_0"] = 1;
+	gltf["meshes"][0]["primitives"][0]["indices"] = 2;
+	gltf["meshes"][0]["primitives"][0]["mode"] = 4;	// TRIANGLES
+	gltf["buffers"][0]["byteLength"] = positionBytes + uvBytes + indexBytes;
+	gltf["bufferViews"][0] = {{"buffer", 0}, {"byteOffset", 0}, {"byteLength", positionBytes}, {"target", 34962}};
+	gltf["bufferViews"][1] = {{"buffer", 0}, {"byteOffset", positionBytes}, {"byteLength", uvBytes}, {"target", 34962}};
+	gltf["bufferViews"][2] = {{"buffer", 0}, {"byteOffset", positionBytes + uvBytes}, {"byteLength", indexBytes}, {"target", 34963}};
+	gltf["accessors"][0] = {{"bufferView", 0}, {"componentType", 5126}, {"count", vertexCount()}, {"type", "VEC3"},
+							{"min", {min[0], min[1], min[2]}}, {"max", {max[0], max[1], max[2]}}};
+	gltf["accessors"][1] = {{"bufferView", 1}, {"componentType", 5126}, {"count", vertexCount()}, {"type", "VEC2"}};
+	gltf["accessors"][2] = {{"bufferView", 2}, {"componentType", 5125}, {"count", indices.size()}, {"type", "SCALAR"}};
+
+	// Chunks have to be aligned to 4 bytes
+	std::string json = gltf.dump();
+	json.resize((json.size() + 3) / 4 * 4, ' ');
+	uint32_t binaryLength = (positionBytes + uvBytes + indexBytes + 3) / 4 * 4;
+
+	uint32_t header[3] = {0x46546C67, 2, uint32_t(12 + 8 + json.size() + 8 + binaryLength)};
+	uint32_t jsonChunk[2] = {uint32_t(json.size()), 0x4E4F534A};
+	uint32_t binaryChunk[2] = {binaryLength, 0x004E4942};
+
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(jsonChunk), sizeof(jsonChunk));
+	file.write(json.data(), json.size());
+	file.write(reinterpret_cast<const char*>(binaryChunk), sizeof(binaryChunk));
+	file.write(reinterpret_cast<const char*>(rotated.data()), positionBytes);
+	file.write(reinterpret_cast<const char*>(uvs.data()), uvBytes);
+	file.write(reinterpret_cast<const char*>(indices.data()), indexBytes);
+	const char padding[4] = {0, 0, 0, 0};
+	file.write(padding, binaryLength - (positionBytes + uvBytes + indexBytes));
+
+	return file.good();
+}
+
+
+void eleman::ElevationMesh::buildFull(const Grid<double>& grid, std::vector<uint32_t>& samples)
+{
+	uint32_t width = grid.getWidth();
+	uint32_t height = grid.getHeight();
+
+	samples.resize(size_t(width) * height);
+	for(uint32_t i = 0; i < samples.size(); i++)
+		samples[i] = i;
+
+	// Two counter clockwise triangles per quad
+	indices.reserve(size_t(width - 1) * (height - 1) * 6);
+	for(uint32_t y = 0; y + 1 < height; y++)
+	{
+		for(uint32_t x = 0; x + 1 < width; x++)
+		{
+			uint32_t index0 = y * width + x;
+			uint32_t index1 = index0 + 1;
+			uint32_t index2 = index1 + width;
+			uint32_t index3 = index0 + width;
+			indices.insert(indices.end(), {index0, index1, index2, index0, index2, index3});
+		}
+	}
+}
+
+namespace
+{
+	// State of the RTIN mesh extraction
+	struct RTIN {
+		uint32_t size;					// Side length of the square RTIN grid (2^k + 1)
+		uint32_t width, height;			// Size of the actual elevation grid
+		double maxError;
+		std::vector<float> errors;
+		std::vector<uint32_t> vertices;	// Vertex index + 1 per elevation sample
+		std::vector<uint32_t>* samples;
+		std::vector<uint32_t>* indices;
+	};
+
+	// Largest vertical distance between the triangle's plane and the samples it covers
+	float triangleError(const std::vector<float>& terrain, uint32_t size,
+						uint32_t ax, uint32_t ay, uint32_t bx, uint32_t by, uint32_t cx, uint32_t cy)
+	{
+		auto edge = [](int64_t px, int64_t py, int64_t qx, int64_t qy, int64_t rx, int64_t ry)
+		{
+			return (qx - px) * (ry - py) - (qy - py) * (rx - px);
+		};
+		int64_t area = edge(ax, ay, bx, by, cx, cy);
+		if(area == 0) return 0.0f;
+
+		double za = terrain[size_t(ay) * size + ax];
+		double zb = terrain[size_t(by) * size + bx];
+		double zc = terrain[size_t(cy) * size + cx];
+		float error = 0.0f;
+		for(uint32_t y = std::min({ay, by, cy}); y <= std::max({ay, by, cy}); y++)
+		{
+			for(uint32_t x = std::min({ax, bx, cx}); x <= std::max({ax, bx, cx}); x++)
+			{
+				// Barycentric weights, all share the sign of the area inside the triangle
+				int64_t wa = edge(bx, by, cx, cy, x, y);
+				int64_t wb = edge(cx, cy, ax, ay, x, y);
+				int64_t wc = edge(ax, ay, bx, by, x, y);
+				if(area > 0 ? (wa < 0 || wb < 0 || wc < 0) : (wa > 0 || wb > 0 || wc > 0)) continue;
+
+				double plane = (wa * za + wb * zb + wc * zc) / area;
+				error = std::max(error, float(std::abs(plane - terrain[size_t(y) * size + x])));
+			}
+		}
+		return error;
+	}
+
+	uint32_t vertex(RTIN& rtin, uint32_t x, uint32_t y)
+	{
+		uint32_t sample = y * rtin.width + x;
+		if(rtin.vertices[sample] == 0)
+		{
+			rtin.samples->push_back(sample);
+			rtin.vertices[sample] = rtin.samples->size();
+		}
+		return rtin.vertices[sample] - 1;
+	}
+
+	void emit(RTIN& rtin, uint32_t ax, uint32_t ay, uint32_t bx, uint32_t by, uint32_t cx, uint32_t cy)
+	{
+		// The RTIN grid is padded beyond the elevation grid, clamp into it
+		ax = std::min(ax, rtin.width - 1);
+		bx = std::min(bx, rtin.width - 1);
+		cx = std::min(cx, rtin.width - 1);
+		ay = std::min(ay, rtin.height - 1);
+		by = std::min(by, rtin.height - 1);
+		cy = std::min(cy, rtin.height - 1);
+
+		// Triangles squeezed onto the border vanish, the rest is made counter clockwise
+		int64_t cross = (int64_t(bx) - ax) * (int64_t(cy) - ay) - (int64_t(by) - ay) * (int64_t(cx) - ax);
+		if(cross == 0) return;
+		if(cross < 0)
+		{
+			std::swap(bx, cx);
+			std::swap(by, cy);
+		}
+
+		uint32_t a = vertex(rtin, ax, ay);
+		uint32_t b = vertex(rtin, bx, by);
+		uint32_t c = vertex(rtin, cx, cy);
+		rtin.indices->insert(rtin.indices->end(), {a, b, c});
+	}
+
+	void process(RTIN& rtin, uint32_t ax, uint32_t ay, uint32_t bx, uint32_t by, uint32_t cx, uint32_t cy)
+	{
+		uint32_t mx = (ax + bx) >> 1;
+		uint32_t my = (ay + by) >> 1;
+		uint32_t legLength = (ax > cx ? ax - cx : cx - ax) + (ay > cy ? ay - cy : cy - ay);
+
+		if(legLength > 1 && rtin.errors[size_t(my) * rtin.size + mx] > rtin.maxError)
+		{
+			process(rtin, cx, cy, ax, ay, mx, my);
+			process(rtin, bx, by, cx, cy, mx, my);
+		}
+		else
+		{
+			emit(rtin, ax, ay, bx, by, cx, cy);
+		}
+	}
+}
+
+// Right-triangulated irregular network (Evans, Kirkpatrick and Townsend), following the MARTINI implementation
+void eleman::ElevationMesh::buildRTIN(const Grid<double>& grid, double maxError, std::vector<uint32_t>& samples)
+{
+	RTIN rtin;
+	rtin.width = grid.getWidth();
+	rtin.height = grid.getHeight();
+	rtin.maxError = maxError;
+	rtin.samples = &samples;
+	rtin.indices = &indices;
+	rtin.vertices.assign(size_t(rtin.width) * rtin.height, 0);
+
+	uint32_t tileSize = 2;
+	while(tileSize + 1 < std::max(rtin.width, rtin.height))
+		tileSize *= 2;
+	rtin.size = tileSize + 1;
+
+	// Heights of the padded grid, samples outside repeat the border
+	size_t area = size_t(rtin.size) * rtin.size;
+	std::vector<float> terrain(area);
+	for(uint32_t y = 0; y < rtin.size; y++)
+	{
+		for(uint32_t x = 0; x < rtin.size; x++)
+			terrain[size_t(y) * rtin.size + x] = grid.get(std::min(x, rtin.width - 1), std::min(y, rtin.height - 1));
+	}
+
+	// Approximation error of every triangle, stored at its midpoint which it shares with the neighbour across the
+	// hypotenuse. Children come before their parents and pass their errors up, so both neighbours split together.
+	rtin.errors.assign(area, 0.0f);
+	uint64_t numTriangles = uint64_t(tileSize) * tileSize * 2 - 2;
+	uint64_t numParentTriangles = numTriangles - uint64_t(tileSize) * tileSize;
+	for(uint64_t i = numTriangles; i-- > 0;)
+	{
+		// Decode the triangle coordinates from its implicit binary tree id
+		uint64_t id = i + 2;
+		uint32_t ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+		if(id & 1)
+		{
+			bx = by = cx = tileSize;
+		}
+		else
+		{
+			ax = ay = cy = tileSize;
+		}
+		while((id >>= 1) > 1)
+		{
+			uint32_t mx = (ax + bx) >> 1;
+			uint32_t my = (ay + by) >> 1;
+			if(id & 1)
+			{
+				bx = ax; by = ay;
+				ax = cx; ay = cy;
+			}
+			else
+			{
+				ax = bx; ay = by;
+				bx = cx; by = cy;
+			}
+			cx = mx;
+			cy = my;
+		}
+
+		// Smallest triangles cover no samples besides their corners
+		size_t middle = size_t((ay + by) >> 1) * rtin.size + ((ax + bx) >> 1);
+		float error = rtin.errors[middle];
+		if(i < numParentTriangles)
+			error = std::max(error, triangleError(terrain, rtin.size, ax, ay, bx, by, cx, cy));
+		else
+			error = std::max(error, std::abs((terrain[size_t(ay) * rtin.size + ax] + terrain[size_t(by) * rtin.size + bx]) / 2.0f
+											 - terrain[middle]));
+
+		if(i < numParentTriangles)
+		{
+			size_t left = size_t((ay + cy) >> 1) * rtin.size + ((ax + cx) >> 1);
+			size_t right = size_t((by + cy) >> 1) * rtin.size + ((bx + cx) >> 1);
+			error = std::max({error, rtin.errors[left], rtin.errors[right]});
+		}
+		rtin.errors[middle] = error;
+	}
+
+	process(rtin, 0, 0, tileSize, tileSize, tileSize, 0);
+	process(rtin, tileSize, tileSize, 0, 0, 0, tileSize);
+}
@@ -0,0 +1,248 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationpyramid.h"
+
+#include <cmath>
+#include <limits>
+
+
+eleman::ElevationPyramid::ElevationPyramid(std::shared_ptr<const Grid<double>> grid)
+{
+	this->grid = grid;
+	build();
+}
+
+eleman::ElevationPyramid::~ElevationPyramid()
+{
+
+}
+
+void eleman::ElevationPyramid::build()
+{
+	minLevels.clear();
+	maxLevels.clear();
+	sumLevels.clear();
+	countLevels.clear();
+
+	uint32_t width = grid->getWidth();
+	uint32_t height = grid->getHeight();
+	uint8_t level = 0;
+	while(width > 1 || height > 1)
+	{
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		level++;
+
+		minLevels.emplace_back(width, height);
+		maxLevels.emplace_back(width, height);
+		sumLevels.emplace_back(width, height);
+		countLevels.emplace_back(width, height);
+
+		for(uint32_t y = 0; y < height; y++)
+		{
+			for(uint32_t x = 0; x < width; x++)
+			{
+				reduce(level, x, y);
+			}
+		}
+	}
+}
+
+void eleman::ElevationPyramid::update(uint32_t x, uint32_t y)
+{
+	for(uint8_t level = 1; level <= getLevels(); level++)
+	{
+		x >>= 1;
+		y >>= 1;
+		reduce(level, x, y);
+	}
+}
+
+double eleman::ElevationPyramid::min() const
+{
+	double value = nodeMin(getLevels(), 0, 0);
+	return std::isinf(value) ? NAN : value;
+}
+
+double eleman::ElevationPyramid::max() const
+{
+	double value = nodeMax(getLevels(), 0, 0);
+	return std::isinf(value) ? NAN : value;
+}
+
+static eleman::ElevationPyramid::Classifier boxClassifier(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+{
+	return [=](uint32_t rx0, uint32_t ry0, uint32_t rx1, uint32_t ry1)
+	{
+		if(rx1 < x0 || rx0 > x1 || ry1 < y0 || ry0 > y1)
+			return eleman::ElevationPyramid::OUTSIDE;
+		if(rx0 >= x0 && rx1 <= x1 && ry0 >= y0 && ry1 <= y1)
+			return eleman::ElevationPyramid::INSIDE;
+		return eleman::ElevationPyramid::PARTIAL;
+	};
+}
+
+double eleman::ElevationPyramid::min(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	return min(boxClassifier(x0, y0, x1, y1));
+}
+
+double eleman::ElevationPyramid::max(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	return max(boxClassifier(x0, y0, x1, y1));
+}
+
+double eleman::ElevationPyramid::min(const Classifier& classifier) const
+{
+	double best = -std::numeric_limits<double>::infinity();
+	query(false, getLevels(), 0, 0, classifier, best);
+	return std::isinf(best) ? NAN : -best;
+}
+
+double eleman::ElevationPyramid::max(const Classifier& classifier) const
+{
+	double best = -std::numeric_limits<double>::infinity();
+	query(true, getLevels(), 0, 0, classifier, best);
+	return std::isinf(best) ? NAN : best;
+}
+
+void eleman::ElevationPyramid::sum(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, double& sum, uint64_t& count) const
+{
+	sum = 0.0;
+	count = 0;
+	querySum(getLevels(), 0, 0, x0, y0, x1, y1, sum, count);
+}
+
+uint8_t eleman::ElevationPyramid::getLevels() const
+{
+	return minLevels.size();
+}
+
+size_t eleman::ElevationPyramid::memory() const
+{
+	size_t memory = sizeof(ElevationPyramid);
+	for(uint8_t i = 0; i < minLevels.size(); i++)
+		memory += minLevels[i].memory() + maxLevels[i].memory() + sumLevels[i].memory() + countLevels[i].memory();
+	return memory;
+}
+
+
+void eleman::ElevationPyramid::reduce(uint8_t level, uint32_t x, uint32_t y)
+{
+	// Children of node x/y on the level below
+	uint32_t childWidth  = level > 1 ? minLevels[level - 2].getWidth()  : grid->getWidth();
+	uint32_t childHeight = level > 1 ? minLevels[level - 2].getHeight() : grid->getHeight();
+	uint32_t cx0 = x * 2;
+	uint32_t cy0 = y * 2;
+	uint32_t cx1 = std::min(cx0 + 1, childWidth - 1);
+	uint32_t cy1 = std::min(cy0 + 1, childHeight - 1);
+
+	double min = std::numeric_limits<double>::infinity();
+	double max = -std::numeric_limits<double>::infinity();
+	double sum = 0.0;
+	uint32_t count = 0;
+	for(uint32_t cy = cy0; cy <= cy1; cy++)
+	{
+		for(uint32_t cx = cx0; cx <= cx1; cx++)
+		{
+			min = std::min(min, nodeMin(level - 1, cx, cy));
+			max = std::max(max, nodeMax(level - 1, cx, cy));
+			sum += nodeSum(level - 1, cx, cy);
+			count += nodeCount(level - 1, cx, cy);
+		}
+	}
+	minLevels[level - 1].set(x, y, min);
+	maxLevels[level - 1].set(x, y, max);
+	sumLevels[level - 1].set(x, y, sum);
+	countLevels[level - 1].set(x, y, count);
+}
+
+double eleman::ElevationPyramid::nodeMin(uint8_t level, uint32_t x, uint32_t y) const
+{
+	if(level > 0) return minLevels[level - 1].get(x, y);
+
+	double value = grid->get(x, y);
+	return std::isnan(value) ? std::numeric_limits<double>::infinity() : value;
+}
+
+double eleman::ElevationPyramid::nodeMax(uint8_t level, uint32_t x, uint32_t y) const
+{
+	if(level > 0) return maxLevels[level - 1].get(x, y);
+
+	double value = grid->get(x, y);
+	return std::isnan(value) ? -std::numeric_limits<double>::infinity() : value;
+}
+
+double eleman::ElevationPyramid::nodeSum(uint8_t level, uint32_t x, uint32_t y) const
+{
+	if(level > 0) return sumLevels[level - 1].get(x, y);
+
+	double value = grid->get(x, y);
+	return std::isnan(value) ? 0.0 : value;
+}
+
+uint32_t eleman::ElevationPyramid::nodeCount(uint8_t level, uint32_t x, uint32_t y) const
+{
+	if(level > 0) return countLevels[level - 1].get(x, y);
+
+	return std::isnan(grid->get(x, y)) ? 0 : 1;
+}
+
+// Box only descent, sums are queried per output sample and a classifier call per node would dominate
+void eleman::ElevationPyramid::querySum(uint8_t level, uint32_t x, uint32_t y, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1,
+										double& sum, uint64_t& count) const
+{
+	uint32_t nx0 = x << level;
+	uint32_t ny0 = y << level;
+	uint32_t nx1 = std::min(((x + 1) << level) - 1, grid->getWidth() - 1);
+	uint32_t ny1 = std::min(((y + 1) << level) - 1, grid->getHeight() - 1);
+
+	if(nx1 < x0 || nx0 > x1 || ny1 < y0 || ny0 > y1) return;
+	if(nx0 >= x0 && nx1 <= x1 && ny0 >= y0 && ny1 <= y1)
+	{
+		sum += nodeSum(level, x, y);
+		count += nodeCount(level, x, y);
+		return;
+	}
+
+	uint32_t childWidth  = level > 1 ? minLevels[level - 2].getWidth()  : grid->getWidth();
+	uint32_t childHeight = level > 1 ? minLevels[level - 2].getHeight() : grid->getHeight();
+	for(uint32_t cy = y * 2; cy <= std::min(y * 2 + 1, childHeight - 1); cy++)
+	{
+		for(uint32_t cx = x * 2; cx <= std::min(x * 2 + 1, childWidth - 1); cx++)
+		{
+			querySum(level - 1, cx, cy, x0, y0, x1, y1, sum, count);
+		}
+	}
+}
+
+// Branch and bound descent, "best" is negated for minimum queries so both share the same comparisons
+void eleman::ElevationPyramid::query(bool maximum, uint8_t level, uint32_t x, uint32_t y, const Classifier& classifier, double& best) const
+{
+	double value = maximum ? nodeMax(level, x, y) : -nodeMin(level, x, y);
+	if(!(value > best)) return;		// Node can not improve the result (or contains no data)
+
+	uint32_t x0 = x << level;
+	uint32_t y0 = y << level;
+	uint32_t x1 = std::min(((x + 1) << level) - 1, grid->getWidth() - 1);
+	uint32_t y1 = std::min(((y + 1) << level) - 1, grid->getHeight() - 1);
+
+	Coverage coverage = classifier(x0, y0, x1, y1);
+	if(coverage == OUTSIDE) return;
+	if(coverage == INSIDE || level == 0)
+	{
+		best = value;
+		return;
+	}
+
+	uint32_t childWidth  = level > 1 ? minLevels[level - 2].getWidth()  : grid->getWidth();
+	uint32_t childHeight = level > 1 ? minLevels[level - 2].getHeight() : grid->getHeight();
+	for(uint32_t cy = y * 2; cy <= std::min(y * 2 + 1, childHeight - 1); cy++)
+	{
+		for(uint32_t cx = x * 2; cx <= std::min(x * 2 + 1, childWidth - 1); cx++)
+		{
+			query(maximum, level - 1, cx, cy, classifier, best);
+		}
+	}
+}
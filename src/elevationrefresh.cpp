@@ -0,0 +1,122 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationrefresh.h"
+
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+
+eleman::ElevationRefresher::ElevationRefresher(ElevationCache& cache, ElevationRegion& region,
+											   ElevationRegion::Interpolation interpolation, uint32_t tileSize)
+	: cache(cache), region(region), interpolation(interpolation), tileSize(tileSize)
+{
+	if(tileSize == 0)
+		throw std::runtime_error("[ElevationRefresher] tile size has to be at least 1");
+
+	tilesLon = (region.getGridSizeLon() + tileSize - 1) / tileSize;
+	tilesLat = (region.getGridSizeLat() + tileSize - 1) / tileSize;
+	stale.assign(size_t(tilesLon) * tilesLat, false);
+
+	listenerID = cache.addUpdateListener([this](const CacheUpdate& update)
+	{
+		markStale(update.lat0, update.lon0, update.lat1, update.lon1);
+	});
+}
+
+eleman::ElevationRefresher::~ElevationRefresher()
+{
+	cache.removeUpdateListener(listenerID);
+}
+
+
+void eleman::ElevationRefresher::markStale(double lat0, double lon0, double lat1, double lon1)
+{
+	// Region samples up to one cache sample away (two for bicubic) interpolate the changed samples,
+	// the cache grids are never coarser than the cache precision
+	double steps = interpolation == ElevationRegion::CUBIC ? 2.0 : 1.0;
+	double latitude = std::max(std::abs(lat0), std::abs(lat1));
+	double marginLat = steps * meters2degrees(cache.getPrecision(), 0.0);
+	double marginLon = steps * meters2degrees(cache.getPrecision(), std::min(latitude, 89.0));
+
+	double boxLat0 = std::min(lat0, lat1) - marginLat, boxLat1 = std::max(lat0, lat1) + marginLat;
+	double boxLon0 = std::min(lon0, lon1) - marginLon, boxLon1 = std::max(lon0, lon1) + marginLon;
+	if(boxLat1 < region.getLat0() || boxLat0 > region.getLat1() || boxLon1 < region.getLon0() || boxLon0 > region.getLon1()) return;
+
+	// Grid box of the corners, covers projected regions as well
+	double minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+	for(double lat : {boxLat0, boxLat1})
+	{
+		for(double lon : {boxLon0, boxLon1})
+		{
+			double gridLat, gridLon;
+			region.posToGridFloat(lat, lon, gridLat, gridLon);
+			minX = std::min(minX, gridLon);
+			maxX = std::max(maxX, gridLon);
+			minY = std::min(minY, gridLat);
+			maxY = std::max(maxY, gridLat);
+		}
+	}
+
+	double lastX = region.getGridSizeLon() - 1.0, lastY = region.getGridSizeLat() - 1.0;
+	if(maxX < 0.0 || maxY < 0.0 || minX > lastX || minY > lastY) return;
+	uint32_t x0 = std::max(floor(minX), 0.0), x1 = std::min(ceil(maxX), lastX);
+	uint32_t y0 = std::max(floor(minY), 0.0), y1 = std::min(ceil(maxY), lastY);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for(uint32_t tileY = y0 / tileSize; tileY <= y1 / tileSize; tileY++)
+	{
+		for(uint32_t tileX = x0 / tileSize; tileX <= x1 / tileSize; tileX++)
+		{
+			if(stale[tileY * tilesLon + tileX]) continue;
+			stale[tileY * tilesLon + tileX] = true;
+			staleCount++;
+		}
+	}
+}
+
+void eleman::ElevationRefresher::markAllStale()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	stale.assign(stale.size(), true);
+	staleCount = stale.size();
+}
+
+bool eleman::ElevationRefresher::isStale() const
+{
+	return staleTiles() > 0;
+}
+
+uint32_t eleman::ElevationRefresher::staleTiles() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return staleCount;
+}
+
+uint32_t eleman::ElevationRefresher::refresh()
+{
+	// Take the stale set first, filling may fetch missing samples and mark tiles again
+	std::vector<bool> tiles;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tiles.swap(stale);
+		stale.assign(tiles.size(), false);
+		staleCount = 0;
+	}
+
+	uint32_t count = 0;
+	for(uint32_t tileY = 0; tileY < tilesLat; tileY++)
+	{
+		for(uint32_t tileX = 0; tileX < tilesLon; tileX++)
+		{
+			if(!tiles[tileY * tilesLon + tileX]) continue;
+
+			uint32_t x0 = tileX * tileSize, y0 = tileY * tileSize;
+			cache.fillRegion(region, x0, y0, x0 + tileSize - 1, y0 + tileSize - 1, interpolation);
+			count++;
+		}
+	}
+	return count;
+}
@@ -3,9 +3,11 @@
 
 #include "eleman/elevationregion.h"
 
+#include "eleman/elevationmesh.h"
 #include "eleman/elevationutils.h"
 
-#include <fstream>
+#include <algorithm>
+#include <filesystem>
 #include <stdio.h>
 #include <math.h>
 
@@ -61,6 +63,7 @@ eleman::ElevationRegion::ElevationRegion(const eleman::ElevationRegion& region)
 	this->sizeLat = region.sizeLat;
 	this->sizeLon = region.sizeLon;
 
+	region.evaluate(0, 0, region.sizeLon - 1, region.sizeLat - 1);
 	this->elevationData = std::make_shared<Grid<double>>(*region.elevationData.get());
 
 	printf("[ElevationRegion] Creating region from other region\n");
@@ -69,6 +72,9 @@ eleman::ElevationRegion::ElevationRegion(const eleman::ElevationRegion& region)
 
 double& eleman::ElevationRegion::atGrid(uint32_t x, uint32_t y)
 {
+	// Caller may write through the reference
+	evaluate(x, y, x, y);
+	invalidatePyramid();
 	return elevationData->at(x, y);
 }
 
@@ -79,7 +85,53 @@ double eleman::ElevationRegion::getGrid(uint32_t x, uint32_t y) const
 
 void eleman::ElevationRegion::setGrid(uint32_t x, uint32_t y, double value)
 {
-	return elevationData->set(x, y, value);
+	elevationData->set(x, y, value);
+	if(pyramid)
+		pyramid->update(x, y);
+}
+
+double eleman::ElevationRegion::getGridExtended(int32_t x, int32_t y) const
+{
+	return getGrid(std::clamp<int32_t>(x, 0, sizeLon - 1), std::clamp<int32_t>(y, 0, sizeLat - 1));
+}
+
+// Skips the sample with zero weight, positions on a grid line never see the unknown sample next to it
+static double lerpSamples(double a, double b, double t)
+{
+	const double epsilon = 1e-6;
+	if(t < epsilon) return a;
+	if(t > 1.0 - epsilon) return b;
+	return a * (1.0 - t) + b * t;
+}
+
+// Keys cubic convolution weights (a = -0.5, Catmull-Rom) of the four samples around t
+static void cubicWeights(double t, double weights[4])
+{
+	weights[0] = ((-0.5 * t + 1.0) * t - 0.5) * t;
+	weights[1] = (1.5 * t - 2.5) * t * t + 1.0;
+	weights[2] = ((-1.5 * t + 2.0) * t + 0.5) * t;
+	weights[3] = (0.5 * t - 0.5) * t * t;
+}
+
+double eleman::ElevationRegion::getGridLinear(double gridFloatLat, double gridFloatLon) const
+{
+	double maxX = sizeLon - 1.0;
+	double maxY = sizeLat - 1.0;
+	gridFloatLon = std::min(std::max(gridFloatLon, 0.0), maxX);
+	gridFloatLat = std::min(std::max(gridFloatLat, 0.0), maxY);
+
+	uint32_t x0 = std::min(floor(gridFloatLon), std::max(maxX - 1.0, 0.0));
+	uint32_t y0 = std::min(floor(gridFloatLat), std::max(maxY - 1.0, 0.0));
+	uint32_t x1 = std::min(x0 + 1, sizeLon - 1);
+	uint32_t y1 = std::min(y0 + 1, sizeLat - 1);
+	double fx = gridFloatLon - x0;
+	double fy = gridFloatLat - y0;
+	evaluate(x0, y0, x1, y1);
+
+	const Grid<double>& grid = *elevationData;
+	double R0 = lerpSamples(grid.get(x0, y0), grid.get(x1, y0), fx);
+	double R1 = lerpSamples(grid.get(x0, y1), grid.get(x1, y1), fx);
+	return lerpSamples(R0, R1, fy);
 }
 
 double eleman::ElevationRegion::get(double latitude, double longitude, eleman::ElevationRegion::Interpolation interpolation) const
@@ -120,6 +172,8 @@ double eleman::ElevationRegion::getNearest(double latitude, double longitude) co
 
 	double gridLat, gridLon;
 	posToGridFloat(lat, lon, gridLat, gridLon);
+	if(!clampGridFloat(gridLat, gridLon))
+		throw std::runtime_error("[ElevationRegion] lat/lon out of bounds");
 	printf("Getting nearest from %f %f\n", gridLat, gridLon);
 	return getGrid(round(gridLon), round(gridLat));
 }
@@ -134,6 +188,8 @@ double eleman::ElevationRegion::getLinear(double latitude, double longitude) con
 
 	double gridLat, gridLon;
 	posToGridFloat(lat, lon, gridLat, gridLon);
+	if(!clampGridFloat(gridLat, gridLon))
+		throw std::runtime_error("[ElevationRegion] lat/lon out of bounds");
 
 	uint32_t x0 = floor(gridLon);
 	uint32_t x1 = ceil(gridLon);
@@ -161,34 +217,255 @@ double eleman::ElevationRegion::getCubic(double latitude, double longitude) cons
 	if(!check_bounds(lat, lon, lat0, lat1, lon0, lon1))
 		throw std::runtime_error("[ElevationRegion] lat/lon out of bounds");
 
-	// TODO CUBIC INTERPOLATION
-	throw std::runtime_error("[ElevationRegion] bicubic interpolation not supported yet!");
+	double gridLat, gridLon;
+	posToGridFloat(lat, lon, gridLat, gridLon);
+	if(!clampGridFloat(gridLat, gridLon))
+		throw std::runtime_error("[ElevationRegion] lat/lon out of bounds");
+	if(sizeLon < 2 || sizeLat < 2)
+		return getLinear(lat, lon);
+
+	// 4x4 neighbourhood, samples beyond the grid come from getGridExtended
+	int32_t x1 = std::min<int32_t>(floor(gridLon), sizeLon - 2);
+	int32_t y1 = std::min<int32_t>(floor(gridLat), sizeLat - 2);
+	double weightsX[4], weightsY[4];
+	cubicWeights(gridLon - x1, weightsX);
+	cubicWeights(gridLat - y1, weightsY);
+
+	double P = 0.0;
+	for(int32_t j = 0; j < 4; j++)
+	{
+		double R = 0.0;
+		for(int32_t i = 0; i < 4; i++)
+			R += weightsX[i] * getGridExtended(x1 - 1 + i, y1 - 1 + j);
+		P += weightsY[j] * R;
+	}
+
+	// Unknown samples in the neighbourhood, bilinear needs fewer of them
+	if(std::isnan(P))
+		return getLinear(lat, lon);
+	return P;
 }
 
 double eleman::ElevationRegion::minElevation() const
 {
-	double min = std::numeric_limits<double>::max();
-	for(uint32_t y = 0; y < sizeLat; y++)
+	return getPyramid().min();
+}
+
+double eleman::ElevationRegion::maxElevation() const
+{
+	return getPyramid().max();
+}
+
+double eleman::ElevationRegion::minElevation(double latitude0, double longitude0, double latitude1, double longitude1) const
+{
+	uint32_t x0, y0, x1, y1;
+	if(!gridBox(latitude0, longitude0, latitude1, longitude1, x0, y0, x1, y1)) return NAN;
+	return minGrid(x0, y0, x1, y1);
+}
+
+double eleman::ElevationRegion::maxElevation(double latitude0, double longitude0, double latitude1, double longitude1) const
+{
+	uint32_t x0, y0, x1, y1;
+	if(!gridBox(latitude0, longitude0, latitude1, longitude1, x0, y0, x1, y1)) return NAN;
+	return maxGrid(x0, y0, x1, y1);
+}
+
+double eleman::ElevationRegion::minElevation(const std::vector<Position>& polygon) const
+{
+	if(polygon.size() < 3) return NAN;
+	return getPyramid().min(polygonClassifier(polygon));
+}
+
+double eleman::ElevationRegion::maxElevation(const std::vector<Position>& polygon) const
+{
+	if(polygon.size() < 3) return NAN;
+	return getPyramid().max(polygonClassifier(polygon));
+}
+
+double eleman::ElevationRegion::minGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	return getPyramid().min(x0, y0, x1, y1);
+}
+
+double eleman::ElevationRegion::maxGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	return getPyramid().max(x0, y0, x1, y1);
+}
+
+void eleman::ElevationRegion::sumGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, double& sum, uint64_t& count) const
+{
+	// Only large boxes gain from the levels, small ones are cheaper to sum directly
+	if(pyramid && uint64_t(x1 - x0 + 1) * (y1 - y0 + 1) >= 4096)
+	{
+		pyramid->sum(x0, y0, x1, y1, sum, count);
+		return;
+	}
+
+	evaluate(x0, y0, x1, y1);
+	sum = 0.0;
+	count = 0;
+	for(uint32_t y = y0; y <= y1; y++)
 	{
-		for(uint32_t x = 0; x < sizeLon; x++)
+		// Four independent lanes without branches, the compiler turns this into vector adds
+		const double* row = elevationData->row(y);
+		double sums[4] = {0.0, 0.0, 0.0, 0.0};
+		uint64_t counts[4] = {0, 0, 0, 0};
+		uint32_t x = x0;
+		for(; x + 3 <= x1; x += 4)
 		{
-			min = std::min(min, getGrid(x, y));
+			for(uint32_t lane = 0; lane < 4; lane++)
+			{
+				double value = row[x + lane];
+				bool known = value == value;
+				sums[lane] += known ? value : 0.0;
+				counts[lane] += known;
+			}
 		}
+		for(; x <= x1; x++)
+		{
+			double value = row[x];
+			bool known = value == value;
+			sums[0] += known ? value : 0.0;
+			counts[0] += known;
+		}
+		sum += (sums[0] + sums[1]) + (sums[2] + sums[3]);
+		count += counts[0] + counts[1] + counts[2] + counts[3];
 	}
-	return min;
 }
 
-double eleman::ElevationRegion::maxElevation() const
+double eleman::ElevationRegion::meanGrid(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) const
+{
+	double sum;
+	uint64_t count;
+	sumGrid(x0, y0, x1, y1, sum, count);
+	return count > 0 ? sum / count : NAN;
+}
+
+const eleman::ElevationPyramid& eleman::ElevationRegion::getPyramid() const
+{
+	if(!pyramid)
+	{
+		evaluate(0, 0, sizeLon - 1, sizeLat - 1);
+		pyramid = std::make_shared<ElevationPyramid>(elevationData);
+	}
+	return *pyramid;
+}
+
+void eleman::ElevationRegion::invalidatePyramid()
+{
+	pyramid.reset();
+}
+
+bool eleman::ElevationRegion::clampGridFloat(double& gridFloatLat, double& gridFloatLon) const
+{
+	// Projected regions do not fill their lat/lon bounds
+	const double epsilon = 1e-6;
+	if(gridFloatLat < -epsilon || gridFloatLat > sizeLat - 1.0 + epsilon) return false;
+	if(gridFloatLon < -epsilon || gridFloatLon > sizeLon - 1.0 + epsilon) return false;
+
+	gridFloatLat = std::min(std::max(gridFloatLat, 0.0), sizeLat - 1.0);
+	gridFloatLon = std::min(std::max(gridFloatLon, 0.0), sizeLon - 1.0);
+	return true;
+}
+
+bool eleman::ElevationRegion::gridBox(double latitude0, double longitude0, double latitude1, double longitude1,
+									  uint32_t& x0, uint32_t& y0, uint32_t& x1, uint32_t& y1) const
+{
+	double gridLat0, gridLon0, gridLat1, gridLon1;
+	posToGridFloat(std::min(latitude0, latitude1), std::min(longitude0, longitude1), gridLat0, gridLon0);
+	posToGridFloat(std::max(latitude0, latitude1), std::max(longitude0, longitude1), gridLat1, gridLon1);
+
+	// Only samples lying inside the box, small epsilon keeps samples on the border
+	double minX = std::max(ceil(gridLon0 - 1e-9), 0.0);
+	double minY = std::max(ceil(gridLat0 - 1e-9), 0.0);
+	double maxX = std::min(floor(gridLon1 + 1e-9), sizeLon - 1.0);
+	double maxY = std::min(floor(gridLat1 + 1e-9), sizeLat - 1.0);
+	if(minX > maxX || minY > maxY) return false;
+
+	x0 = minX;
+	y0 = minY;
+	x1 = maxX;
+	y1 = maxY;
+	return true;
+}
+
+// Even-odd rule
+static bool pointInPolygon(const std::vector<double>& px, const std::vector<double>& py, double x, double y)
+{
+	bool inside = false;
+	for(size_t i = 0, j = px.size() - 1; i < px.size(); j = i++)
+	{
+		if((py[i] > y) != (py[j] > y) && x < (px[j] - px[i]) * (y - py[i]) / (py[j] - py[i]) + px[i])
+			inside = !inside;
+	}
+	return inside;
+}
+
+// Liang-Barsky clipping of segment a-b against the closed rectangle
+static bool segmentIntersectsRect(double ax, double ay, double bx, double by, double x0, double y0, double x1, double y1)
 {
-	double max = std::numeric_limits<double>::min();
-	for(uint32_t y = 0; y < sizeLat; y++)
+	double t0 = 0.0;
+	double t1 = 1.0;
+	double p[4] = {ax - bx, bx - ax, ay - by, by - ay};
+	double q[4] = {ax - x0, x1 - ax, ay - y0, y1 - ay};
+	for(uint8_t i = 0; i < 4; i++)
 	{
-		for(uint32_t x = 0; x < sizeLon; x++)
+		if(p[i] == 0.0)
 		{
-			max = std::max(max, getGrid(x, y));
+			if(q[i] < 0.0) return false;
+			continue;
+		}
+
+		double t = q[i] / p[i];
+		if(p[i] < 0.0)
+		{
+			if(t > t1) return false;
+			t0 = std::max(t0, t);
+		}
+		else
+		{
+			if(t < t0) return false;
+			t1 = std::min(t1, t);
 		}
 	}
-	return max;
+	return true;
+}
+
+eleman::ElevationPyramid::Classifier eleman::ElevationRegion::polygonClassifier(const std::vector<Position>& polygon) const
+{
+	// Transform polygon into grid coordinates once
+	std::vector<double> px(polygon.size());
+	std::vector<double> py(polygon.size());
+	for(size_t i = 0; i < polygon.size(); i++)
+		posToGridFloat(polygon[i].latitude, polygon[i].longitude, py[i], px[i]);
+
+	double minX = *std::min_element(px.begin(), px.end());
+	double maxX = *std::max_element(px.begin(), px.end());
+	double minY = *std::min_element(py.begin(), py.end());
+	double maxY = *std::max_element(py.begin(), py.end());
+
+	return [=](uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+	{
+		if(x1 < minX || x0 > maxX || y1 < minY || y0 > maxY)
+			return ElevationPyramid::OUTSIDE;
+
+		// Single sample
+		if(x0 == x1 && y0 == y1)
+			return pointInPolygon(px, py, x0, y0) ? ElevationPyramid::INSIDE : ElevationPyramid::OUTSIDE;
+
+		for(size_t i = 0, j = px.size() - 1; i < px.size(); j = i++)
+		{
+			if(segmentIntersectsRect(px[j], py[j], px[i], py[i], x0, y0, x1, y1))
+				return ElevationPyramid::PARTIAL;
+		}
+
+		// No edge crosses the rectangle, so it is either fully inside, fully outside or contains the polygon
+		if(pointInPolygon(px, py, x0, y0))
+			return ElevationPyramid::INSIDE;
+		if(px[0] >= x0 && px[0] <= x1 && py[0] >= y0 && py[0] <= y1)
+			return ElevationPyramid::PARTIAL;
+		return ElevationPyramid::OUTSIDE;
+	};
 }
 
 
@@ -217,90 +494,48 @@ void eleman::ElevationRegion::posToGrid(double latitude, double longitude, uint3
 	gridLon = round(interpolate(longitude, lon0, 0.0, lon1, sizeLon - 1.0));
 }
 
-// Blender: Import OBJ Up-Axis Z, Forward-Axis Y
-void eleman::ElevationRegion::toMesh(const std::string& filepath, double scale, bool centerHorizontal, bool centerVertical) const
+void eleman::ElevationRegion::gridRowToPos(uint32_t gridLat, double* latitude, double* longitude) const
 {
-	// TODO create directory
-	// TODO Place mesh at correct position (place multiple besides) when not centered horizontally
-
-	std::ofstream file(filepath);
-	// TODO Replace with global getVersionString() or something like that
-	file << "# EleMan v0.01" << std::endl;
-
-	// Write position data
-	double referenceLatitude = std::min(std::abs(lat0), std::abs(lat1));
-	double metersLat = degrees2meters(lat1-lat0, 0.0);
-	double metersLon = degrees2meters(lon1-lon0, referenceLatitude);
-	double cellWidth = metersLon  / (sizeLon - 1.0);
-	double cellHeight= metersLat / (sizeLat - 1.0);
-
-	// Values for moving output
-	double centerX = 0.0;
-	double centerY = 0.0;
-	double elevationOffset = 0.0;
+	for(uint32_t x = 0; x < sizeLon; x++)
+		gridToPos(gridLat, x, latitude[x], longitude[x]);
+}
 
-	if(centerHorizontal)
-	{
-		centerX = metersLon / 2.0;
-		centerY = metersLat / 2.0;
-	}
+void eleman::ElevationRegion::gridSpacing(uint32_t gridLat, double& metersLon, double& metersLat) const
+{
+	double latitude, longitude;
+	gridToPos(gridLat, 0, latitude, longitude);
+	metersLat = degrees2meters((lat1 - lat0) / std::max(sizeLat - 1.0, 1.0), 0.0);
+	metersLon = degrees2meters((lon1 - lon0) / std::max(sizeLon - 1.0, 1.0), latitude);
+}
 
-	if(centerVertical)
-	{
-		double min = minElevation();
-		double max = maxElevation();
-		double avg = (min + max) / 2.0;
-		elevationOffset = -avg;
-	}
+void eleman::ElevationRegion::mapToFile(const std::filesystem::path& filepath, size_t rowAlignment)
+{
+	evaluate(0, 0, sizeLon - 1, sizeLat - 1);
+	Grid<double> mapped = Grid<double>::map(filepath, sizeLon, sizeLat, MappedFile::SHARED, 0, rowAlignment);
+	mapped.view().copy(elevationData->view());
+	elevationData = std::make_shared<Grid<double>>(std::move(mapped));
+	invalidatePyramid();
+}
 
-	printf("Writing position data\n");
-	for(uint32_t y = 0; y < sizeLat; y++)
-	{
-		for(uint32_t x = 0; x < sizeLon; x++)
-		{
-			file << "v ";
-			file << scale * (x * cellWidth  - centerX) << " ";
-			file << scale * (y * cellHeight - centerY) << " ";
-			file << scale * (elevationData->get(x, y) + elevationOffset);
-			file << std::endl;
-		}
-	}
+void eleman::ElevationRegion::toMesh(const std::string& filepath, double scale, bool centerHorizontal, bool centerVertical, double maxError) const
+{
+	// TODO create directory
+	// TODO Place mesh at correct position (place multiple besides) when not centered horizontally
 
-	printf("Writing UV data\n");
-	for(uint32_t y = 0; y < sizeLat; y++)
-	{
-		for(uint32_t x = 0; x < sizeLon; x++)
-		{
-			file << "vt ";
-			file << interpolate(x, 0, 0.0, sizeLon-1, 1.0);
-			file << " ";
-			file << interpolate(y, 0, 0.0, sizeLat-1, 1.0);
-			file << std::endl;
-		}
-	}
+	ElevationMesh mesh(*this, maxError, scale, centerHorizontal, centerVertical);
+	printf("[ElevationRegion] Writing mesh with %zu vertices and %zu triangles\n", mesh.vertexCount(), mesh.triangleCount());
 
-	printf("Writing face data\n");
-	uint32_t quadsX = sizeLon - 1;
-	uint32_t quadsY = sizeLat - 1;
-	for(uint32_t y = 0; y < quadsY; y++)
-	{
-		for(uint32_t x = 0; x < quadsX; x++)
-		{
-			uint32_t index0 = 1 + y * sizeLon + x;
-			uint32_t index1 = 1 + y * sizeLon + x + sizeLon;
-			uint32_t index2 = index1 + 1;
-			uint32_t index3 = index0 + 1;
-
-			file << "f ";
-			file << index0 << "/" << index0 << " ";
-			file << index1 << "/" << index1 << " ";
-			file << index2 << "/" << index2 << " ";
-			file << index3 << "/" << index3 << " ";
-			file << std::endl;
-		}
-	}
+	std::string extension = std::filesystem::path(filepath).extension().string();
+	bool success;
+	if(extension == ".ply")
+		success = mesh.writePLY(filepath);
+	else if(extension == ".glb")
+		success = mesh.writeGLB(filepath);
+	else
+		success = mesh.writeOBJ(filepath);
 
-	file.close();
+	if(!success)
+		throw std::runtime_error("[ElevationRegion] could not write mesh to " + filepath);
 }
 
 
@@ -317,7 +552,7 @@ size_t eleman::ElevationRegion::sizeTotal() const
 
 size_t eleman::ElevationRegion::memory() const
 {
-	return sizeof(this) + elevationData->memory();
+	return sizeof(this) + elevationData->memory() + (pyramid ? pyramid->memory() : 0);
 }
 
 
@@ -0,0 +1,226 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationterrain.h"
+
+#include "eleman/elevationcache.h"
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+eleman::ElevationTerrain::ElevationTerrain(const Grid<double>& grid, double spacingX, double spacingY)
+	: width(grid.getWidth()), height(grid.getHeight()), window(width + 2, height + 2, NAN)
+{
+	window.view(1, 1, width, height).copy(grid.view());
+
+	this->spacingX.assign(height, spacingX);
+	this->spacingY = spacingY;
+
+	extendBorder();
+}
+
+eleman::ElevationTerrain::ElevationTerrain(const ElevationRegion& region)
+	: width(region.getGridSizeLon()), height(region.getGridSizeLat()), window(width + 2, height + 2, NAN)
+{
+	fromRegion(region);
+	extendBorder();
+}
+
+eleman::ElevationTerrain::ElevationTerrain(ElevationCache& cache, uint64_t cellID)
+	: ElevationTerrain(*cache.getCell(cellID))
+{
+	// Loading the neighbours fills the halo of the cell
+	for(uint64_t id : cache.neighborCells(cellID))
+		cache.getCell(id);
+
+	// Replace the extrapolated border by the halo, one grid step beyond the cell edges.
+	// Without a halo the extrapolated border stays.
+	const ElevationCacheCell* cell = cache.getCell(cellID);
+	if(cell->getHaloWidth() == 0) return;
+
+	for(uint32_t y = 0; y < height + 2; y++)
+	{
+		for(uint32_t x = 0; x < width + 2; x++)
+		{
+			if(x > 0 && x < width + 1 && y > 0 && y < height + 1) continue;
+
+			double value = cell->getGridHalo(int32_t(x) - 1, int32_t(y) - 1);
+			if(!std::isnan(value))
+				window.set(x, y, value);
+		}
+	}
+}
+
+
+void eleman::ElevationTerrain::gradient(Grid<double>& dzdx, Grid<double>& dzdy, GradientMethod method) const
+{
+	if(dzdx.getWidth() != width || dzdx.getHeight() != height || dzdy.getWidth() != width || dzdy.getHeight() != height)
+		throw std::runtime_error("[ElevationTerrain] gradient grids do not match the terrain size");
+
+	forEachRow(method, [&](uint32_t y, const double* p, const double* q)
+	{
+		std::copy(p, p + width, dzdx.row(y));
+		std::copy(q, q + width, dzdy.row(y));
+	});
+}
+
+Grid<double> eleman::ElevationTerrain::slope(GradientMethod method) const
+{
+	Grid<double> slope(width, height);
+	forEachRow(method, [&](uint32_t y, const double* p, const double* q)
+	{
+		double* out = slope.row(y);
+		for(uint32_t x = 0; x < width; x++)
+			out[x] = atan(sqrt(p[x] * p[x] + q[x] * q[x])) * (180.0 / M_PI);
+	});
+	return slope;
+}
+
+Grid<double> eleman::ElevationTerrain::aspect(GradientMethod method) const
+{
+	Grid<double> aspect(width, height);
+	forEachRow(method, [&](uint32_t y, const double* p, const double* q)
+	{
+		double* out = aspect.row(y);
+		for(uint32_t x = 0; x < width; x++)
+		{
+			// Downslope vector is (-p, -q), azimuth measured from north towards east
+			double angle = atan2(-p[x], -q[x]) * (180.0 / M_PI);
+			out[x] = (p[x] == 0.0 && q[x] == 0.0) ? NAN : (angle < 0.0 ? angle + 360.0 : angle);
+		}
+	});
+	return aspect;
+}
+
+Grid<eleman::Normal> eleman::ElevationTerrain::normals(GradientMethod method) const
+{
+	Grid<Normal> normals(width, height);
+	forEachRow(method, [&](uint32_t y, const double* p, const double* q)
+	{
+		Normal* out = normals.row(y);
+		for(uint32_t x = 0; x < width; x++)
+		{
+			double length = 1.0 / sqrt(p[x] * p[x] + q[x] * q[x] + 1.0);
+			out[x] = {-p[x] * length, -q[x] * length, length};
+		}
+	});
+	return normals;
+}
+
+Grid<uint8_t> eleman::ElevationTerrain::hillshade(double azimuth, double altitude, double zFactor, GradientMethod method) const
+{
+	// Direction towards the light source (east, north, up)
+	double az = azimuth * M_PI / 180.0;
+	double alt = altitude * M_PI / 180.0;
+	double lightX = sin(az) * cos(alt);
+	double lightY = cos(az) * cos(alt);
+	double lightZ = sin(alt);
+
+	Grid<uint8_t> shade(width, height);
+	forEachRow(method, [&](uint32_t y, const double* p, const double* q)
+	{
+		uint8_t* out = shade.row(y);
+		for(uint32_t x = 0; x < width; x++)
+		{
+			double px = p[x] * zFactor;
+			double qy = q[x] * zFactor;
+			double value = (lightZ - px * lightX - qy * lightY) / sqrt(px * px + qy * qy + 1.0);
+			// Also maps NAN to 0
+			out[x] = value > 0.0 ? uint8_t(value * 255.0 + 0.5) : 0;
+		}
+	});
+	return shade;
+}
+
+
+void eleman::ElevationTerrain::fromRegion(const ElevationRegion& region)
+{
+	const Grid<double>& grid = region.getElevationData();
+	window.view(1, 1, width, height).copy(grid.view());
+
+	spacingX.resize(height);
+	for(uint32_t y = 0; y < height; y++)
+		region.gridSpacing(y, spacingX[y], spacingY);
+}
+
+// Linear extrapolation of the outermost samples into unknown border samples
+void eleman::ElevationTerrain::extendBorder()
+{
+	auto extrapolate = [](double edge, double inner) {
+		return std::isnan(inner) ? edge : 2.0 * edge - inner;
+	};
+
+	for(uint32_t y = 1; y <= height; y++)
+	{
+		double* row = window.row(y);
+		if(std::isnan(row[0]))
+			row[0] = extrapolate(row[1], width > 1 ? row[2] : NAN);
+		if(std::isnan(row[width + 1]))
+			row[width + 1] = extrapolate(row[width], width > 1 ? row[width - 1] : NAN);
+	}
+
+	double* bottom = window.row(0);
+	double* top = window.row(height + 1);
+	for(uint32_t x = 0; x < width + 2; x++)
+	{
+		if(std::isnan(bottom[x]))
+			bottom[x] = extrapolate(window.get(x, 1), height > 1 ? window.get(x, 2) : NAN);
+		if(std::isnan(top[x]))
+			top[x] = extrapolate(window.get(x, height), height > 1 ? window.get(x, height - 1) : NAN);
+	}
+}
+
+void eleman::ElevationTerrain::gradientRow(uint32_t y, GradientMethod method, double* dzdx, double* dzdy) const
+{
+	// Window row y + 1 is grid row y, north has the larger latitude
+	const double* s = window.row(y);
+	const double* c = window.row(y + 1);
+	const double* n = window.row(y + 2);
+
+	switch(method)
+	{
+		case HORN:
+		{
+			double scaleX = 1.0 / (8.0 * spacingX[y]);
+			double scaleY = 1.0 / (8.0 * spacingY);
+			for(uint32_t x = 0; x < width; x++)
+			{
+				dzdx[x] = ((n[x + 2] + 2.0 * c[x + 2] + s[x + 2]) - (n[x] + 2.0 * c[x] + s[x])) * scaleX;
+				dzdy[x] = ((n[x] + 2.0 * n[x + 1] + n[x + 2]) - (s[x] + 2.0 * s[x + 1] + s[x + 2])) * scaleY;
+			}
+			break;
+		}
+
+		case ZEVENBERGEN_THORNE:
+		{
+			double scaleX = 1.0 / (2.0 * spacingX[y]);
+			double scaleY = 1.0 / (2.0 * spacingY);
+			for(uint32_t x = 0; x < width; x++)
+			{
+				dzdx[x] = (c[x + 2] - c[x]) * scaleX;
+				dzdy[x] = (n[x + 1] - s[x + 1]) * scaleY;
+			}
+			break;
+		}
+
+		default:
+			throw std::runtime_error("[ElevationTerrain] Unknown gradient method");
+	}
+}
+
+void eleman::ElevationTerrain::forEachRow(GradientMethod method, const std::function<void(uint32_t y, const double* dzdx, const double* dzdy)>& function) const
+{
+	parallelFor(0, height, [&](uint32_t begin, uint32_t end)
+	{
+		std::vector<double> dzdx(width);
+		std::vector<double> dzdy(width);
+		for(uint32_t y = begin; y < end; y++)
+		{
+			gradientRow(y, method, dzdx.data(), dzdy.data());
+			function(y, dzdx.data(), dzdy.data());
+		}
+	});
+}
@@ -5,8 +5,12 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <exception>
 #include <iomanip>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 
 double eleman::degrees2meters(double degreesLon, double latitude)
@@ -51,6 +55,17 @@ std::string eleman::toHex(double value)
 	return ss.str();
 }
 
+double eleman::fromHex(const std::string& hex)
+{
+	if(hex.empty() || hex.size() > 16 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+		return NAN;
+
+	uint64_t bits = std::stoull(hex, nullptr, 16);
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
 
 std::string eleman::formatMemory(size_t bytes)
 {
@@ -75,3 +90,123 @@ std::string eleman::formatMemory(size_t bytes)
 	return ss.str();
 }
 
+void eleman::parallelFor(uint32_t begin, uint32_t end, const std::function<void(uint32_t chunkBegin, uint32_t chunkEnd)>& function, uint32_t threads)
+{
+	if(end <= begin) return;
+
+	if(threads == 0)
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	threads = std::min(threads, end - begin);
+
+	if(threads == 1)
+	{
+		function(begin, end);
+		return;
+	}
+
+	// Rethrow the first exception on the calling thread
+	std::vector<std::exception_ptr> errors(threads);
+	std::vector<std::thread> workers;
+	uint32_t chunk = (end - begin + threads - 1) / threads;
+	for(uint32_t i = 0; i < threads; i++)
+	{
+		uint32_t chunkBegin = begin + i * chunk;
+		uint32_t chunkEnd = std::min(chunkBegin + chunk, end);
+		if(chunkBegin >= chunkEnd) break;
+
+		workers.emplace_back([&, i, chunkBegin, chunkEnd]()
+		{
+			try {
+				function(chunkBegin, chunkEnd);
+			} catch(...) {
+				errors[i] = std::current_exception();
+			}
+		});
+	}
+
+	for(std::thread& worker : workers)
+		worker.join();
+
+	for(std::exception_ptr& error : errors)
+	{
+		if(error) std::rethrow_exception(error);
+	}
+}
+
+// Spreads the bits of value to the even bit positions
+static uint64_t spreadBits(uint32_t value)
+{
+	uint64_t v = value;
+	v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+	v = (v | (v << 8))  & 0x00FF00FF00FF00FFull;
+	v = (v | (v << 4))  & 0x0F0F0F0F0F0F0F0Full;
+	v = (v | (v << 2))  & 0x3333333333333333ull;
+	v = (v | (v << 1))  & 0x5555555555555555ull;
+	return v;
+}
+
+uint64_t eleman::mortonIndex(uint32_t x, uint32_t y)
+{
+	return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+uint64_t eleman::hilbertIndex(uint32_t x, uint32_t y)
+{
+	// Parallel prefix scan over the quadrant transformations of all levels at once (after F. Giesen / rawrunprotected),
+	// gives the same index as walking the quadrants level by level without the unpredictable branches
+	const uint32_t ones = 0xFFFFFFFFu;
+	uint32_t A, B, C, D;
+	{
+		uint32_t a = x ^ y;
+		uint32_t b = ones ^ a;
+		uint32_t c = ones ^ (x | y);
+		uint32_t d = x & (y ^ ones);
+
+		A = a | (b >> 1);
+		B = (a >> 1) ^ a;
+		C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+		D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+	}
+
+	for(uint32_t shift = 2; shift <= 8; shift <<= 1)
+	{
+		uint32_t a = A, b = B, c = C, d = D;
+		A = (a & (a >> shift)) ^ (b & (b >> shift));
+		B = (a & (b >> shift)) ^ (b & ((a ^ b) >> shift));
+		C ^= (a & (c >> shift)) ^ (b & (d >> shift));
+		D ^= (b & (c >> shift)) ^ ((a ^ b) & (d >> shift));
+	}
+
+	{
+		uint32_t a = A, b = B, c = C, d = D;
+		C ^= (a & (c >> 16)) ^ (b & (d >> 16));
+		D ^= (b & (c >> 16)) ^ ((a ^ b) & (d >> 16));
+	}
+
+	// Undo the transformation prefix scan and recover the index bits
+	uint32_t a = C ^ (C >> 1);
+	uint32_t b = D ^ (D >> 1);
+	uint32_t i0 = x ^ y;
+	uint32_t i1 = b | (ones ^ (i0 | a));
+	return (spreadBits(i1) << 1) | spreadBits(i0);
+}
+
+uint64_t eleman::checksum(const void* data, size_t size, uint64_t seed)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+	// Whole words first, a byte at a time would be eight times the multiplications
+	uint64_t hash = seed;
+	size_t words = size / 8;
+	for(size_t i = 0; i < words; i++)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i * 8, 8);
+		hash = (hash ^ word) * prime;
+	}
+	for(size_t i = words * 8; i < size; i++)
+		hash = (hash ^ bytes[i]) * prime;
+
+	return hash;
+}
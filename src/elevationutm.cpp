@@ -0,0 +1,410 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationutm.h"
+
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <stdio.h>
+
+// WGS84 ellipsoid and UTM parameters
+static const double WGS84_A = 6378137.0;
+static const double WGS84_F = 1.0 / 298.257223563;
+static const double UTM_K0 = 0.9996;
+static const double UTM_FALSE_EASTING = 500000.0;
+static const double UTM_FALSE_NORTHING = 10000000.0;
+
+// Batches below this size are not worth spawning threads for
+static const size_t PARALLEL_BATCH = 8192;
+
+namespace
+{
+	// Series coefficients of the Krüger expansion in the third flattening n
+	struct KruegerSeries
+	{
+		double e;			// First eccentricity
+		double scale;		// k0 times the rectifying radius
+		double alpha[6];	// Conformal to projected
+		double beta[6];		// Projected to conformal
+		double delta[6];	// Conformal to geodetic latitude
+
+		KruegerSeries()
+		{
+			double n = WGS84_F / (2.0 - WGS84_F);
+			double n2 = n * n, n3 = n2 * n, n4 = n3 * n, n5 = n4 * n, n6 = n5 * n;
+
+			e = std::sqrt(WGS84_F * (2.0 - WGS84_F));
+			scale = UTM_K0 * WGS84_A / (1.0 + n) * (1.0 + n2 / 4.0 + n4 / 64.0 + n6 / 256.0);
+
+			alpha[0] = n / 2.0 - 2.0 * n2 / 3.0 + 5.0 * n3 / 16.0 + 41.0 * n4 / 180.0 - 127.0 * n5 / 288.0 + 7891.0 * n6 / 37800.0;
+			alpha[1] = 13.0 * n2 / 48.0 - 3.0 * n3 / 5.0 + 557.0 * n4 / 1440.0 + 281.0 * n5 / 630.0 - 1983433.0 * n6 / 1935360.0;
+			alpha[2] = 61.0 * n3 / 240.0 - 103.0 * n4 / 140.0 + 15061.0 * n5 / 26880.0 + 167603.0 * n6 / 181440.0;
+			alpha[3] = 49561.0 * n4 / 161280.0 - 179.0 * n5 / 168.0 + 6601661.0 * n6 / 7257600.0;
+			alpha[4] = 34729.0 * n5 / 80640.0 - 3418889.0 * n6 / 1995840.0;
+			alpha[5] = 212378941.0 * n6 / 319334400.0;
+
+			beta[0] = n / 2.0 - 2.0 * n2 / 3.0 + 37.0 * n3 / 96.0 - n4 / 360.0 - 81.0 * n5 / 512.0 + 96199.0 * n6 / 604800.0;
+			beta[1] = n2 / 48.0 + n3 / 15.0 - 437.0 * n4 / 1440.0 + 46.0 * n5 / 105.0 - 1118711.0 * n6 / 3870720.0;
+			beta[2] = 17.0 * n3 / 480.0 - 37.0 * n4 / 840.0 - 209.0 * n5 / 4480.0 + 5569.0 * n6 / 90720.0;
+			beta[3] = 4397.0 * n4 / 161280.0 - 11.0 * n5 / 504.0 - 830251.0 * n6 / 7257600.0;
+			beta[4] = 4583.0 * n5 / 161280.0 - 108847.0 * n6 / 3991680.0;
+			beta[5] = 20648693.0 * n6 / 638668800.0;
+
+			delta[0] = 2.0 * n - 2.0 * n2 / 3.0 - 2.0 * n3 + 116.0 * n4 / 45.0 + 26.0 * n5 / 45.0 - 2854.0 * n6 / 675.0;
+			delta[1] = 7.0 * n2 / 3.0 - 8.0 * n3 / 5.0 - 227.0 * n4 / 45.0 + 2704.0 * n5 / 315.0 + 2323.0 * n6 / 945.0;
+			delta[2] = 56.0 * n3 / 15.0 - 136.0 * n4 / 35.0 - 1262.0 * n5 / 105.0 + 73814.0 * n6 / 2835.0;
+			delta[3] = 4279.0 * n4 / 630.0 - 332.0 * n5 / 35.0 - 399572.0 * n6 / 14175.0;
+			delta[4] = 4174.0 * n5 / 315.0 - 144838.0 * n6 / 6237.0;
+			delta[5] = 601676.0 * n6 / 22275.0;
+		}
+	};
+
+	const KruegerSeries& series()
+	{
+		static const KruegerSeries instance;
+		return instance;
+	}
+
+	// Sum of c[j] * sin(2 (j + 1) x) with Clenshaw's recurrence
+	double sineSeries(const double* c, double x)
+	{
+		double twoCos = 2.0 * std::cos(2.0 * x);
+		double b1 = 0.0, b2 = 0.0;
+		for(int j = 5; j >= 0; j--)
+		{
+			double b = c[j] + twoCos * b1 - b2;
+			b2 = b1;
+			b1 = b;
+		}
+		return b1 * std::sin(2.0 * x);
+	}
+
+	// Same for the complex argument x + iy, written out in real arithmetic (std::complex multiplication is slow)
+	void sineSeries(const double* c, double x, double y, double& real, double& imag)
+	{
+		double sin2x = std::sin(2.0 * x), cos2x = std::cos(2.0 * x);
+		double sinh2y = std::sinh(2.0 * y), cosh2y = std::cosh(2.0 * y);
+
+		// 2 cos(2z) and sin(2z)
+		double ar = 2.0 * cos2x * cosh2y, ai = -2.0 * sin2x * sinh2y;
+		double sr = sin2x * cosh2y, si = cos2x * sinh2y;
+
+		double b1r = 0.0, b1i = 0.0, b2r = 0.0, b2i = 0.0;
+		for(int j = 5; j >= 0; j--)
+		{
+			double br = c[j] + ar * b1r - ai * b1i - b2r;
+			double bi = ar * b1i + ai * b1r - b2i;
+			b2r = b1r;
+			b2i = b1i;
+			b1r = br;
+			b1i = bi;
+		}
+		real = b1r * sr - b1i * si;
+		imag = b1r * si + b1i * sr;
+	}
+
+	inline double toRadians(double degrees) { return degrees * M_PI / 180.0; }
+	inline double toDegrees(double radians) { return radians * 180.0 / M_PI; }
+}
+
+
+eleman::UTMProjection::UTMProjection(uint8_t zone, bool north)
+{
+	if(zone < 1 || zone > 60)
+		throw std::runtime_error("[UTMProjection] zone has to be between 1 and 60");
+
+	this->zone = zone;
+	this->north = north;
+	this->centralMeridian = zone * 6.0 - 183.0;
+	this->falseNorthing = north ? 0.0 : UTM_FALSE_NORTHING;
+}
+
+eleman::UTMProjection::~UTMProjection()
+{
+
+}
+
+uint8_t eleman::UTMProjection::zoneFor(double latitude, double longitude)
+{
+	// Wrap longitude into [-180, 180)
+	longitude = std::fmod(std::fmod(longitude + 180.0, 360.0) + 360.0, 360.0) - 180.0;
+
+	// Norway
+	if(latitude >= 56.0 && latitude < 64.0 && longitude >= 3.0 && longitude < 12.0)
+		return 32;
+
+	// Svalbard
+	if(latitude >= 72.0 && latitude <= 84.0 && longitude >= 0.0 && longitude < 42.0)
+	{
+		if(longitude < 9.0) return 31;
+		if(longitude < 21.0) return 33;
+		if(longitude < 33.0) return 35;
+		return 37;
+	}
+
+	int zone = std::floor((longitude + 180.0) / 6.0) + 1;
+	return std::min(std::max(zone, 1), 60);
+}
+
+char eleman::UTMProjection::zoneLetter(double latitude)
+{
+	if(latitude < -80.0 || latitude > 84.0) return 'Z';
+
+	// Band X is 12° high
+	static const char letters[] = "CDEFGHJKLMNPQRSTUVWXX";
+	return letters[int((latitude + 80.0) / 8.0)];
+}
+
+eleman::UTMProjection eleman::UTMProjection::forPosition(double latitude, double longitude)
+{
+	return UTMProjection(zoneFor(latitude, longitude), latitude >= 0.0);
+}
+
+void eleman::UTMProjection::forward(double latitude, double longitude, double& easting, double& northing) const
+{
+	const KruegerSeries& s = series();
+
+	double lambda = std::remainder(longitude - centralMeridian, 360.0);
+	double phi = toRadians(latitude);
+	double lam = toRadians(lambda);
+
+	// Conformal latitude, tangent of
+	double sinPhi = std::sin(phi);
+	double tau = std::sinh(std::atanh(sinPhi) - s.e * std::atanh(s.e * sinPhi));
+	double cosLam = std::cos(lam);
+
+	// Gauss-Schreiber transverse Mercator, then the series corrects to the ellipsoid
+	double xi = std::atan2(tau, cosLam);
+	double eta = std::asinh(std::sin(lam) / std::hypot(tau, cosLam));
+	double dXi, dEta;
+	sineSeries(s.alpha, xi, eta, dXi, dEta);
+
+	easting = UTM_FALSE_EASTING + s.scale * (eta + dEta);
+	northing = falseNorthing + s.scale * (xi + dXi);
+}
+
+void eleman::UTMProjection::inverse(double easting, double northing, double& latitude, double& longitude) const
+{
+	const KruegerSeries& s = series();
+
+	double xi = (northing - falseNorthing) / s.scale;
+	double eta = (easting - UTM_FALSE_EASTING) / s.scale;
+	double dXi, dEta;
+	sineSeries(s.beta, xi, eta, dXi, dEta);
+	xi -= dXi;
+	eta -= dEta;
+
+	double chi = std::asin(std::sin(xi) / std::cosh(eta));
+
+	latitude = toDegrees(chi + sineSeries(s.delta, chi));
+	longitude = std::remainder(centralMeridian + toDegrees(std::atan2(std::sinh(eta), std::cos(xi))), 360.0);
+}
+
+void eleman::UTMProjection::forward(const double* latitude, const double* longitude, double* easting, double* northing, size_t count) const
+{
+	auto range = [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			double e, n;
+			forward(latitude[i], longitude[i], e, n);
+			easting[i] = e;
+			northing[i] = n;
+		}
+	};
+
+	if(count < PARALLEL_BATCH)
+	{
+		range(0, count);
+		return;
+	}
+
+	uint32_t blocks = (count + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+	parallelFor(0, blocks, [&](uint32_t b0, uint32_t b1) {
+		range(b0 * PARALLEL_BATCH, std::min(b1 * PARALLEL_BATCH, count));
+	});
+}
+
+void eleman::UTMProjection::inverse(const double* easting, const double* northing, double* latitude, double* longitude, size_t count) const
+{
+	// Inputs are read before outputs are written, so conversions may happen in place
+	auto range = [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; i++)
+		{
+			double lat, lon;
+			inverse(easting[i], northing[i], lat, lon);
+			latitude[i] = lat;
+			longitude[i] = lon;
+		}
+	};
+
+	if(count < PARALLEL_BATCH)
+	{
+		range(0, count);
+		return;
+	}
+
+	uint32_t blocks = (count + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+	parallelFor(0, blocks, [&](uint32_t b0, uint32_t b1) {
+		range(b0 * PARALLEL_BATCH, std::min(b1 * PARALLEL_BATCH, count));
+	});
+}
+
+
+eleman::ElevationUTMRegion::ElevationUTMRegion(uint8_t zone, bool north, double easting0, double northing0, double easting1, double northing1, double precision)
+	: projection(zone, north)
+{
+	if(!(precision > 0.0))
+		throw std::runtime_error("[ElevationUTMRegion] precision has to be positive");
+
+	uint32_t sizeNorthing = std::ceil(std::abs(northing1 - northing0) / precision) + 1;
+	uint32_t sizeEasting = std::ceil(std::abs(easting1 - easting0) / precision) + 1;
+	initialize(easting0, northing0, easting1, northing1, sizeNorthing, sizeEasting);
+
+	printf("[ElevationUTMRegion] Creating region in zone %d from precision %f -> %d %d\n", zone, precision, sizeLat, sizeLon);
+}
+
+eleman::ElevationUTMRegion::ElevationUTMRegion(uint8_t zone, bool north, double easting0, double northing0, double easting1, double northing1,
+											   uint32_t gridSizeNorthing, uint32_t gridSizeEasting)
+	: projection(zone, north)
+{
+	initialize(easting0, northing0, easting1, northing1, gridSizeNorthing, gridSizeEasting);
+
+	printf("[ElevationUTMRegion] Creating region in zone %d from size %d %d\n", zone, sizeLat, sizeLon);
+}
+
+eleman::ElevationUTMRegion::ElevationUTMRegion(double lat0, double lon0, double lat1, double lon1, double precision)
+	: projection(UTMProjection::forPosition((lat0 + lat1) / 2.0, (lon0 + lon1) / 2.0))
+{
+	if(!(precision > 0.0))
+		throw std::runtime_error("[ElevationUTMRegion] precision has to be positive");
+
+	// Edges of the box are curved in the projection, sample them densely
+	const int steps = 64;
+	double e0 = INFINITY, n0 = INFINITY, e1 = -INFINITY, n1 = -INFINITY;
+	for(int i = 0; i <= steps; i++)
+	{
+		double t = double(i) / steps;
+		double lat[4] = {lat0, lat1, lat0 + t * (lat1 - lat0), lat0 + t * (lat1 - lat0)};
+		double lon[4] = {lon0 + t * (lon1 - lon0), lon0 + t * (lon1 - lon0), lon0, lon1};
+		for(int k = 0; k < 4; k++)
+		{
+			double e, n;
+			projection.forward(lat[k], lon[k], e, n);
+			e0 = std::min(e0, e);
+			n0 = std::min(n0, n);
+			e1 = std::max(e1, e);
+			n1 = std::max(n1, n);
+		}
+	}
+
+	uint32_t sizeNorthing = std::ceil((n1 - n0) / precision) + 1;
+	uint32_t sizeEasting = std::ceil((e1 - e0) / precision) + 1;
+	initialize(e0, n0, e0 + (sizeEasting - 1) * precision, n0 + (sizeNorthing - 1) * precision, sizeNorthing, sizeEasting);
+
+	printf("[ElevationUTMRegion] Creating region in zone %d from precision %f -> %d %d\n", projection.getZone(), precision, sizeLat, sizeLon);
+}
+
+eleman::ElevationUTMRegion::~ElevationUTMRegion()
+{
+
+}
+
+void eleman::ElevationUTMRegion::initialize(double easting0, double northing0, double easting1, double northing1, uint32_t gridSizeNorthing, uint32_t gridSizeEasting)
+{
+	if(gridSizeNorthing < 2 || gridSizeEasting < 2)
+		throw std::runtime_error("[ElevationUTMRegion] grid needs at least two samples per direction");
+
+	this->easting0 = easting0;
+	this->northing0 = northing0;
+	this->easting1 = easting1;
+	this->northing1 = northing1;
+	this->sizeLat = gridSizeNorthing;
+	this->sizeLon = gridSizeEasting;
+
+	// Lat/lon bounding box of the rectangle, slightly enlarged so the sampled outline does not cut off bulges
+	const int steps = 64;
+	lat0 = lon0 = INFINITY;
+	lat1 = lon1 = -INFINITY;
+	for(int i = 0; i <= steps; i++)
+	{
+		double t = double(i) / steps;
+		double e[4] = {easting0, easting1, easting0 + t * (easting1 - easting0), easting0 + t * (easting1 - easting0)};
+		double n[4] = {northing0 + t * (northing1 - northing0), northing0 + t * (northing1 - northing0), northing0, northing1};
+		for(int k = 0; k < 4; k++)
+		{
+			double lat, lon;
+			projection.inverse(e[k], n[k], lat, lon);
+			lat0 = std::min(lat0, lat);
+			lon0 = std::min(lon0, lon);
+			lat1 = std::max(lat1, lat);
+			lon1 = std::max(lon1, lon);
+		}
+	}
+	double marginLat = (lat1 - lat0) * 1e-4;
+	double marginLon = (lon1 - lon0) * 1e-4;
+	lat0 -= marginLat;
+	lat1 += marginLat;
+	lon0 -= marginLon;
+	lon1 += marginLon;
+
+	elevationData = std::make_shared<Grid<double>>(sizeLon, sizeLat, NAN);
+}
+
+
+void eleman::ElevationUTMRegion::gridToPos(uint32_t gridLat, uint32_t gridLon, double& latitude, double& longitude) const
+{
+	gridFloatToPos(gridLat, gridLon, latitude, longitude);
+}
+
+void eleman::ElevationUTMRegion::posToGrid(double latitude, double longitude, uint32_t& gridLat, uint32_t& gridLon) const
+{
+	double gridFloatLat, gridFloatLon;
+	posToGridFloat(latitude, longitude, gridFloatLat, gridFloatLon);
+	gridLat = round(gridFloatLat);
+	gridLon = round(gridFloatLon);
+}
+
+void eleman::ElevationUTMRegion::gridFloatToPos(double gridFloatLat, double gridFloatLon, double& latitude, double& longitude) const
+{
+	double easting, northing;
+	gridToUTM(gridFloatLat, gridFloatLon, easting, northing);
+	projection.inverse(easting, northing, latitude, longitude);
+}
+
+void eleman::ElevationUTMRegion::posToGridFloat(double latitude, double longitude, double& gridFloatLat, double& gridFloatLon) const
+{
+	double easting, northing;
+	projection.forward(latitude, longitude, easting, northing);
+	utmToGrid(easting, northing, gridFloatLat, gridFloatLon);
+}
+
+void eleman::ElevationUTMRegion::gridRowToPos(uint32_t gridLat, double* latitude, double* longitude) const
+{
+	// Rows are filled one after another, spawning threads for every row would cost more than it saves
+	double northing = interpolate(gridLat, 0.0, northing0, sizeLat - 1.0, northing1);
+	for(uint32_t x = 0; x < sizeLon; x++)
+		projection.inverse(interpolate(x, 0.0, easting0, sizeLon - 1.0, easting1), northing, latitude[x], longitude[x]);
+}
+
+void eleman::ElevationUTMRegion::gridSpacing(uint32_t, double& metersLon, double& metersLat) const
+{
+	metersLon = std::abs(easting1 - easting0) / (sizeLon - 1.0);
+	metersLat = std::abs(northing1 - northing0) / (sizeLat - 1.0);
+}
+
+void eleman::ElevationUTMRegion::gridToUTM(double gridFloatNorthing, double gridFloatEasting, double& easting, double& northing) const
+{
+	easting = interpolate(gridFloatEasting, 0.0, easting0, sizeLon - 1.0, easting1);
+	northing = interpolate(gridFloatNorthing, 0.0, northing0, sizeLat - 1.0, northing1);
+}
+
+void eleman::ElevationUTMRegion::utmToGrid(double easting, double northing, double& gridFloatNorthing, double& gridFloatEasting) const
+{
+	gridFloatEasting = interpolate(easting, easting0, 0.0, easting1, sizeLon - 1.0);
+	gridFloatNorthing = interpolate(northing, northing0, 0.0, northing1, sizeLat - 1.0);
+}
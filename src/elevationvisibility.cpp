@@ -0,0 +1,324 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/elevationvisibility.h"
+
+#include "eleman/elevationcache.h"
+#include "eleman/elevationutils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+// Mean earth radius in meters
+static const double EARTH_RADIUS = 6371000.0;
+
+// Amount of ray samples checked against the pyramid at once
+static const uint32_t CHUNK_SIZE = 32;
+
+
+eleman::ElevationVisibility::ElevationVisibility(ElevationCache* cache)
+{
+	this->cache = cache;
+}
+
+eleman::ElevationVisibility::~ElevationVisibility()
+{
+
+}
+
+bool eleman::ElevationVisibility::lineOfSight(Position from, double fromHeight, Position to, double toHeight)
+{
+	return lineOfSight({from, fromHeight, to, toHeight});
+}
+
+bool eleman::ElevationVisibility::lineOfSight(const SightLine& line)
+{
+	std::vector<SightLine> lines = {line};
+	std::vector<double> groundFrom, groundTo;
+	prepare(lines, groundFrom, groundTo);
+	return trace(line, groundFrom[0], groundTo[0]);
+}
+
+std::vector<uint8_t> eleman::ElevationVisibility::lineOfSight(const std::vector<SightLine>& lines)
+{
+	std::vector<double> groundFrom, groundTo;
+	prepare(lines, groundFrom, groundTo);
+
+	// Cells are loaded and their pyramids built, workers only read from here on
+	std::vector<uint8_t> visible(lines.size());
+	parallelFor(0, lines.size(), [&](uint32_t begin, uint32_t end)
+	{
+		for(uint32_t i = begin; i < end; i++)
+			visible[i] = trace(lines[i], groundFrom[i], groundTo[i]);
+	});
+	return visible;
+}
+
+Grid<uint8_t> eleman::ElevationVisibility::viewshed(const ElevationRegion& terrain, Position observer, double observerHeight, double targetHeight, double radius) const
+{
+	uint32_t width = terrain.getGridSizeLon();
+	uint32_t height = terrain.getGridSizeLat();
+
+	double oy, ox;
+	terrain.posToGridFloat(observer.latitude, observer.longitude, oy, ox);
+	if(ox < 0.0 || ox > width - 1.0 || oy < 0.0 || oy > height - 1.0)
+		throw std::runtime_error("[ElevationVisibility] observer outside of terrain");
+
+	double ground = terrain.getGridLinear(oy, ox);
+	if(std::isnan(ground))
+		throw std::runtime_error("[ElevationVisibility] no elevation known at observer");
+	double zObserver = ground + observerHeight;
+
+	// Meters per grid step around the observer
+	double metersX, metersY;
+	terrain.gridSpacing(round(oy), metersX, metersY);
+
+	// Area of interest in grid coordinates
+	double minX = 0.0, maxX = width - 1.0;
+	double minY = 0.0, maxY = height - 1.0;
+	if(radius > 0.0)
+	{
+		minX = std::max(minX, floor(ox - radius / metersX));
+		maxX = std::min(maxX, ceil(ox + radius / metersX));
+		minY = std::max(minY, floor(oy - radius / metersY));
+		maxY = std::min(maxY, ceil(oy + radius / metersY));
+	}
+
+	// One ray to every sample on the perimeter of the area
+	std::vector<std::pair<uint32_t, uint32_t>> targets;
+	for(uint32_t x = minX; x <= maxX; x++)
+	{
+		targets.push_back({x, minY});
+		if(maxY > minY) targets.push_back({x, maxY});
+	}
+	for(uint32_t y = minY + 1; y + 1 <= maxY; y++)
+	{
+		targets.push_back({minX, y});
+		if(maxX > minX) targets.push_back({maxX, y});
+	}
+
+	// Build pyramid before the workers start reading from it
+	terrain.getPyramid();
+
+	Grid<uint8_t> visible(width, height, 0);
+	visible.set(round(ox), round(oy), 1);
+	std::mutex visibleMutex;
+
+	parallelFor(0, targets.size(), [&](uint32_t begin, uint32_t end)
+	{
+		Grid<uint8_t> local(width, height, 0);
+
+		for(uint32_t target = begin; target < end; target++)
+		{
+			double rayX = targets[target].first - ox;
+			double rayY = targets[target].second - oy;
+			uint32_t steps = ceil(std::max(std::abs(rayX), std::abs(rayY)));
+			if(steps == 0) continue;
+
+			auto distance = [&](uint32_t step) {
+				double t = double(step) / steps;
+				return std::hypot(rayX * t * metersX, rayY * t * metersY);
+			};
+
+			// Upper bound of the elevation angle any sample between both steps can reach
+			auto bound = [&](uint32_t step0, uint32_t step1) {
+				double t0 = double(step0) / steps;
+				double t1 = double(step1) / steps;
+				uint32_t x0 = std::max(floor(std::min(ox + rayX * t0, ox + rayX * t1)), 0.0);
+				uint32_t x1 = std::min(ceil(std::max(ox + rayX * t0, ox + rayX * t1)), width - 1.0);
+				uint32_t y0 = std::max(floor(std::min(oy + rayY * t0, oy + rayY * t1)), 0.0);
+				uint32_t y1 = std::min(ceil(std::max(oy + rayY * t0, oy + rayY * t1)), height - 1.0);
+
+				double zMax = terrain.maxGrid(x0, y0, x1, y1);
+				if(std::isnan(zMax)) return -std::numeric_limits<double>::infinity();
+
+				double d0 = distance(step0);
+				double d1 = distance(step1);
+				double rise = zMax + targetHeight - curvature(d0) - zObserver;
+				return rise >= 0.0 ? rise / d0 : rise / d1;
+			};
+
+			double horizon = -std::numeric_limits<double>::infinity();
+			for(uint32_t step0 = 1; step0 <= steps; step0 += CHUNK_SIZE)
+			{
+				uint32_t step1 = std::min(step0 + CHUNK_SIZE - 1, steps);
+
+				// Nothing behind can be seen anymore
+				if(bound(step0, steps) < horizon) break;
+				// Nothing in this chunk can be seen or raise the horizon
+				if(bound(step0, step1) < horizon) continue;
+
+				bool outside = false;
+				for(uint32_t step = step0; step <= step1; step++)
+				{
+					double d = distance(step);
+					if(radius > 0.0 && d > radius)
+					{
+						outside = true;
+						break;
+					}
+
+					double t = double(step) / steps;
+					double x = ox + rayX * t;
+					double y = oy + rayY * t;
+					double z = terrain.getGridLinear(y, x);
+					if(std::isnan(z)) continue;
+
+					double rise = z - curvature(d) - zObserver;
+					if((rise + targetHeight) / d >= horizon)
+						local.set(round(x), round(y), 1);
+					horizon = std::max(horizon, rise / d);
+				}
+				if(outside) break;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(visibleMutex);
+		for(uint32_t y = 0; y < height; y++)
+		{
+			uint8_t* out = visible.row(y);
+			const uint8_t* in = local.row(y);
+			for(uint32_t x = 0; x < width; x++)
+				out[x] |= in[x];
+		}
+	});
+
+	return visible;
+}
+
+eleman::Viewshed eleman::ElevationVisibility::viewshed(Position observer, double observerHeight, double radius, double targetHeight)
+{
+	double radiusLat = meters2degrees(radius, 0.0);
+	double radiusLon = meters2degrees(radius, observer.latitude);
+
+	ElevationRegion terrain = cache->get(observer.latitude - radiusLat, observer.longitude - radiusLon,
+										 observer.latitude + radiusLat, observer.longitude + radiusLon,
+										 cache->getPrecision());
+	Grid<uint8_t> visible = viewshed(terrain, observer, observerHeight, targetHeight, radius);
+	return {terrain, visible};
+}
+
+void eleman::ElevationVisibility::setRefraction(double refraction)
+{
+	this->refraction = refraction;
+}
+
+double eleman::ElevationVisibility::getRefraction() const
+{
+	return refraction;
+}
+
+
+double eleman::ElevationVisibility::curvature(double distance) const
+{
+	return distance * distance * (1.0 - refraction) / (2.0 * EARTH_RADIUS);
+}
+
+double eleman::ElevationVisibility::sample(double latitude, double longitude, const ElevationCacheCell*& cell) const
+{
+	// prepare() loaded every cell, lookups from the worker threads must not touch the access counts
+	if(cell == nullptr || !cell->contains(latitude, longitude))
+		cell = cache->findCell(ElevationCache::toCellID(latitude, longitude, cache->getCellDivisions()));
+
+	double gridLat, gridLon;
+	cell->posToGridFloat(latitude, longitude, gridLat, gridLon);
+	return cell->getGridLinear(gridLat, gridLon);
+}
+
+void eleman::ElevationVisibility::prepare(const std::vector<SightLine>& lines, std::vector<double>& groundFrom, std::vector<double>& groundTo)
+{
+	uint16_t cellDivisions = cache->getCellDivisions();
+
+	// Load every cell a line passes through
+	std::set<uint64_t> ids;
+	for(const SightLine& line : lines)
+	{
+		uint64_t x0, y0, x1, y1;
+		ElevationCache::toCellXY(line.from.latitude, line.from.longitude, cellDivisions, x0, y0);
+		ElevationCache::toCellXY(line.to.latitude, line.to.longitude, cellDivisions, x1, y1);
+		for(uint64_t y = std::min(y0, y1); y <= std::max(y0, y1); y++)
+		{
+			for(uint64_t x = std::min(x0, x1); x <= std::max(x0, x1); x++)
+				ids.insert(ElevationCache::toCellID(x, y, cellDivisions));
+		}
+	}
+	cache->loadCells(std::vector<uint64_t>(ids.begin(), ids.end()));
+
+	// Ground elevation at both ends is required, request it if it is not cached yet
+	auto ground = [&](const Position& pos) {
+		const ElevationCacheCell* cell = nullptr;
+		double elevation = sample(pos.latitude, pos.longitude, cell);
+		if(std::isnan(elevation))
+			elevation = cache->getCell(cell->getID())->get(pos.latitude, pos.longitude);
+		return elevation;
+	};
+
+	groundFrom.resize(lines.size());
+	groundTo.resize(lines.size());
+	for(size_t i = 0; i < lines.size(); i++)
+	{
+		groundFrom[i] = ground(lines[i].from);
+		groundTo[i] = ground(lines[i].to);
+	}
+
+	// Built last, writes of the ground lookups may invalidate them and the workers must not build them concurrently
+	for(uint64_t id : ids)
+		cache->getCell(id)->getPyramid();
+}
+
+bool eleman::ElevationVisibility::trace(const SightLine& line, double groundFrom, double groundTo) const
+{
+	double dLat = line.to.latitude - line.from.latitude;
+	double dLon = line.to.longitude - line.from.longitude;
+	double midLat = (line.from.latitude + line.to.latitude) / 2.0;
+	double length = std::hypot(degrees2meters(dLat, 0.0), degrees2meters(dLon, midLat));
+	if(length <= 0.0) return true;
+
+	// Straight sight line after moving the curvature drop onto the terrain
+	double zFrom = groundFrom + line.fromHeight;
+	double zTo = groundTo + line.toHeight - curvature(length);
+	auto sight = [&](double t) { return zFrom + (zTo - zFrom) * t; };
+
+	uint32_t steps = std::max(ceil(length / cache->getPrecision()), 1.0);
+	const ElevationCacheCell* cell = nullptr;
+	for(uint32_t step0 = 1; step0 < steps; step0 += CHUNK_SIZE)
+	{
+		uint32_t step1 = std::min(step0 + CHUNK_SIZE - 1, steps - 1);
+		double t0 = double(step0) / steps;
+		double t1 = double(step1) / steps;
+		double lat0 = line.from.latitude + dLat * t0;
+		double lon0 = line.from.longitude + dLon * t0;
+		double lat1 = line.from.latitude + dLat * t1;
+		double lon1 = line.from.longitude + dLon * t1;
+
+		// Skip the chunk if it lies within one cell and its highest sample stays below the sight line
+		sample(lat0, lon0, cell);
+		if(cell->contains(lat1, lon1))
+		{
+			double gridLat0, gridLon0, gridLat1, gridLon1;
+			cell->posToGridFloat(lat0, lon0, gridLat0, gridLon0);
+			cell->posToGridFloat(lat1, lon1, gridLat1, gridLon1);
+			uint32_t x0 = std::max(floor(std::min(gridLon0, gridLon1)), 0.0);
+			uint32_t y0 = std::max(floor(std::min(gridLat0, gridLat1)), 0.0);
+			uint32_t x1 = std::min(ceil(std::max(gridLon0, gridLon1)), cell->getGridSizeLon() - 1.0);
+			uint32_t y1 = std::min(ceil(std::max(gridLat0, gridLat1)), cell->getGridSizeLat() - 1.0);
+
+			double zMax = cell->maxGrid(x0, y0, x1, y1);
+			if(std::isnan(zMax) || zMax <= std::min(sight(t0), sight(t1)) + curvature(length * t0))
+				continue;
+		}
+
+		for(uint32_t step = step0; step <= step1; step++)
+		{
+			double t = double(step) / steps;
+			double z = sample(line.from.latitude + dLat * t, line.from.longitude + dLon * t, cell);
+			if(std::isnan(z)) continue;
+			if(z - curvature(length * t) > sight(t)) return false;
+		}
+	}
+	return true;
+}
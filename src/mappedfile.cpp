@@ -0,0 +1,83 @@
+// SPDX-FileCopyrightText: 2023 <rudolf.ortner> <rudolf.ortner.rottenbach@gmail.com>
+// SPDX-License-Identifier: MIT
+
+#include "eleman/mappedfile.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+eleman::MappedFile::MappedFile(const std::filesystem::path& filepath, size_t offset, size_t size, Mode mode)
+{
+	if(size == 0)
+		throw std::runtime_error("[MappedFile] can not map an empty range");
+	if(offset % pageSize() != 0)
+		throw std::runtime_error("[MappedFile] offset has to be a multiple of the page size");
+
+	this->size = size;
+	this->mode = mode;
+
+	int fd = mode == SHARED ? open(filepath.c_str(), O_RDWR | O_CREAT, 0644) : open(filepath.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("[MappedFile] could not open " + filepath.string() + ": " + strerror(errno));
+
+	struct stat status;
+	if(fstat(fd, &status) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("[MappedFile] could not stat " + filepath.string());
+	}
+
+	if(size_t(status.st_size) < offset + size)
+	{
+		// Only shared mappings may grow the file, new bytes read as zero
+		if(mode != SHARED || ftruncate(fd, offset + size) != 0)
+		{
+			close(fd);
+			throw std::runtime_error("[MappedFile] " + filepath.string() + " is too small for the requested range");
+		}
+	}
+
+	int protection = mode == READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+	int flags = mode == SHARED ? MAP_SHARED : MAP_PRIVATE;
+	data = mmap(nullptr, size, protection, flags, fd, offset);
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+
+	if(data == MAP_FAILED)
+		throw std::runtime_error("[MappedFile] could not map " + filepath.string() + ": " + strerror(errno));
+}
+
+eleman::MappedFile::~MappedFile()
+{
+	munmap(data, size);
+}
+
+void eleman::MappedFile::sync()
+{
+	if(mode != SHARED) return;
+	if(msync(data, size, MS_SYNC) != 0)
+		throw std::runtime_error(std::string("[MappedFile] could not sync mapping: ") + strerror(errno));
+}
+
+void eleman::MappedFile::prefetch(size_t offset, size_t size)
+{
+	// madvise needs a page aligned start
+	size_t begin = offset / pageSize() * pageSize();
+	size_t end = std::min(offset + size, this->size);
+	if(begin >= end) return;
+
+	madvise(static_cast<char*>(data) + begin, end - begin, MADV_WILLNEED);
+}
+
+size_t eleman::MappedFile::pageSize()
+{
+	static const size_t size = sysconf(_SC_PAGESIZE);
+	return size;
+}